@@ -0,0 +1,102 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "audio_clock.h"
+
+
+// Gains of the correction loop. The rate gain is chosen for critical damping
+// (rate_gain = phase_gain^2 / 4).
+static const double phase_gain = 0.1;
+static const double rate_gain = phase_gain * phase_gain / 4.0;
+// Limits for the rate. Real clock drift is far below this.
+static const double min_rate = 0.95;
+static const double max_rate = 1.05;
+// Prediction errors larger than this are discontinuities (e.g. underruns), not drift.
+static const double max_error = 250000.0;
+
+audio_clock::audio_clock()
+{
+    reset();
+}
+
+void audio_clock::reset()
+{
+    _valid = false;
+    _base_sys = 0;
+    _base_audio = 0.0;
+    _rate = 1.0;
+    _last_coarse = 0;
+    _last_reported = 0;
+}
+
+int64_t audio_clock::update(int64_t coarse, int64_t sys)
+{
+    if (!_valid)
+    {
+        _base_sys = sys;
+        _base_audio = coarse;
+        _rate = 1.0;
+        _last_coarse = coarse;
+        _last_reported = coarse;
+        _valid = true;
+        return coarse;
+    }
+
+    double predicted = _base_audio + _rate * (sys - _base_sys);
+    if (coarse != _last_coarse)
+    {
+        // The coarse time just changed, so this is the best moment to compare it
+        // with the prediction.
+        _last_coarse = coarse;
+        double error = coarse - predicted;
+        if (std::fabs(error) > max_error)
+        {
+            _base_audio = coarse;
+            _rate = 1.0;
+        }
+        else
+        {
+            double dt = sys - _base_sys;
+            _base_audio = predicted + phase_gain * error;
+            if (dt > 0.0)
+            {
+                _rate = std::min(std::max(_rate + rate_gain * error / dt, min_rate), max_rate);
+            }
+        }
+        _base_sys = sys;
+        predicted = _base_audio;
+    }
+    _last_reported = std::max(_last_reported, static_cast<int64_t>(predicted + 0.5));
+    return _last_reported;
+}
+
+void audio_clock::rebase(int64_t sys)
+{
+    if (_valid)
+    {
+        _base_sys = sys;
+        _base_audio = _last_reported;
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_CLOCK_H
+#define AUDIO_CLOCK_H
+
+#include <stdint.h>
+
+
+/*
+ * The audio clock estimates the current audio time with high resolution.
+ *
+ * Audio devices usually report their playback position in relatively large
+ * steps (e.g. once per mixing period). The audio clock combines these coarse
+ * positions with the system time: it predicts the audio time from a linear
+ * model (offset and rate relative to the system time), and corrects this model
+ * a little each time the coarse position changes. The rate correction
+ * compensates for drift between the audio device clock and the system clock.
+ *
+ * The reported time never runs backwards. All times are in microseconds.
+ */
+
+class audio_clock
+{
+private:
+    bool _valid;                        // Do we have a model?
+    int64_t _base_sys;                  // System time of the model base point
+    double _base_audio;                 // Audio time at the model base point
+    double _rate;                       // Audio time per system time
+    int64_t _last_coarse;               // Last coarse audio time
+    int64_t _last_reported;             // Last reported audio time
+
+public:
+    audio_clock();
+
+    /* Forget everything, e.g. when playback (re)starts. */
+    void reset();
+
+    /* Feed the coarse audio time that was observed at the given system time,
+     * and return the estimated audio time at that system time. */
+    int64_t update(int64_t coarse, int64_t sys);
+
+    /* Continue the estimation from the last reported time at the given system
+     * time, e.g. after the audio was paused. */
+    void rebase(int64_t sys);
+};
+
+#endif
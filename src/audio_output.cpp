@@ -21,6 +21,7 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "audio_output.h"
@@ -30,20 +31,52 @@
 #include "str.h"
 #include "msg.h"
 #include "timer.h"
+#include "trace.h"
 #include "dbg.h"
 
 
 /* This code is adapted from the alffmpeg.c example available here:
  * http://kcat.strangesoft.net/alffmpeg.c (as of 2010-09-12). */
 
-// These number should fit for most formats; see comments in the alffmpeg.c example.
-const size_t audio_output::_num_buffers = 3;
-const size_t audio_output::_buffer_size = 20160;
+// Buffer sizes must be multiples of all possible frame sizes (1-8 channels with
+// 1, 2, 4, or 8 bytes per sample), so that a buffer never splits a frame. This is
+// the least common multiple of these frame sizes: lcm(1, ..., 8) * 8.
+static const size_t buffer_size_unit = 6720;
+
+// Time without underruns after which the buffer size is reduced again.
+static const int64_t stable_period = 30000000;
 
 audio_output::audio_output(bool receive_notifications) :
     controller(receive_notifications),
     _initialized(false)
 {
+    set_buffering(normal);
+}
+
+void audio_output::set_buffering(buffering_t buffering)
+{
+    assert(!_initialized);
+    _buffering = buffering;
+    switch (buffering)
+    {
+    case low_latency:
+        _num_buffers = 3;
+        _min_buffer_size = 1 * buffer_size_unit;
+        break;
+    case normal:
+        // These numbers should fit for most formats; see comments in the alffmpeg.c example.
+        _num_buffers = 3;
+        _min_buffer_size = 3 * buffer_size_unit;
+        break;
+    case robust:
+        _num_buffers = 4;
+        _min_buffer_size = 6 * buffer_size_unit;
+        break;
+    }
+    _max_buffer_size = 8 * _min_buffer_size;
+    _buffer_size = _min_buffer_size;
+    _underruns = 0;
+    _last_adjustment = std::numeric_limits<int64_t>::min();
 }
 
 audio_output::~audio_output()
@@ -66,7 +99,14 @@ void audio_output::init()
         }
         alcMakeContextCurrent(_context);
         set_openal_versions();
+        alcGetIntegerv(_device, ALC_FREQUENCY, 1, &_device_rate);
+        if (alcGetError(_device) != ALC_NO_ERROR)
+        {
+            _device_rate = 0;
+        }
         _buffers.resize(_num_buffers);
+        _buffer_rates.resize(_num_buffers);
+        _buffer_durations.resize(_num_buffers);
         alGenBuffers(_num_buffers, &(_buffers[0]));
         if (alGetError() != AL_NO_ERROR)
         {
@@ -158,6 +198,11 @@ int64_t audio_output::status(bool *need_data)
                 {
                     throw exc("Cannot restart OpenAL source playback.");
                 }
+                if (_state == AL_STOPPED)
+                {
+                    // The source ran out of data before we could refill it.
+                    adjust_buffer_size(true);
+                }
             }
             if (need_data)
             {
@@ -174,139 +219,132 @@ int64_t audio_output::status(bool *need_data)
         ALint offset;
         alGetSourcei(_source, AL_SAMPLE_OFFSET, &offset);
         /* The time inside the current buffer */
-        int64_t timestamp = static_cast<int64_t>(offset) * 1000000 / _buffer_rates[0];
+        int64_t timestamp = static_cast<int64_t>(offset) * 1000000 / _buffer_rates[_buffer_ring_head];
         /* Add the time for all past buffers */
         timestamp += _past_time;
         /* This timestamp unfortunately only grows in relatively large steps. This is
-         * too imprecise for syncing a video stream with. Therefore, we use an external
-         * time source between two timestamp steps. In case this external time runs
-         * faster than the audio time, we also need to make sure that we do not report
-         * timestamps that run backwards. */
-        if (timestamp != _last_timestamp)
-        {
-            _last_timestamp = timestamp;
-            _ext_timer_at_last_timestamp = timer::get_microseconds(timer::monotonic);
-            _last_reported_timestamp = std::max(_last_reported_timestamp, timestamp);
-            return _last_reported_timestamp;
-        }
-        else
-        {
-            _last_reported_timestamp = _last_timestamp + (timer::get_microseconds(timer::monotonic) - _ext_timer_at_last_timestamp);
-            return _last_reported_timestamp;
-        }
+         * too imprecise for syncing a video stream with. Therefore, the audio clock
+         * refines it using the system time. */
+        return _clock.update(timestamp, timer::get_microseconds(timer::monotonic));
     }
 }
 
-ALenum audio_output::get_al_format(const audio_blob &blob)
+ALenum audio_output::find_al_format(int channels, audio_blob::sample_format_t sample_format)
 {
     ALenum format = 0;
-    if (blob.sample_format == audio_blob::u8)
+    if (sample_format == audio_blob::u8)
     {
-        if (blob.channels == 1)
+        if (channels == 1)
         {
             format = AL_FORMAT_MONO8;
         }
-        else if (blob.channels == 2)
+        else if (channels == 2)
         {
             format = AL_FORMAT_STEREO8;
         }
         else if (alIsExtensionPresent("AL_EXT_MCFORMATS"))
         {
-            if (blob.channels == 4)
+            if (channels == 4)
             {
                 format = alGetEnumValue("AL_FORMAT_QUAD8");
             }
-            else if (blob.channels == 6)
+            else if (channels == 6)
             {
                 format = alGetEnumValue("AL_FORMAT_51CHN8");
             }
-            else if (blob.channels == 7)
+            else if (channels == 7)
             {
                 format = alGetEnumValue("AL_FORMAT_71CHN8");
             }
-            else if (blob.channels == 8)
+            else if (channels == 8)
             {
                 format = alGetEnumValue("AL_FORMAT_81CHN8");
             }
         }
     }
-    else if (blob.sample_format == audio_blob::s16)
+    else if (sample_format == audio_blob::s16)
     {
-        if (blob.channels == 1)
+        if (channels == 1)
         {
             format = AL_FORMAT_MONO16;
         }
-        else if (blob.channels == 2)
+        else if (channels == 2)
         {
             format = AL_FORMAT_STEREO16;
         }
         else if (alIsExtensionPresent("AL_EXT_MCFORMATS"))
         {
-            if (blob.channels == 4)
+            if (channels == 4)
             {
                 format = alGetEnumValue("AL_FORMAT_QUAD16");
             }
-            else if (blob.channels == 6)
+            else if (channels == 6)
             {
                 format = alGetEnumValue("AL_FORMAT_51CHN16");
             }
-            else if (blob.channels == 7)
+            else if (channels == 7)
             {
                 format = alGetEnumValue("AL_FORMAT_61CHN16");
             }
-            else if (blob.channels == 8)
+            else if (channels == 8)
             {
                 format = alGetEnumValue("AL_FORMAT_71CHN16");
             }
         }
     }
-    else if (blob.sample_format == audio_blob::f32)
+    else if (sample_format == audio_blob::f32)
     {
         if (alIsExtensionPresent("AL_EXT_float32"))
         {
-            if (blob.channels == 1)
+            if (channels == 1)
             {
                 format = alGetEnumValue("AL_FORMAT_MONO_FLOAT32");
             }
-            else if (blob.channels == 2)
+            else if (channels == 2)
             {
                 format = alGetEnumValue("AL_FORMAT_STEREO_FLOAT32");
             }
             else if (alIsExtensionPresent("AL_EXT_MCFORMATS"))
             {
-                if (blob.channels == 4)
+                if (channels == 4)
                 {
                     format = alGetEnumValue("AL_FORMAT_QUAD32");
                 }
-                else if (blob.channels == 6)
+                else if (channels == 6)
                 {
                     format = alGetEnumValue("AL_FORMAT_51CHN32");
                 }
-                else if (blob.channels == 7)
+                else if (channels == 7)
                 {
                     format = alGetEnumValue("AL_FORMAT_61CHN32");
                 }
-                else if (blob.channels == 8)
+                else if (channels == 8)
                 {
                     format = alGetEnumValue("AL_FORMAT_71CHN32");
                 }
             }
         }
     }
-    else if (blob.sample_format == audio_blob::d64)
+    else if (sample_format == audio_blob::d64)
     {
         if (alIsExtensionPresent("AL_EXT_double"))
         {
-            if (blob.channels == 1)
+            if (channels == 1)
             {
                 format = alGetEnumValue("AL_FORMAT_MONO_DOUBLE_EXT");
             }
-            else if (blob.channels == 2)
+            else if (channels == 2)
             {
                 format = alGetEnumValue("AL_FORMAT_STEREO_DOUBLE_EXT");
             }
         }
     }
+    return format;
+}
+
+ALenum audio_output::get_al_format(const audio_blob &blob)
+{
+    ALenum format = find_al_format(blob.channels, blob.sample_format);
     if (format == 0)
     {
         throw exc(std::string("No OpenAL format available for audio data ")
@@ -315,25 +353,97 @@ ALenum audio_output::get_al_format(const audio_blob &blob)
     return format;
 }
 
-void audio_output::data(const audio_blob &blob)
+void audio_output::choose_output_format(const audio_blob &blob,
+        int *channels, int *rate, audio_blob::sample_format_t *sample_format)
 {
-    assert(blob.data);
+    // Sample format: u8 and s16 are always supported. Floating point data is
+    // played as f32 if possible, and as s16 otherwise.
+    *sample_format = blob.sample_format;
+    if (blob.sample_format == audio_blob::f32 || blob.sample_format == audio_blob::d64)
+    {
+        *sample_format = (find_al_format(std::min(blob.channels, 2), audio_blob::f32) != 0
+                ? audio_blob::f32 : audio_blob::s16);
+    }
+    // Channels: mono and stereo are always supported. Multichannel audio is
+    // downmixed to stereo if the device cannot take it directly.
+    *channels = blob.channels;
+    if (blob.channels > 2 && find_al_format(blob.channels, *sample_format) == 0)
+    {
+        *channels = 2;
+    }
+    // Rate: OpenAL resamples by itself, but high rates are brought down to the
+    // mixing frequency here, which saves both bandwidth and resampling work.
+    *rate = blob.rate;
+    if (_device_rate > 0 && blob.rate > _device_rate)
+    {
+        *rate = _device_rate;
+    }
+    // The conversion stage produces only s16 or f32 data. If it has to
+    // downmix or resample u8 data, the result is s16.
+    if (*sample_format == audio_blob::u8 && (*channels != blob.channels || *rate != blob.rate))
+    {
+        *sample_format = audio_blob::s16;
+    }
+}
+
+void audio_output::adjust_buffer_size(bool underrun)
+{
+    int64_t now = timer::get_microseconds(timer::monotonic);
+    if (underrun)
+    {
+        _underruns++;
+        if (_buffer_size < _max_buffer_size)
+        {
+            _buffer_size = std::min(2 * _buffer_size, _max_buffer_size);
+            msg::inf("Audio underrun; increasing audio buffer size to %d bytes.",
+                    static_cast<int>(_buffer_size));
+        }
+        _last_adjustment = now;
+    }
+    else if (_buffer_size > _min_buffer_size
+            && (_last_adjustment == std::numeric_limits<int64_t>::min()
+                || now - _last_adjustment > stable_period))
+    {
+        _buffer_size = std::max(_buffer_size / buffer_size_unit * 3 / 4 * buffer_size_unit, _min_buffer_size);
+        msg::dbg("Audio playback is stable; decreasing audio buffer size to %d bytes.",
+                static_cast<int>(_buffer_size));
+        _last_adjustment = now;
+    }
+}
+
+void audio_output::data(const audio_blob &input_blob)
+{
+    TRACE_SCOPE("audio data");
+    assert(input_blob.data);
+    MSG_DBG(std::string("Buffering ") + str::from(input_blob.size) + " bytes of audio data.");
+    audio_blob blob = input_blob;
+    int channels, rate;
+    audio_blob::sample_format_t sample_format;
+    choose_output_format(blob, &channels, &rate, &sample_format);
+    _processor.process(blob, channels, rate, sample_format);
     ALenum format = get_al_format(blob);
-    msg::dbg(std::string("Buffering ") + str::from(blob.size) + " bytes of audio data.");
     if (_state == 0)
     {
-        // Initial buffering
-        assert(blob.size == _num_buffers * _buffer_size);
+        // Initial buffering. The blob size may differ from
+        // required_initial_data_size() if it was read ahead (e.g. for the
+        // next playlist item) before the buffer size was adjusted.
+        assert(input_blob.size > 0);
+        size_t frame_size = blob.channels * blob.sample_bits() / 8;
+        size_t size = blob.size / _num_buffers / frame_size * frame_size;
         char *data = static_cast<char *>(blob.data);
         for (size_t j = 0; j < _num_buffers; j++)
         {
-            _buffer_channels.push_back(blob.channels);
-            _buffer_sample_bits.push_back(blob.sample_bits());
-            _buffer_rates.push_back(blob.rate);
-            alBufferData(_buffers[j], format, data, _buffer_size, blob.rate);
+            if (j == _num_buffers - 1)
+            {
+                size = static_cast<char *>(blob.data) + blob.size - data;
+            }
+            _buffer_rates[j] = blob.rate;
+            _buffer_durations[j] = static_cast<int64_t>(size / frame_size) * 1000000 / blob.rate;
+            alBufferData(_buffers[j], format, data, size, blob.rate);
             alSourceQueueBuffers(_source, 1, &(_buffers[j]));
-            data += _buffer_size;
+            data += size;
         }
+        _buffer_ring_head = 0;
         if (alGetError() != AL_NO_ERROR)
         {
             throw exc("Cannot buffer initial OpenAL data.");
@@ -341,29 +451,25 @@ void audio_output::data(const audio_blob &blob)
     }
     else if (blob.size > 0)
     {
-        // Replace one buffer
-        assert(blob.size == _buffer_size);
+        // Replace one buffer. Note that the size of the blob may differ from the
+        // current _buffer_size if that was adjusted after the blob was requested.
         ALuint buf = 0;
         alSourceUnqueueBuffers(_source, 1, &buf);
         assert(buf != 0);
-        alBufferData(buf, format, blob.data, _buffer_size, blob.rate);
+        alBufferData(buf, format, blob.data, blob.size, blob.rate);
         alSourceQueueBuffers(_source, 1, &buf);
         if (alGetError() != AL_NO_ERROR)
         {
             throw exc("Cannot buffer OpenAL data.");
         }
         // Update the time spent on all past buffers
-        int64_t current_buffer_samples = _buffer_size / _buffer_channels[0] * 8 / _buffer_sample_bits[0];
-        int64_t current_buffer_time = current_buffer_samples * 1000000 / _buffer_rates[0];
-        _past_time += current_buffer_time;
-        // Remove current buffer entries
-        _buffer_channels.erase(_buffer_channels.begin());
-        _buffer_sample_bits.erase(_buffer_sample_bits.begin());
-        _buffer_rates.erase(_buffer_rates.begin());
-        // Add entries for the new buffer
-        _buffer_channels.push_back(blob.channels);
-        _buffer_sample_bits.push_back(blob.sample_bits());
-        _buffer_rates.push_back(blob.rate);
+        _past_time += _buffer_durations[_buffer_ring_head];
+        // The new buffer replaces the finished one at the end of the ring
+        size_t frame_size = blob.channels * blob.sample_bits() / 8;
+        _buffer_rates[_buffer_ring_head] = blob.rate;
+        _buffer_durations[_buffer_ring_head] = static_cast<int64_t>(blob.size / frame_size) * 1000000 / blob.rate;
+        _buffer_ring_head = (_buffer_ring_head + 1) % _num_buffers;
+        adjust_buffer_size(false);
     }
 }
 
@@ -378,10 +484,8 @@ int64_t audio_output::start()
         throw exc("Cannot start OpenAL source playback.");
     }
     _past_time = 0;
-    _last_timestamp = 0;
-    _ext_timer_at_last_timestamp = timer::get_microseconds(timer::monotonic);
-    _last_reported_timestamp = _last_timestamp;
-    return _last_timestamp;
+    _clock.reset();
+    return _clock.update(0, timer::get_microseconds(timer::monotonic));
 }
 
 void audio_output::pause()
@@ -400,6 +504,8 @@ void audio_output::unpause()
     {
         throw exc("Cannot unpause OpenAL source playback.");
     }
+    // The audio time did not advance during the pause
+    _clock.rebase(timer::get_microseconds(timer::monotonic));
 }
 
 void audio_output::stop()
@@ -422,5 +528,7 @@ void audio_output::stop()
         }
         alGetSourcei(_source, AL_BUFFERS_PROCESSED, &processed_buffers);
     }
+    _buffer_ring_head = 0;
+    _processor.reset();
     _state = 0;
 }
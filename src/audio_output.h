@@ -35,14 +35,33 @@
 
 #include "media_data.h"
 #include "controller.h"
+#include "audio_processor.h"
+#include "audio_clock.h"
 
 
 class audio_output : public controller
 {
+public:
+    // Buffering modes
+    typedef enum
+    {
+        low_latency,    // Few small buffers
+        normal,         // Default
+        robust          // More and larger buffers, for busy systems
+    } buffering_t;
+
 private:
-    // Static configuration
-    static const size_t _num_buffers;   // Number of audio buffers
-    static const size_t _buffer_size;   // Size of each audio buffer
+    // Buffer configuration
+    buffering_t _buffering;             // Buffering mode
+    size_t _num_buffers;                // Number of audio buffers
+    size_t _min_buffer_size;            // Lower limit for _buffer_size (from the buffering mode)
+    size_t _max_buffer_size;            // Upper limit for _buffer_size
+    size_t _buffer_size;                // Size of the audio data requested for each buffer
+
+    // Automatic adjustment of the buffer size: it grows on underruns, and shrinks
+    // back when playback was stable for some time.
+    int _underruns;                     // Number of underruns observed so far
+    int64_t _last_adjustment;           // Time of the last buffer size adjustment
 
     // OpenAL things
     bool _initialized;                  // Was this initialized?
@@ -51,24 +70,41 @@ private:
     std::vector<ALuint> _buffers;       // Buffer handles
     ALuint _source;                     // Audio source
     ALint _state;                       // State of audio source
+    ALCint _device_rate;                // Mixing frequency of the device (or 0 if unknown)
 
-    // Properties of the audio data in the current buffers
-    std::vector<int64_t> _buffer_channels;      // Number of channels
-    std::vector<int64_t> _buffer_sample_bits;   // Number of sample bits
+    // Conversion of the audio data to a format that the device can play
+    audio_processor _processor;
+
+    // Properties of the audio data in the queued buffers. These form a ring
+    // with _num_buffers entries, in the order in which the buffers are played.
     std::vector<int64_t> _buffer_rates;         // Sample rate in Hz
+    std::vector<int64_t> _buffer_durations;     // Duration in microseconds
+    size_t _buffer_ring_head;                   // Entry of the buffer that is currently playing
 
     // Time management
     int64_t _past_time;                 // Time that represents all finished buffers
-    int64_t _last_timestamp;            // 
-    int64_t _ext_timer_at_last_timestamp;
-    int64_t _last_reported_timestamp;
+    audio_clock _clock;                 // High resolution estimate of the audio time
 
+    // Get an OpenAL source format for the given audio data properties (or 0 if none is available)
+    ALenum find_al_format(int channels, audio_blob::sample_format_t sample_format);
     // Get an OpenAL source format for the audio data in blob (or throw an exception)
     ALenum get_al_format(const audio_blob &blob);
+    // Choose the format that the audio data in blob is converted to before playing it
+    void choose_output_format(const audio_blob &blob,
+            int *channels, int *rate, audio_blob::sample_format_t *sample_format);
+    // Adjust the buffer size after an underrun, or after a stable period
+    void adjust_buffer_size(bool underrun);
 
 public:
     audio_output(bool receive_notifications = false);
     ~audio_output();
+
+    /* Set the buffering mode. This must be done before init(). */
+    void set_buffering(buffering_t buffering);
+    buffering_t buffering() const
+    {
+        return _buffering;
+    }
     
     /* Initialize the audio device for output. Throw an exception if this fails. */
     void init();
@@ -78,7 +114,8 @@ public:
     /* To play audio, do the following:
      * - First, call required_initial_data_size() to find out the initial amount
      *   of audio data that is required.
-     * - Then provide exactly this amount of data using the data() function.
+     * - Then provide this amount of data using the data() function (a
+     *   different amount is accepted, e.g. for data that was read ahead).
      * - Then start audio playback using start(). This function returns the audio
      *   start time, in microseconds.
      * - Regularly call status() to get the current audio time and to be notified
@@ -86,7 +123,9 @@ public:
      *   required_update_data_size() using the data() function. The time position
      *   in the audio stream is the time returned by status() minus the start time
      *   that the start() function returned. You can also just query the time
-     *   without asking if more data is needed by passing NULL as need_data. */
+     *   without asking if more data is needed by passing NULL as need_data.
+     * Note that required_update_data_size() may change during playback, because the
+     * buffer size adapts to underruns. Always ask for the current value. */
     size_t required_initial_data_size() const;
     size_t required_update_data_size() const;
     int64_t status(bool *need_data);
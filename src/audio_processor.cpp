@@ -0,0 +1,325 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "dbg.h"
+
+#include "audio_processor.h"
+
+
+audio_processor::audio_processor()
+{
+    reset();
+}
+
+void audio_processor::reset()
+{
+    _resample_first = true;
+    _resample_pos = 0.0;
+    for (int c = 0; c < 8; c++)
+    {
+        _resample_last[c] = 0.0f;
+    }
+}
+
+void audio_processor::to_float(audio_blob &blob)
+{
+    if (blob.sample_format == audio_blob::f32)
+    {
+        return;
+    }
+    else if (blob.sample_format == audio_blob::d64)
+    {
+        // In place: the output is half the size of the input, and each
+        // iteration reads its input before writing its output.
+        size_t n = blob.size / sizeof(double);
+        const double *src = static_cast<const double *>(blob.data);
+        float *dst = static_cast<float *>(blob.data);
+        size_t i = 0;
+#ifdef __SSE2__
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+            __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+            _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i] = src[i];
+        }
+        blob.size = n * sizeof(float);
+    }
+    else
+    {
+        size_t n = blob.size / (blob.sample_format == audio_blob::s16 ? 2 : 1);
+        if (_float_buf.size() < n * sizeof(float))
+        {
+            _float_buf.resize(n * sizeof(float));
+        }
+        float *dst = _float_buf.ptr<float>();
+        size_t i = 0;
+        if (blob.sample_format == audio_blob::s16)
+        {
+            const int16_t *src = static_cast<const int16_t *>(blob.data);
+#ifdef __SSE2__
+            const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+            for (; i + 8 <= n; i += 8)
+            {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+                __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+                __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+            }
+#endif
+            for (; i < n; i++)
+            {
+                dst[i] = src[i] / 32768.0f;
+            }
+        }
+        else
+        {
+            const uint8_t *src = static_cast<const uint8_t *>(blob.data);
+            for (; i < n; i++)
+            {
+                dst[i] = (static_cast<int>(src[i]) - 128) / 128.0f;
+            }
+        }
+        blob.data = dst;
+        blob.size = n * sizeof(float);
+    }
+    blob.sample_format = audio_blob::f32;
+}
+
+void audio_processor::downmix(audio_blob &blob, int channels)
+{
+    assert(blob.sample_format == audio_blob::f32);
+    assert(channels == 1 || channels == 2);
+    assert(channels < blob.channels && blob.channels <= 8);
+
+    // Left/right weights of each input channel, for the FFmpeg default channel
+    // layouts. LFE is dropped.
+    float m[8][2];
+    for (int c = 0; c < 8; c++)
+    {
+        m[c][0] = 0.0f;
+        m[c][1] = 0.0f;
+    }
+    const float s = static_cast<float>(M_SQRT1_2);
+    m[0][0] = 1.0f;                             // FL
+    m[1][1] = 1.0f;                             // FR
+    switch (blob.channels)
+    {
+    case 2:
+        break;
+    case 3:
+        m[2][0] = s; m[2][1] = s;               // FC
+        break;
+    case 4:
+        m[2][0] = s;                            // BL
+        m[3][1] = s;                            // BR
+        break;
+    case 5:
+        m[2][0] = s; m[2][1] = s;               // FC
+        m[3][0] = s;                            // BL
+        m[4][1] = s;                            // BR
+        break;
+    case 6:
+        m[2][0] = s; m[2][1] = s;               // FC
+        m[4][0] = s;                            // BL
+        m[5][1] = s;                            // BR
+        break;
+    case 7:
+        m[2][0] = s; m[2][1] = s;               // FC
+        m[4][0] = 0.5f; m[4][1] = 0.5f;         // BC
+        m[5][0] = s;                            // SL
+        m[6][1] = s;                            // SR
+        break;
+    case 8:
+        m[2][0] = s; m[2][1] = s;               // FC
+        m[4][0] = s;                            // BL
+        m[5][1] = s;                            // BR
+        m[6][0] = s;                            // SL
+        m[7][1] = s;                            // SR
+        break;
+    }
+    // Normalize so that the output cannot clip
+    float sum_l = 0.0f, sum_r = 0.0f;
+    for (int c = 0; c < blob.channels; c++)
+    {
+        sum_l += m[c][0];
+        sum_r += m[c][1];
+    }
+    for (int c = 0; c < blob.channels; c++)
+    {
+        m[c][0] /= sum_l;
+        m[c][1] /= sum_r;
+        if (channels == 1)
+        {
+            m[c][0] = (m[c][0] + m[c][1]) / 2.0f;
+        }
+    }
+
+    // In place: a frame is read completely before its output is written.
+    const int in_channels = blob.channels;
+    const size_t frames = blob.size / (in_channels * sizeof(float));
+    float *data = static_cast<float *>(blob.data);
+    for (size_t i = 0; i < frames; i++)
+    {
+        const float *in = data + i * in_channels;
+        float l = 0.0f, r = 0.0f;
+        for (int c = 0; c < in_channels; c++)
+        {
+            l += m[c][0] * in[c];
+            r += m[c][1] * in[c];
+        }
+        if (channels == 1)
+        {
+            data[i] = l;
+        }
+        else
+        {
+            data[2 * i] = l;
+            data[2 * i + 1] = r;
+        }
+    }
+    blob.channels = channels;
+    blob.size = frames * channels * sizeof(float);
+}
+
+void audio_processor::resample(audio_blob &blob, int rate)
+{
+    assert(blob.sample_format == audio_blob::f32);
+    assert(blob.channels >= 1 && blob.channels <= 8);
+
+    // Linear interpolation. The input is seen as the last frame of the previous
+    // blob followed by the frames of this blob, so that there are no gaps
+    // between blobs.
+    const int ch = blob.channels;
+    const size_t n = blob.size / (ch * sizeof(float));
+    const float *in = static_cast<const float *>(blob.data);
+    const double step = static_cast<double>(blob.rate) / rate;
+    if (n == 0)
+    {
+        return;
+    }
+    if (_resample_first)
+    {
+        for (int c = 0; c < ch; c++)
+        {
+            _resample_last[c] = in[c];
+        }
+        _resample_first = false;
+    }
+    size_t max_frames = static_cast<size_t>(std::ceil(n / step)) + 2;
+    if (_resample_buf.size() < max_frames * ch * sizeof(float))
+    {
+        _resample_buf.resize(max_frames * ch * sizeof(float));
+    }
+    float *out = _resample_buf.ptr<float>();
+    size_t out_frames = 0;
+    double pos = _resample_pos;
+    while (pos < static_cast<double>(n) && out_frames < max_frames)
+    {
+        size_t j = static_cast<size_t>(pos);
+        float f = pos - j;
+        const float *a = (j == 0 ? _resample_last : in + (j - 1) * ch);
+        const float *b = in + j * ch;
+        for (int c = 0; c < ch; c++)
+        {
+            out[c] = a[c] + f * (b[c] - a[c]);
+        }
+        out += ch;
+        out_frames++;
+        pos += step;
+    }
+    _resample_pos = pos - n;
+    for (int c = 0; c < ch; c++)
+    {
+        _resample_last[c] = in[(n - 1) * ch + c];
+    }
+    blob.data = _resample_buf.ptr();
+    blob.size = out_frames * ch * sizeof(float);
+    blob.rate = rate;
+}
+
+void audio_processor::to_s16(audio_blob &blob)
+{
+    assert(blob.sample_format == audio_blob::f32);
+
+    // In place: the output is half the size of the input.
+    size_t n = blob.size / sizeof(float);
+    const float *src = static_cast<const float *>(blob.data);
+    int16_t *dst = static_cast<int16_t *>(blob.data);
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minus_one = _mm_set1_ps(-1.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128 lo = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), minus_one), one);
+        __m128 hi = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), minus_one), one);
+        __m128i x = _mm_packs_epi32(
+                _mm_cvtps_epi32(_mm_mul_ps(lo, scale)),
+                _mm_cvtps_epi32(_mm_mul_ps(hi, scale)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), x);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        float x = std::min(std::max(src[i], -1.0f), 1.0f) * 32767.0f;
+        dst[i] = static_cast<int16_t>(x >= 0.0f ? x + 0.5f : x - 0.5f);
+    }
+    blob.size = n * sizeof(int16_t);
+    blob.sample_format = audio_blob::s16;
+}
+
+void audio_processor::process(audio_blob &blob, int channels, int rate, audio_blob::sample_format_t sample_format)
+{
+    if (blob.channels == channels && blob.rate == rate && blob.sample_format == sample_format)
+    {
+        return;
+    }
+    assert(sample_format == audio_blob::f32 || sample_format == audio_blob::s16);
+    to_float(blob);
+    if (blob.channels != channels)
+    {
+        downmix(blob, channels);
+    }
+    if (blob.rate != rate)
+    {
+        resample(blob, rate);
+    }
+    if (sample_format == audio_blob::s16)
+    {
+        to_s16(blob);
+    }
+}
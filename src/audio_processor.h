@@ -0,0 +1,69 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_PROCESSOR_H
+#define AUDIO_PROCESSOR_H
+
+#include "blob.h"
+
+#include "media_data.h"
+
+
+/*
+ * The audio processor converts audio blobs to a format that the audio output
+ * can handle: sample format conversion (to s16 or f32), downmixing of
+ * multichannel audio to stereo, and sample rate conversion.
+ *
+ * Conversions that do not increase the data size (d64 to f32/s16, f32 to s16,
+ * downmixing) work in place on the blob data. Everything else writes to
+ * buffers owned by the processor; the blob then points to these buffers
+ * until the next call to process().
+ */
+
+class audio_processor
+{
+private:
+    blob _float_buf;                    // Float samples for inputs that need to grow
+    blob _resample_buf;                 // Output of the sample rate conversion
+    // Sample rate conversion state, to get continuous output across blobs
+    bool _resample_first;               // Is the next blob the first after reset()?
+    double _resample_pos;               // Position of the next output sample in the input
+    float _resample_last[8];            // Last input frame of the previous blob
+
+    // The individual steps. Each one updates the blob.
+    void to_float(audio_blob &blob);
+    void downmix(audio_blob &blob, int channels);
+    void resample(audio_blob &blob, int rate);
+    void to_s16(audio_blob &blob);
+
+public:
+    audio_processor();
+
+    /* Convert the blob to the given number of channels (only downmixing to
+     * 1 or 2 channels is supported), sample rate, and sample format (only
+     * s16 and f32 are supported as targets unless the blob already has the
+     * target format). */
+    void process(audio_blob &blob, int channels, int rate, audio_blob::sample_format_t sample_format);
+
+    /* Forget the sample rate conversion state (e.g. after seeking). */
+    void reset();
+};
+
+#endif
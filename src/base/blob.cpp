@@ -0,0 +1,158 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <vector>
+#include <cstdlib>
+#include <cerrno>
+#ifdef _WIN32
+#  include <malloc.h>
+#endif
+
+#include "exc.h"
+#include "thread.h"
+
+#include "blob.h"
+
+
+const size_t blob::alignment;
+
+/* The pool has one list of free blocks for each size class. The size classes
+ * are the powers of two from 2^min_class_shift to 2^max_class_shift bytes.
+ * Larger blocks are allocated with their exact size and not pooled. Each class
+ * keeps at most max_pooled_blocks blocks, and at most max_pooled_bytes bytes,
+ * so that the pool never holds on to more than about 8 MiB in total. */
+
+static const int min_class_shift = 6;   // 64 bytes
+static const int max_class_shift = 20;  // 1 MiB
+static const size_t max_pooled_blocks = 8;
+static const size_t max_pooled_bytes = static_cast<size_t>(1) << 21;   // 2 MiB per class
+
+class blob_pool
+{
+public:
+    mutex lock;
+    std::vector<void *> free_blocks[max_class_shift - min_class_shift + 1];
+
+    blob_pool()
+    {
+        // Reserve the space now, so that freeing a block never allocates
+        for (int c = 0; c <= max_class_shift - min_class_shift; c++)
+        {
+            free_blocks[c].reserve(max_pooled_blocks);
+        }
+    }
+};
+
+// The pool is never destroyed, so that blobs can safely be freed during
+// the destruction of static objects.
+static blob_pool *pool()
+{
+    static blob_pool *p = new blob_pool;
+    return p;
+}
+
+static int size_class(size_t s)
+{
+    int shift = min_class_shift;
+    while (shift <= max_class_shift && (static_cast<size_t>(1) << shift) < s)
+    {
+        shift++;
+    }
+    return (shift <= max_class_shift ? shift - min_class_shift : -1);
+}
+
+static void *aligned_malloc(size_t s)
+{
+#ifdef _WIN32
+    return _aligned_malloc(s, blob::alignment);
+#else
+    void *ptr;
+    return (posix_memalign(&ptr, blob::alignment, s) == 0 ? ptr : NULL);
+#endif
+}
+
+static void aligned_free(void *ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+void *blob::alloc(size_t s, size_t *capacity)
+{
+    if (s == 0)
+    {
+        *capacity = 0;
+        return NULL;
+    }
+    void *ptr = NULL;
+    int c = size_class(s);
+    if (c >= 0)
+    {
+        s = static_cast<size_t>(1) << (c + min_class_shift);
+        blob_pool *p = pool();
+        p->lock.lock();
+        if (!p->free_blocks[c].empty())
+        {
+            ptr = p->free_blocks[c].back();
+            p->free_blocks[c].pop_back();
+        }
+        p->lock.unlock();
+    }
+    if (!ptr)
+    {
+        ptr = aligned_malloc(s);
+        if (!ptr)
+        {
+            throw exc(ENOMEM);
+        }
+    }
+    *capacity = s;
+    return ptr;
+}
+
+void blob::free(void *ptr, size_t capacity) throw ()
+{
+    if (!ptr)
+    {
+        return;
+    }
+    int c = size_class(capacity);
+    if (c >= 0 && (static_cast<size_t>(1) << (c + min_class_shift)) == capacity)
+    {
+        blob_pool *p = pool();
+        p->lock.lock();
+        if (p->free_blocks[c].size() < max_pooled_blocks
+                && (p->free_blocks[c].size() + 1) * capacity <= max_pooled_bytes)
+        {
+            p->free_blocks[c].push_back(ptr);
+            ptr = NULL;
+        }
+        p->lock.unlock();
+    }
+    if (ptr)
+    {
+        aligned_free(ptr);
+    }
+}
@@ -25,6 +25,15 @@
  * store any kind of data. Such memory blocks are a pain to manage with
  * new/delete or new[]/delete[] or malloc()/free() because of the necessary
  * type casting. This class provides easy access pointers and a destructor.
+ *
+ * The memory is aligned to blob::alignment bytes, which is enough for SIMD
+ * instructions and non-temporal stores. Memory blocks up to 1 MiB are rounded
+ * up to a power of two and recycled through a small pool (at most about 8 MiB
+ * in total), so that blobs that are created and destroyed frequently rarely
+ * hit the system allocator. Larger blocks are allocated and freed directly.
+ * Shrinking a blob or growing it within its capacity never reallocates, and
+ * swap() exchanges the memory of two blobs without copying, so that hot paths
+ * can reuse their buffers.
  */
 
 #ifndef BLOB_H
@@ -32,109 +41,131 @@
 
 #include <cstdlib>
 #include <cstring>
-#include <cerrno>
+#include <algorithm>
 
-#include "exc.h"
 #include "intcheck.h"
 
 
 class blob
 {
+public:
+
+    static const size_t alignment = 64;
+
 private:
     
     size_t _size;
+    size_t _capacity;
     void *_ptr;
 
-    static void *alloc(size_t s)
-    {
-        void *ptr = ::malloc(s);
-        if (s != 0 && !ptr)
-        {
-            throw exc(ENOMEM);
-        }
-        return ptr;
-    }
+    // Allocate at least s bytes. The size of the block is returned in capacity.
+    // Throws an exception if no memory is available.
+    static void *alloc(size_t s, size_t *capacity);
+    // Free (or recycle) a block that was returned by alloc().
+    static void free(void *ptr, size_t capacity) throw ();
 
-    static void *realloc(void *p, size_t s)
+    void set_size(size_t s)
     {
-        void *ptr = ::realloc(p, s);
-        if (s != 0 && !ptr)
+        if (s > _capacity)
         {
-            throw exc(ENOMEM);
+            size_t capacity;
+            void *ptr = alloc(s, &capacity);
+            if (_size > 0)
+            {
+                std::memcpy(ptr, _ptr, _size);
+            }
+            free(_ptr, _capacity);
+            _ptr = ptr;
+            _capacity = capacity;
         }
-        return ptr;
+        _size = s;
     }
 
 public:
     
     blob() throw ()
-        : _size(0), _ptr(NULL)
+        : _size(0), _capacity(0), _ptr(NULL)
     {
     }
 
     blob(size_t s)
-        : _size(s), _ptr(alloc(_size))
+        : _size(s), _capacity(0), _ptr(alloc(_size, &_capacity))
     {
     }
 
     blob(size_t s, size_t n)
-        : _size(checked_mul(s, n)), _ptr(alloc(_size))
+        : _size(checked_mul(s, n)), _capacity(0), _ptr(alloc(_size, &_capacity))
     {
     }
 
     blob(size_t s, size_t n0, size_t n1)
-        : _size(checked_mul(checked_mul(s, n0), n1)), _ptr(alloc(_size))
+        : _size(checked_mul(checked_mul(s, n0), n1)), _capacity(0), _ptr(alloc(_size, &_capacity))
     {
     }
 
     blob(size_t s, size_t n0, size_t n1, size_t n2)
-        : _size(checked_mul(checked_mul(s, n0), checked_mul(n1, n2))), _ptr(alloc(_size))
+        : _size(checked_mul(checked_mul(s, n0), checked_mul(n1, n2))), _capacity(0), _ptr(alloc(_size, &_capacity))
     {
     }
 
     blob(const blob &b)
-        : _size(b._size), _ptr(alloc(_size))
+        : _size(b._size), _capacity(0), _ptr(alloc(_size, &_capacity))
     {
-        memcpy(_ptr, b._ptr, _size);
+        if (_size > 0)
+        {
+            std::memcpy(_ptr, b._ptr, _size);
+        }
     }
 
     const blob &operator=(const blob &b)
     {
-        void *ptr = alloc(b.size());
-        memcpy(ptr, b.ptr(), b.size());
-        ::free(_ptr);
-        _ptr = ptr;
-        _size = b.size();
+        if (b.size() > _capacity)
+        {
+            blob tmp(b);
+            swap(tmp);
+        }
+        else if (&b != this)
+        {
+            if (b.size() > 0)
+            {
+                std::memcpy(_ptr, b.ptr(), b.size());
+            }
+            _size = b.size();
+        }
         return *this;
     }
 
     ~blob() throw ()
     {
-        ::free(_ptr);
+        free(_ptr, _capacity);
+    }
+
+    /* Exchange the memory of two blobs. This never allocates or copies. */
+    void swap(blob &b) throw ()
+    {
+        std::swap(_size, b._size);
+        std::swap(_capacity, b._capacity);
+        std::swap(_ptr, b._ptr);
     }
 
     void resize(size_t s)
     {
-        _ptr = realloc(_ptr, s);
-        _size = s;
+        set_size(s);
     }
 
     void resize(size_t s, size_t n)
     {
-        _ptr = realloc(_ptr, checked_mul(s, n));
-        _size = s;
+        set_size(checked_mul(s, n));
     }
 
     void resize(size_t s, size_t n0, size_t n1)
     {
-        _ptr = realloc(_ptr, checked_mul(checked_mul(s, n0), n1));
-        _size = s;
+        set_size(checked_mul(checked_mul(s, n0), n1));
     }
 
     void resize(size_t s, size_t n0, size_t n1, size_t n2)
     {
-        _ptr = realloc(_ptr, checked_mul(checked_mul(s, n0), checked_mul(n1, n2)));
-        _size = s;
+        set_size(checked_mul(checked_mul(s, n0), checked_mul(n1, n2)));
     }
 
     size_t size() const throw ()
@@ -142,6 +173,11 @@ public:
         return _size;
     }
 
+    size_t capacity() const throw ()
+    {
+        return _capacity;
+    }
+
     const void *ptr(size_t offset = 0) const throw ()
     {
         return static_cast<const void *>(static_cast<const char *>(_ptr) + offset);
@@ -165,4 +201,12 @@ public:
     }
 };
 
+namespace std
+{
+    template<> inline void swap<blob>(blob &a, blob &b) throw ()
+    {
+        a.swap(b);
+    }
+}
+
 #endif
@@ -22,8 +22,10 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <unistd.h>
 
 #include "str.h"
+#include "thread.h"
 #include "msg.h"
 
 
@@ -35,6 +37,101 @@ namespace msg
     static std::string _program_name("");
     static std::string _category_name("");
 
+    /* Asynchronous output */
+
+    static const size_t _async_slots = 1024;                    // Size of the message ring
+    static bool _async = false;
+    static mutex _async_ring_mutex;                             // Protects the ring
+    static mutex _async_write_mutex;                            // Serializes writers to keep order
+    static std::string _async_ring[_async_slots];
+    static size_t _async_head = 0;                              // Next slot to write to _file
+    static size_t _async_tail = 0;                              // Next slot to fill
+    static unsigned long _async_dropped = 0;                    // Messages dropped because the ring was full
+
+    // Write all queued messages to _file.
+    static void async_flush()
+    {
+        std::string out;
+        std::string tmp;
+        unsigned long dropped;
+        _async_write_mutex.lock();
+        _async_ring_mutex.lock();
+        while (_async_head != _async_tail)
+        {
+            tmp.swap(_async_ring[_async_head % _async_slots]);
+            out += tmp;
+            _async_head++;
+        }
+        dropped = _async_dropped;
+        _async_dropped = 0;
+        _async_ring_mutex.unlock();
+        if (dropped > 0)
+        {
+            out += str::asprintf("[%lu log messages dropped]\n", dropped);
+        }
+        if (!out.empty())
+        {
+            std::fputs(out.c_str(), _file);
+        }
+        _async_write_mutex.unlock();
+    }
+
+    class async_writer : public thread
+    {
+    public:
+        int stop_request;
+
+        async_writer() : stop_request(0)
+        {
+        }
+
+        void run()
+        {
+            while (!atomic::fetch(&stop_request))
+            {
+                async_flush();
+                usleep(10000);
+            }
+        }
+    };
+
+    static async_writer *_async_writer = NULL;
+
+    static void async_stop_at_exit()
+    {
+        set_async(false);
+    }
+
+    // Write a formatted message, either directly or through the ring.
+    static void output(level_t level, std::string &out)
+    {
+        if (!_async)
+        {
+            std::fputs(out.c_str(), _file);
+        }
+        else if (level >= ERR)
+        {
+            async_flush();
+            _async_write_mutex.lock();
+            std::fputs(out.c_str(), _file);
+            _async_write_mutex.unlock();
+        }
+        else
+        {
+            _async_ring_mutex.lock();
+            if (_async_tail - _async_head < _async_slots)
+            {
+                _async_ring[_async_tail % _async_slots].swap(out);
+                _async_tail++;
+            }
+            else
+            {
+                _async_dropped++;
+            }
+            _async_ring_mutex.unlock();
+        }
+    }
+
     /* Get / Set configuration */
 
     FILE *file()
@@ -101,6 +198,36 @@ namespace msg
         _category_name = n;
     }
 
+    bool async()
+    {
+        return _async;
+    }
+
+    void set_async(bool a)
+    {
+        if (a && !_async)
+        {
+            static bool atexit_registered = false;
+            if (!atexit_registered)
+            {
+                std::atexit(async_stop_at_exit);
+                atexit_registered = true;
+            }
+            _async_writer = new async_writer;
+            _async = true;
+            _async_writer->start();
+        }
+        else if (!a && _async)
+        {
+            _async = false;
+            atomic::increment(&_async_writer->stop_request);
+            _async_writer->wait();
+            delete _async_writer;
+            _async_writer = NULL;
+            async_flush();
+        }
+    }
+
     /* Print messages */
 
     static std::string prefix(level_t level)
@@ -133,7 +260,7 @@ namespace msg
         }
 
         std::string out = prefix(level) + s.c_str() + '\n';
-        std::fputs(out.c_str(), _file);
+        output(level, out);
     }
 
     void msg(level_t level, const char *format, ...)
@@ -223,7 +350,7 @@ namespace msg
                 }
             }
         }
-        std::fputs(out.c_str(), _file);
+        output(level, out);
     }
 
     void msg_txt(level_t level, const char *format, ...)
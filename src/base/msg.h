@@ -64,6 +64,14 @@ namespace msg
     std::string category_name();
     void set_category_name(const std::string &n);
 
+    /* Asynchronous output: messages are queued in a ring buffer and written
+     * by a background thread, so that callers never block on the output file.
+     * Error messages flush the queue and are written immediately. If the ring
+     * is full, messages are dropped (and the number of dropped messages is
+     * reported). Disabling asynchronous output flushes the queue. */
+    bool async();
+    void set_async(bool a);
+
     /* Print messages */
 
     void msg(level_t level, const std::string &s);
@@ -97,4 +105,14 @@ namespace msg
     void req_txt(const char *format, ...) MSG_AFP(1, 2);
 }
 
+/* Level-gated variants of msg::dbg(), msg::inf(), msg::wrn() and msg::err().
+ * The arguments are not evaluated if the level is disabled, so these should
+ * be used in hot paths where building the message is expensive.
+ * Example: MSG_DBG(url + ": " + str::from(n) + " packets queued."); */
+
+#define MSG_DBG if (msg::level() > msg::DBG) {} else msg::dbg
+#define MSG_INF if (msg::level() > msg::INF) {} else msg::inf
+#define MSG_WRN if (msg::level() > msg::WRN) {} else msg::wrn
+#define MSG_ERR if (msg::level() > msg::ERR) {} else msg::err
+
 #endif
@@ -20,9 +20,32 @@
 
 #include "config.h"
 
+#include <sstream>
+
 #include "s11n.h"
 
 
+/*
+ * Default implementations of the writer/reader interface for serializable classes
+ */
+
+void s11n::save(writer &w) const
+{
+    std::ostringstream oss;
+    save(oss);
+    w.write(oss.str().data(), oss.str().size());
+}
+
+void s11n::load(reader &r)
+{
+    std::istringstream iss(std::string(r.current(), r.remaining()));
+    load(iss);
+    std::streamoff n = (iss.good() ? static_cast<std::streamoff>(iss.tellg())
+            : static_cast<std::streamoff>(r.remaining()));
+    r.skip(static_cast<size_t>(n));
+}
+
+
 /*
  * Save a value to a stream
  */
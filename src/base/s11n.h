@@ -28,17 +28,118 @@
  * classes that implement the s11n interface.
  * Additionally, STL containers of serializable types can also be serialized,
  * e.g. std::vector<std::string>.
+ *
+ * The data can be written to / read from standard streams, or to / from
+ * s11n::writer / s11n::reader, which work directly on a contiguous buffer. The
+ * latter are much cheaper for the small amounts of data that are serialized
+ * many times per second (commands, notifications, Equalizer frame data),
+ * because they avoid the stream construction, locale and virtual call
+ * overhead. Both produce the same data format.
  */
 
 #include <iostream>
 #include <string>
 #include <vector>
+#include <cstring>
 
 
 class s11n
 {
 public:
 
+    /*
+     * Buffers for serialization without streams
+     */
+
+    class writer
+    {
+    private:
+        std::string _buf;
+
+    public:
+        writer() : _buf()
+        {
+        }
+
+        void write(const void *x, size_t n)
+        {
+            _buf.append(static_cast<const char *>(x), n);
+        }
+
+        // The serialized data
+        const std::string &str() const
+        {
+            return _buf;
+        }
+
+        // Start anew, but keep the allocated memory
+        void clear()
+        {
+            _buf.clear();
+        }
+    };
+
+    class reader
+    {
+    private:
+        const char *_ptr;
+        size_t _size;
+        size_t _pos;
+        bool _good;
+
+    public:
+        // The data must remain valid while the reader is used.
+        reader(const std::string &s) : _ptr(s.data()), _size(s.size()), _pos(0), _good(true)
+        {
+        }
+
+        reader(const void *ptr, size_t size) : _ptr(static_cast<const char *>(ptr)), _size(size), _pos(0), _good(true)
+        {
+        }
+
+        // Read n bytes. If not enough data is left, the missing bytes are
+        // set to zero and good() returns false afterwards.
+        void read(void *x, size_t n)
+        {
+            size_t m = (n <= _size - _pos ? n : _size - _pos);
+            std::memcpy(x, _ptr + _pos, m);
+            if (m < n)
+            {
+                std::memset(static_cast<char *>(x) + m, 0, n - m);
+                _good = false;
+            }
+            _pos += m;
+        }
+
+        // Number of bytes that are not read yet, and a pointer to them
+        size_t remaining() const
+        {
+            return _size - _pos;
+        }
+
+        const char *current() const
+        {
+            return _ptr + _pos;
+        }
+
+        // Skip n bytes
+        void skip(size_t n)
+        {
+            if (n > _size - _pos)
+            {
+                n = _size - _pos;
+                _good = false;
+            }
+            _pos += n;
+        }
+
+        bool good() const
+        {
+            return _good;
+        }
+    };
+
+
     /*
      * Interface for serializable classes
      */
@@ -46,6 +147,11 @@ public:
     virtual void save(std::ostream &os) const = 0;
     virtual void load(std::istream &is) = 0;
 
+    // The default implementations of these use the stream functions above.
+    // Classes that are serialized frequently should implement them directly.
+    virtual void save(writer &w) const;
+    virtual void load(reader &r);
+
 
     /*
      * Save a value to a stream
@@ -97,6 +203,59 @@ public:
     // TODO: add more STL containers as needed
 
 
+    /*
+     * Save a value to a writer
+     */
+
+    // Fundamental arithmetic data types
+
+    static void save(writer &w, const bool x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const char x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const signed char x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const unsigned char x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const short x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const unsigned short x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const int x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const unsigned int x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const long x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const unsigned long x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const long long x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const unsigned long long x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const float x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const double x) { w.write(&x, sizeof(x)); }
+    static void save(writer &w, const long double x) { w.write(&x, sizeof(x)); }
+
+    // Binary blobs
+
+    static void save(writer &w, const void *x, const size_t n) { w.write(x, n); }
+
+    // Serializable classes
+
+    static void save(writer &w, const s11n &x) { x.save(w); }
+
+    // Basic STL types
+
+    static void save(writer &w, const std::string &x)
+    {
+        const size_t s = x.length();
+        w.write(&s, sizeof(s));
+        w.write(x.data(), s);
+    }
+
+    // STL containters
+
+    template<typename T>
+    static void save(writer &w, const std::vector<T> &x)
+    {
+        size_t s = x.size();
+        save(w, s);
+        for (size_t i = 0; i < s; i++)
+        {
+            save(w, x[i]);
+        }
+    }
+
+
     /*
      * Load a value from a stream
      */
@@ -148,6 +307,69 @@ public:
     }
 
     // TODO: add more STL containers as needed
+
+
+    /*
+     * Load a value from a reader
+     */
+
+    // Fundamental arithmetic data types
+
+    static void load(reader &r, bool &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, char &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, signed char &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, unsigned char &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, short &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, unsigned short &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, int &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, unsigned int &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, long &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, unsigned long &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, long long &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, unsigned long long &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, float &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, double &x) { r.read(&x, sizeof(x)); }
+    static void load(reader &r, long double &x) { r.read(&x, sizeof(x)); }
+
+    // Binary blobs
+
+    static void load(reader &r, void *x, const size_t n) { r.read(x, n); }
+
+    // Serializable classes
+
+    static void load(reader &r, s11n &x) { x.load(r); }
+
+    // Basic STL types
+
+    static void load(reader &r, std::string &x)
+    {
+        size_t s;
+        r.read(&s, sizeof(s));
+        if (s > r.remaining())
+        {
+            r.skip(s);          // marks the reader as not good
+            x.clear();
+            return;
+        }
+        x.assign(r.current(), s);
+        r.skip(s);
+    }
+
+    // STL containers
+
+    template<typename T>
+    static void load(reader &r, std::vector<T> &x)
+    {
+        x.clear();
+        size_t s;
+        load(r, s);
+        for (size_t i = 0; i < s && r.good(); i++)
+        {
+            T v;
+            load(r, v);
+            x.push_back(v);
+        }
+    }
 };
 
 #endif
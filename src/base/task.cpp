@@ -0,0 +1,497 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
+
+#if HAVE_SYSCONF
+#  include <unistd.h>
+#else
+#  include <windows.h>
+#endif
+
+#include "exc.h"
+#include "msg.h"
+#include "thread.h"
+#include "task.h"
+
+
+/*
+ * The task pool.
+ *
+ * Each worker has its own queue. Tasks submitted by a worker go to its own
+ * queue, other tasks are distributed round-robin. A worker takes the newest
+ * task from its own queue (it is likely to still be in the cache), and steals
+ * the oldest tasks from the queues of other workers.
+ *
+ * The number of queued tasks that are not yet reserved by a worker is counted
+ * separately. A worker first reserves a task by decrementing this counter, and
+ * then searches the queues for it. Since a task is counted only after it was
+ * added to a queue, the search always succeeds. Workers sleep only on this
+ * counter, so that the queues themselves need only short-lived locks.
+ *
+ * The pool is created on first use and never destroyed: its workers sleep
+ * until the process exits.
+ */
+
+class task_pool
+{
+private:
+    class worker : public thread
+    {
+    private:
+        task_pool *_pool;
+        int _index;
+
+    public:
+        worker(task_pool *pool, int index) : thread(thread::decode), _pool(pool), _index(index)
+        {
+        }
+
+        void run()
+        {
+            _pool->work(_index);
+        }
+    };
+
+    struct queue
+    {
+        mutex m;
+        std::deque<task *> tasks;
+    };
+
+    int _workers;
+    std::vector<worker *> _threads;
+    std::vector<queue *> _queues;
+    mutex _mutex;               // protects _queued
+    condition _cond;            // signaled when _queued was incremented
+    int _queued;                // number of queued tasks that are not reserved yet
+    unsigned int _next;         // next queue for tasks from non-worker threads
+    pthread_key_t _key;         // worker index + 1 in worker threads, NULL elsewhere
+
+    static pthread_once_t _once;
+    static task_pool *_pool;
+    static void create();
+
+    task_pool();
+
+    // Find and remove a task that the calling worker has reserved.
+    task *take(int w);
+    // The main loop of worker w.
+    void work(int w);
+
+    friend class worker;
+
+public:
+    // Get the process-wide pool.
+    static task_pool *get();
+
+    int workers() const
+    {
+        return _workers;
+    }
+
+    // Return the index of the calling worker, or -1 for other threads.
+    int current_worker();
+    // Queue a task.
+    void push(task *t);
+    // Remove a queued task that was not yet reserved by a worker. Returns false
+    // if the task is not available anymore.
+    bool reclaim(task *t);
+    // Let the calling worker execute one queued task. Returns false if there
+    // is none, or if the caller is not a worker.
+    bool help();
+};
+
+pthread_once_t task_pool::_once = PTHREAD_ONCE_INIT;
+task_pool *task_pool::_pool = NULL;
+
+void task_pool::create()
+{
+    _pool = new task_pool;
+}
+
+task_pool *task_pool::get()
+{
+    (void)pthread_once(&_once, create);
+    return _pool;
+}
+
+task_pool::task_pool() : _mutex(), _cond(), _queued(0), _next(0)
+{
+#if HAVE_SYSCONF
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    long n = si.dwNumberOfProcessors;
+#endif
+    _workers = std::max(1L, std::min(n, 16L));
+    int e = pthread_key_create(&_key, NULL);
+    if (e != 0)
+    {
+        throw exc(std::string("Cannot create task pool: ") + std::strerror(e), e);
+    }
+    for (int i = 0; i < _workers; i++)
+    {
+        _queues.push_back(new queue);
+    }
+    for (int i = 0; i < _workers; i++)
+    {
+        _threads.push_back(new worker(this, i));
+        _threads.back()->start();
+    }
+    msg::dbg("Task pool: %d worker threads.", _workers);
+}
+
+int task_pool::current_worker()
+{
+    return static_cast<int>(reinterpret_cast<intptr_t>(pthread_getspecific(_key))) - 1;
+}
+
+void task_pool::push(task *t)
+{
+    int w = current_worker();
+    if (w < 0)
+    {
+        w = atomic::fetch_and_add(&_next, 1u) % static_cast<unsigned int>(_workers);
+    }
+    _queues[w]->m.lock();
+    _queues[w]->tasks.push_back(t);
+    _queues[w]->m.unlock();
+    _mutex.lock();
+    _queued++;
+    _cond.wake_one();
+    _mutex.unlock();
+}
+
+task *task_pool::take(int w)
+{
+    for (;;)
+    {
+        queue *q = _queues[w];
+        q->m.lock();
+        if (!q->tasks.empty())
+        {
+            task *t = q->tasks.back();
+            q->tasks.pop_back();
+            q->m.unlock();
+            return t;
+        }
+        q->m.unlock();
+        for (int i = 1; i < _workers; i++)
+        {
+            q = _queues[(w + i) % _workers];
+            q->m.lock();
+            if (!q->tasks.empty())
+            {
+                task *t = q->tasks.front();
+                q->tasks.pop_front();
+                q->m.unlock();
+                return t;
+            }
+            q->m.unlock();
+        }
+        // The reserved task was taken from a queue that we had already
+        // searched, in exchange for one that was added after it. Search again.
+    }
+}
+
+void task_pool::work(int w)
+{
+    (void)pthread_setspecific(_key, reinterpret_cast<void *>(static_cast<intptr_t>(w + 1)));
+    for (;;)
+    {
+        _mutex.lock();
+        while (_queued == 0)
+        {
+            _cond.wait(_mutex);
+        }
+        _queued--;
+        _mutex.unlock();
+        take(w)->__execute();
+    }
+}
+
+bool task_pool::reclaim(task *t)
+{
+    bool found = false;
+    _mutex.lock();
+    // If _queued is zero, every queued task is already reserved by a worker.
+    if (_queued > 0)
+    {
+        for (int i = 0; i < _workers && !found; i++)
+        {
+            queue *q = _queues[i];
+            q->m.lock();
+            std::deque<task *>::iterator it = std::find(q->tasks.begin(), q->tasks.end(), t);
+            if (it != q->tasks.end())
+            {
+                q->tasks.erase(it);
+                found = true;
+            }
+            q->m.unlock();
+        }
+        if (found)
+        {
+            _queued--;
+        }
+    }
+    _mutex.unlock();
+    return found;
+}
+
+bool task_pool::help()
+{
+    int w = current_worker();
+    if (w < 0)
+    {
+        return false;
+    }
+    _mutex.lock();
+    bool reserved = (_queued > 0);
+    if (reserved)
+    {
+        _queued--;
+    }
+    _mutex.unlock();
+    if (reserved)
+    {
+        take(w)->__execute();
+    }
+    return reserved;
+}
+
+
+task::task() :
+    __mutex(),
+    __cond(),
+    __state(idle),
+    __exception()
+{
+}
+
+task::task(const task &) :
+    __mutex(),
+    __cond(),
+    __state(idle),
+    __exception()
+{
+    // The task state cannot be copied; a new state is created instead.
+}
+
+task::~task()
+{
+    // The subclass is already destroyed at this point, so a task that is
+    // still queued must not be executed anymore.
+    __mutex.lock();
+    bool busy = (__state != idle);
+    __mutex.unlock();
+    if (busy && !task_pool::get()->reclaim(this))
+    {
+        __mutex.lock();
+        while (__state != idle)
+        {
+            __cond.wait(__mutex);
+        }
+        __mutex.unlock();
+    }
+}
+
+void task::__execute()
+{
+    __mutex.lock();
+    __state = running;
+    __mutex.unlock();
+    try
+    {
+        run();
+    }
+    catch (exc &e)
+    {
+        __exception = e;
+    }
+    catch (std::exception &e)
+    {
+        __exception = e;
+    }
+    catch (...)
+    {
+        __exception = exc("Unknown exception");
+    }
+    __mutex.lock();
+    __state = idle;
+    __cond.wake_all();
+    __mutex.unlock();
+}
+
+void task::start()
+{
+    __mutex.lock();
+    if (__state != idle)
+    {
+        __mutex.unlock();
+        return;
+    }
+    __state = queued;
+    __exception = exc();
+    __mutex.unlock();
+    task_pool::get()->push(this);
+}
+
+void task::wait()
+{
+    task_pool *pool = task_pool::get();
+    __mutex.lock();
+    if (__state == queued)
+    {
+        // No worker has picked up the task yet; run it here instead of
+        // waiting for one.
+        __mutex.unlock();
+        if (pool->reclaim(this))
+        {
+            __execute();
+            return;
+        }
+        __mutex.lock();
+    }
+    bool is_worker = (pool->current_worker() >= 0);
+    while (__state != idle)
+    {
+        if (is_worker)
+        {
+            // Do not block a worker: help with other tasks, and check for
+            // completion from time to time when there is nothing to do.
+            __mutex.unlock();
+            bool helped = pool->help();
+            __mutex.lock();
+            if (!helped && __state != idle)
+            {
+                (void)__cond.wait(__mutex, 1000);
+            }
+        }
+        else
+        {
+            __cond.wait(__mutex);
+        }
+    }
+    __mutex.unlock();
+}
+
+void task::finish()
+{
+    wait();
+    if (!exception().empty())
+    {
+        throw exception();
+    }
+}
+
+int task::workers()
+{
+    return task_pool::get()->workers();
+}
+
+
+class parallel_task : public task
+{
+private:
+    parallel_job *_job;
+    int _n;
+    int *_next;
+    int _slot;
+
+public:
+    parallel_task(parallel_job *job, int n, int *next, int slot) :
+        _job(job), _n(n), _next(next), _slot(slot)
+    {
+    }
+
+    void run()
+    {
+        int i;
+        while ((i = atomic::fetch_and_add(_next, 1)) < _n)
+        {
+            _job->run(i, _slot);
+        }
+    }
+};
+
+void parallel_run(parallel_job &job, int n, int max_concurrency)
+{
+    int concurrency = task::workers();
+    if (max_concurrency > 0)
+    {
+        concurrency = std::min(concurrency, max_concurrency);
+    }
+    concurrency = std::min(concurrency, n);
+    if (concurrency <= 1)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            job.run(i, 0);
+        }
+        return;
+    }
+
+    int next = 0;
+    std::vector<parallel_task> tasks;
+    tasks.reserve(concurrency);
+    for (int s = 0; s < concurrency; s++)
+    {
+        tasks.push_back(parallel_task(&job, n, &next, s));
+    }
+    for (int s = 1; s < concurrency; s++)
+    {
+        tasks[s].start();
+    }
+    // Slot 0 belongs to the calling thread. Queued helpers that no worker
+    // picked up are run by wait() below and find no work left.
+    exc e;
+    try
+    {
+        tasks[0].run();
+    }
+    catch (exc &x)
+    {
+        e = x;
+    }
+    catch (std::exception &x)
+    {
+        e = x;
+    }
+    for (int s = 1; s < concurrency; s++)
+    {
+        tasks[s].wait();
+        if (e.empty())
+        {
+            e = tasks[s].exception();
+        }
+    }
+    if (!e.empty())
+    {
+        throw e;
+    }
+}
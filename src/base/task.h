@@ -0,0 +1,118 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+#include "exc.h"
+#include "thread.h"
+
+
+/*
+ * Task
+ *
+ * A task is a piece of work that is executed by the process-wide task pool
+ * instead of a thread of its own. The pool has one worker thread (with role
+ * thread::decode) per processor. Each worker has its own task queue; idle
+ * workers steal tasks from the queues of busy workers.
+ *
+ * The interface mirrors the thread class: implement run() in a subclass,
+ * then use start() and finish(). A thread that waits for a task that no
+ * worker has picked up yet runs the task itself, and a worker that waits for
+ * a running task helps with other queued tasks in the meantime. Tasks may
+ * therefore start and wait for other tasks without risking a deadlock.
+ */
+
+class task
+{
+private:
+    enum state_t
+    {
+        idle,
+        queued,
+        running
+    };
+
+    mutex __mutex;
+    condition __cond;
+    state_t __state;
+    exc __exception;
+
+    void __execute();
+
+    friend class task_pool;
+
+public:
+    // Constructor / Destructor
+    task();
+    task(const task &t);
+    virtual ~task();
+
+    // Implement this in a subclass; it will be executed by the task pool via start()
+    virtual void run() = 0;
+
+    // Submit the task to the pool. If the task is already queued or running,
+    // this function does nothing.
+    void start();
+
+    // Wait for the task to finish. If the task is not queued or running, this
+    // function returns immediately.
+    void wait();
+
+    // Wait for the task to finish, like wait(), and rethrow an exception that the
+    // run() function might have thrown during its execution.
+    void finish();
+
+    // Get an exception that the run() function might have thrown.
+    const exc &exception() const
+    {
+        return __exception;
+    }
+    // Modify the stored exception
+    exc &exception()
+    {
+        return __exception;
+    }
+
+    // Return the number of worker threads in the pool
+    static int workers();
+};
+
+
+/*
+ * Parallel jobs
+ *
+ * parallel_run() executes run(0), ..., run(n - 1) of a job, using the calling
+ * thread and at most max_concurrency - 1 pool tasks (0 means as many as there
+ * are workers). The slot argument is unique among the concurrently executing
+ * calls and lower than the concurrency, so that it can be used to index
+ * per-thread scratch data. The first exception thrown by run() is rethrown.
+ */
+
+class parallel_job
+{
+public:
+    virtual ~parallel_job() {}
+    virtual void run(int index, int slot) = 0;
+};
+
+void parallel_run(parallel_job &job, int n, int max_concurrency = 0);
+
+#endif
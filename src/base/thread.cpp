@@ -21,9 +21,22 @@
 #include "config.h"
 
 #include <cstring>
+#include <cerrno>
+#include <climits>
 #include <pthread.h>
+#include <sched.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#elif defined(__linux__)
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#  include <sys/resource.h>
+#endif
 
 #include "dbg.h"
+#include "msg.h"
+#include "timer.h"
 #include "thread.h"
 
 
@@ -78,21 +91,96 @@ void mutex::unlock()
 }
 
 
-thread::thread() :
+const pthread_cond_t condition::_cond_initializer = PTHREAD_COND_INITIALIZER;
+
+condition::condition() : _cond(_cond_initializer)
+{
+    int e = pthread_cond_init(&_cond, NULL);
+    if (e != 0)
+    {
+        throw exc(std::string("Cannot initialize condition: ") + std::strerror(e), e);
+    }
+}
+
+condition::condition(const condition &) : _cond(_cond_initializer)
+{
+    // As with mutexes, a copy is a new condition.
+    int e = pthread_cond_init(&_cond, NULL);
+    if (e != 0)
+    {
+        throw exc(std::string("Cannot initialize condition: ") + std::strerror(e), e);
+    }
+}
+
+condition::~condition()
+{
+    (void)pthread_cond_destroy(&_cond);
+}
+
+void condition::wait(mutex &m)
+{
+    int e = pthread_cond_wait(&_cond, &m._mutex);
+    if (e != 0)
+    {
+        throw exc(std::string("Cannot wait for condition: ") + std::strerror(e), e);
+    }
+}
+
+bool condition::wait(mutex &m, int64_t microseconds)
+{
+    int64_t t = timer::get_microseconds(timer::realtime) + microseconds;
+    struct timespec abstime;
+    abstime.tv_sec = t / 1000000;
+    abstime.tv_nsec = (t % 1000000) * 1000;
+    int e = pthread_cond_timedwait(&_cond, &m._mutex, &abstime);
+    if (e != 0 && e != ETIMEDOUT)
+    {
+        throw exc(std::string("Cannot wait for condition: ") + std::strerror(e), e);
+    }
+    return (e == 0);
+}
+
+void condition::wake_one()
+{
+    int e = pthread_cond_signal(&_cond);
+    if (e != 0)
+    {
+        throw exc(std::string("Cannot signal condition: ") + std::strerror(e), e);
+    }
+}
+
+void condition::wake_all()
+{
+    int e = pthread_cond_broadcast(&_cond);
+    if (e != 0)
+    {
+        throw exc(std::string("Cannot broadcast condition: ") + std::strerror(e), e);
+    }
+}
+
+
+// The configured attributes of each role
+static thread::role_attributes configured_role_attributes[thread::roles];
+// Whether a failure to apply the attributes of a role was already reported
+static bool role_failure_reported[thread::roles];
+
+thread::thread(role_t role) :
     __thread_id(pthread_self()),
     __joinable(false),
     __running(false),
     __wait_mutex(),
-    __exception()
+    __exception(),
+    __role(role)
 {
 }
 
-thread::thread(const thread &) :
+thread::thread(const thread &t) :
     __thread_id(pthread_self()),
     __joinable(false),
     __running(false),
     __wait_mutex(),
-    __exception()
+    __exception(),
+    __role(t.__role)
 {
     // The thread state cannot be copied; a new state is created instead.
 }
@@ -110,6 +198,7 @@ void *thread::__run(void *p)
     thread *t = static_cast<thread *>(p);
     try
     {
+        apply_role(t->__role);
         t->run();
     }
     catch (exc &e)
@@ -124,7 +213,7 @@ void *thread::__run(void *p)
     {
         t->__exception = exc("Unknown exception");
     }
-    t->__running = false;
+    (void)atomic::bool_compare_and_swap(&(t->__running), true, false);
     return NULL;
 }
 
@@ -133,7 +222,25 @@ void thread::start()
     if (atomic::bool_compare_and_swap(&__running, false, true))
     {
         wait();
-        int e = pthread_create(&__thread_id, NULL, __run, this);
+        pthread_attr_t attr;
+        pthread_attr_t *attrp = NULL;
+        size_t stack_size = configured_role_attributes[__role].stack_size;
+        if (stack_size > 0 && pthread_attr_init(&attr) == 0)
+        {
+            attrp = &attr;
+#ifdef PTHREAD_STACK_MIN
+            if (stack_size < static_cast<size_t>(PTHREAD_STACK_MIN))
+            {
+                stack_size = PTHREAD_STACK_MIN;
+            }
+#endif
+            (void)pthread_attr_setstacksize(attrp, stack_size);
+        }
+        int e = pthread_create(&__thread_id, attrp, __run, this);
+        if (attrp)
+        {
+            (void)pthread_attr_destroy(attrp);
+        }
         if (e != 0)
         {
             throw exc(std::string("Cannot create thread: ") + std::strerror(e), e);
@@ -165,3 +272,238 @@ void thread::finish()
         throw exception();
     }
 }
+
+bool thread::is_running()
+{
+    return atomic::val_compare_and_swap(&__running, true, true);
+}
+
+// The attributes of the process before any role was configured. Threads whose
+// role does not configure an attribute that other roles configure are reset to
+// these, so that they do not inherit the attributes of the thread that started
+// them (e.g. the render thread).
+static bool initial_attributes_known = false;
+static std::vector<int> initial_cpus;
+static int initial_nice = 0;
+
+static void get_initial_attributes()
+{
+#ifdef _WIN32
+    DWORD_PTR process_mask, system_mask;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+    {
+        for (int i = 0; i < static_cast<int>(sizeof(DWORD_PTR) * CHAR_BIT); i++)
+        {
+            if (process_mask & (static_cast<DWORD_PTR>(1) << i))
+            {
+                initial_cpus.push_back(i);
+            }
+        }
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        for (int i = 0; i < CPU_SETSIZE; i++)
+        {
+            if (CPU_ISSET(i, &set))
+            {
+                initial_cpus.push_back(i);
+            }
+        }
+    }
+    errno = 0;
+    int n = getpriority(PRIO_PROCESS, 0);
+    if (errno == 0)
+    {
+        initial_nice = n;
+    }
+#endif
+}
+
+void thread::set_role_attributes(role_t role, const role_attributes &attr)
+{
+    if (!initial_attributes_known)
+    {
+        get_initial_attributes();
+        initial_attributes_known = true;
+    }
+    configured_role_attributes[role] = attr;
+}
+
+const thread::role_attributes &thread::get_role_attributes(role_t role)
+{
+    return configured_role_attributes[role];
+}
+
+static bool set_affinity(const std::vector<int> &cpus)
+{
+#ifdef _WIN32
+    DWORD_PTR mask = 0;
+    for (size_t i = 0; i < cpus.size(); i++)
+    {
+        if (cpus[i] >= 0 && cpus[i] < static_cast<int>(sizeof(DWORD_PTR) * CHAR_BIT))
+        {
+            mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+        }
+    }
+    return (SetThreadAffinityMask(GetCurrentThread(), mask) != 0);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); i++)
+    {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+        {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+#else
+    return cpus.empty();
+#endif
+}
+
+static bool set_fifo_priority(int priority)
+{
+#ifdef _WIN32
+    return SetThreadPriority(GetCurrentThread(),
+            priority > 0 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL);
+#else
+    struct sched_param param;
+    param.sched_priority = priority;
+    return (pthread_setschedparam(pthread_self(), priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param) == 0);
+#endif
+}
+
+// Whether the calling thread has a real time priority, e.g. one that it
+// inherited from the thread that started it.
+static bool has_fifo_priority()
+{
+#ifdef _WIN32
+    return (GetThreadPriority(GetCurrentThread()) == THREAD_PRIORITY_TIME_CRITICAL);
+#else
+    int policy;
+    struct sched_param param;
+    return (pthread_getschedparam(pthread_self(), &policy, &param) == 0
+            && (policy == SCHED_FIFO || policy == SCHED_RR));
+#endif
+}
+
+// Get the nice level of the calling thread. Returns false if it is unknown.
+static bool get_nice(int *nice)
+{
+#if defined(__linux__) && defined(SYS_gettid)
+    errno = 0;
+    int n = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+    if (errno == 0)
+    {
+        *nice = n;
+        return true;
+    }
+#endif
+    (void)nice;
+    return false;
+}
+
+static bool set_nice(int nice)
+{
+#ifdef _WIN32
+    int prio = (nice <= -15 ? THREAD_PRIORITY_HIGHEST
+            : nice < 0 ? THREAD_PRIORITY_ABOVE_NORMAL
+            : nice == 0 ? THREAD_PRIORITY_NORMAL
+            : nice < 15 ? THREAD_PRIORITY_BELOW_NORMAL
+            : THREAD_PRIORITY_LOWEST);
+    return SetThreadPriority(GetCurrentThread(), prio);
+#elif defined(__linux__) && defined(SYS_gettid)
+    // On Linux, the nice level is a per-thread attribute
+    return (setpriority(PRIO_PROCESS, syscall(SYS_gettid), nice) == 0);
+#else
+    return (nice == 0);
+#endif
+}
+
+void thread::apply_role(role_t role)
+{
+    if (!initial_attributes_known)
+    {
+        // No role was configured
+        return;
+    }
+    const role_attributes &attr = configured_role_attributes[role];
+    bool any_cpus = false;
+    bool any_fifo = false;
+    bool any_nice = false;
+    for (int r = 0; r < roles; r++)
+    {
+        any_cpus = any_cpus || !configured_role_attributes[r].cpus.empty();
+        any_fifo = any_fifo || configured_role_attributes[r].fifo_priority > 0;
+        any_nice = any_nice || configured_role_attributes[r].set_nice;
+    }
+    std::string errors;
+
+    if (!attr.cpus.empty() || any_cpus)
+    {
+        if (!set_affinity(attr.cpus.empty() ? initial_cpus : attr.cpus))
+        {
+            errors += " CPU affinity";
+        }
+    }
+    // Threads of roles that do not configure a priority only drop priorities
+    // they inherited from other roles. A thread that lowered its own priority
+    // (e.g. to SCHED_IDLE), and the threads it starts, keep that.
+    if (attr.fifo_priority > 0 || (any_fifo && has_fifo_priority()))
+    {
+        if (!set_fifo_priority(attr.fifo_priority))
+        {
+            errors += " real time priority";
+        }
+    }
+    if (attr.fifo_priority <= 0)
+    {
+        int nice;
+        if (attr.set_nice || (any_nice && get_nice(&nice) && nice < initial_nice))
+        {
+            if (!set_nice(attr.set_nice ? attr.nice : initial_nice))
+            {
+                errors += " nice level";
+            }
+        }
+    }
+
+    if (!errors.empty() && atomic::bool_compare_and_swap(&role_failure_reported[role], false, true))
+    {
+        msg::wrn("Cannot set thread attributes for role %s:%s.", role_to_string(role), errors.c_str());
+    }
+}
+
+const char *thread::role_to_string(role_t role)
+{
+    switch (role)
+    {
+    case io:
+        return "io";
+    case decode:
+        return "decode";
+    case audio:
+        return "audio";
+    case render:
+        return "render";
+    case generic:
+    default:
+        return "generic";
+    }
+}
+
+bool thread::role_from_string(const std::string &s, role_t &role)
+{
+    for (int r = 0; r < roles; r++)
+    {
+        if (s == role_to_string(static_cast<role_t>(r)))
+        {
+            role = static_cast<role_t>(r);
+            return true;
+        }
+    }
+    return false;
+}
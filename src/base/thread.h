@@ -21,6 +21,9 @@
 #ifndef THREADS_H
 #define THREADS_H
 
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
 #include <pthread.h>
 
 #include "exc.h"
@@ -85,6 +88,8 @@ private:
     static const pthread_mutex_t _mutex_initializer;
     pthread_mutex_t _mutex;
 
+    friend class condition;
+
 public:
     // Constructor / Destructor
     mutex();
@@ -100,26 +105,194 @@ public:
 };
 
 
+/*
+ * Condition variable
+ */
+
+class condition
+{
+private:
+    static const pthread_cond_t _cond_initializer;
+    pthread_cond_t _cond;
+
+public:
+    // Constructor / Destructor
+    condition();
+    condition(const condition &c);
+    ~condition();
+
+    // Wait for the condition. The calling thread must have locked the mutex.
+    void wait(mutex &m);
+    // Wait for the condition, but at most the given number of microseconds.
+    // Return false on timeout.
+    bool wait(mutex &m, int64_t microseconds);
+    // Wake one waiting thread
+    void wake_one();
+    // Wake all waiting threads
+    void wake_all();
+};
+
+
+/*
+ * Multiple-producer single-consumer queue
+ *
+ * Any number of threads can push elements concurrently, without locking.
+ * A single consumer thread takes all queued elements at once, in the order
+ * in which they were pushed. Each push allocates a list node.
+ */
+
+template<typename T>
+class mpsc_queue
+{
+private:
+    struct node
+    {
+        T data;
+        node *next;
+
+        node(const T &d) : data(d), next(NULL)
+        {
+        }
+    };
+
+    node *_head;        // The most recently pushed element
+
+    // Not copyable
+    mpsc_queue(const mpsc_queue &);
+    mpsc_queue &operator=(const mpsc_queue &);
+
+    // Atomically detach the list of queued elements, newest first
+    node *detach()
+    {
+        node *head = _head;
+        node *prev;
+        while ((prev = atomic::val_compare_and_swap(&_head, head, static_cast<node *>(NULL))) != head)
+        {
+            head = prev;
+        }
+        return head;
+    }
+
+public:
+    mpsc_queue() : _head(NULL)
+    {
+    }
+
+    ~mpsc_queue()
+    {
+        node *n = detach();
+        while (n)
+        {
+            node *next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    // Push an element. This can be called from any thread. It allocates a node
+    // and therefore may block in the memory allocator.
+    void push(const T &x)
+    {
+        node *n = new node(x);
+        node *head = _head;
+        node *prev;
+        for (;;)
+        {
+            n->next = head;
+            prev = atomic::val_compare_and_swap(&_head, head, n);
+            if (prev == head)
+            {
+                break;
+            }
+            head = prev;
+        }
+    }
+
+    // Append all queued elements to v, oldest first. Return false if the queue
+    // was empty. Only the consumer thread may call this.
+    bool take(std::vector<T> &v)
+    {
+        node *n = detach();
+        if (!n)
+        {
+            return false;
+        }
+        // Reverse the list to get push order
+        node *oldest = NULL;
+        while (n)
+        {
+            node *next = n->next;
+            n->next = oldest;
+            oldest = n;
+            n = next;
+        }
+        while (oldest)
+        {
+            node *next = oldest->next;
+            v.push_back(oldest->data);
+            delete oldest;
+            oldest = next;
+        }
+        return true;
+    }
+};
+
+
 /*
  * Thread
  *
  * Implement the run() function in a subclass.
+ *
+ * Each thread has a role. The scheduling attributes of a role (CPU affinity,
+ * priority, stack size) can be configured, and a thread gets the attributes
+ * of its role when it is started. If no role configures an attribute, threads
+ * inherit it from their creator as usual. If some role configures it, threads
+ * of the other roles get the value that the process had initially, so that
+ * they do not inherit e.g. the real time priority of the render thread. For
+ * the priority, this only happens if the inherited priority is higher: threads
+ * started by a thread that lowered its own priority keep the lower one.
  */
 
 class thread
 {
+public:
+    enum role_t
+    {
+        generic,        // No special role
+        io,             // Reading input
+        decode,         // Decoding video and subtitles (the task pool workers)
+        audio,          // Decoding audio and feeding the audio output
+        render          // Presentation: the player and GUI thread, and the texture upload thread
+    };
+    static const int roles = 5;
+
+    class role_attributes
+    {
+    public:
+        std::vector<int> cpus;          // The CPUs to run on; empty for all
+        bool set_nice;                  // Whether to set the nice level
+        int nice;                       //   The nice level (-20 to 19)
+        int fifo_priority;              // Real time priority (SCHED_FIFO, 1 to 99); 0 to keep the policy
+        size_t stack_size;              // Stack size in bytes; 0 for the default
+
+        role_attributes() : cpus(), set_nice(false), nice(0), fifo_priority(0), stack_size(0)
+        {
+        }
+    };
+
 private:
     pthread_t __thread_id;
     bool __joinable;
     bool __running;
     mutex __wait_mutex;
     exc __exception;
+    role_t __role;
 
     static void *__run(void *p);
 
 public:
     // Constructor / Destructor
-    thread();
+    thread(role_t role = generic);
     thread(const thread &t);
     virtual ~thread();
 
@@ -138,6 +311,10 @@ public:
     // run() function might have thrown during its execution.
     void finish();
 
+    // Return whether the thread is running. Once this returns false, the thread
+    // does not access this object anymore, so it can be destroyed without waiting.
+    bool is_running();
+
     // Get an exception that the run() function might have thrown.
     const exc &exception() const
     {
@@ -148,6 +325,28 @@ public:
     {
         return __exception;
     }
+
+    // Get the role of this thread
+    role_t role() const
+    {
+        return __role;
+    }
+
+    /* Configure the attributes of a role. This should be done before any
+     * threads are started. */
+    static void set_role_attributes(role_t role, const role_attributes &attr);
+    static const role_attributes &get_role_attributes(role_t role);
+
+    /* Apply the attributes of a role to the calling thread. This is useful
+     * for threads that were not started via this class, e.g. the main thread.
+     * Failures are reported as warnings (e.g. missing privileges for real time
+     * scheduling). The stack size cannot be changed. */
+    static void apply_role(role_t role);
+
+    /* Convert roles to and from their names ("io", "decode", ...).
+     * role_from_string returns false if the name is unknown. */
+    static const char *role_to_string(role_t role);
+    static bool role_from_string(const std::string &s, role_t &role);
 };
 
 #endif
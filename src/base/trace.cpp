@@ -0,0 +1,214 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <pthread.h>
+
+#include "exc.h"
+#include "msg.h"
+#include "thread.h"
+#include "timer.h"
+#include "trace.h"
+
+
+namespace trace
+{
+    bool _enabled = false;
+
+    // Number of events kept per thread. Older events are overwritten.
+    static const unsigned long buffer_capacity = 32768;
+
+    struct event
+    {
+        const char *name;
+        int64_t start;
+        int64_t duration;
+    };
+
+    // A buffer is only ever written by the thread that owns it, so recording
+    // needs no locks. The event count is published atomically for dump().
+    // Threads in bino are short-lived (one per start()), so buffers of finished
+    // threads are recycled. Each buffer becomes one lane in the timeline.
+    struct buffer
+    {
+        int lane;
+        unsigned long count;
+        event events[buffer_capacity];
+    };
+
+    static std::string _filename;
+    static int64_t _start_time;
+    static pthread_key_t _key;
+    static mutex _buffers_mutex;                // Protects _buffers and _free_buffers
+    static std::vector<buffer *> _buffers;      // All buffers ever created
+    static std::vector<buffer *> _free_buffers; // Buffers of finished threads
+    static volatile sig_atomic_t _dump_requested = 0;
+
+    static void release_buffer(void *p)
+    {
+        _buffers_mutex.lock();
+        _free_buffers.push_back(static_cast<buffer *>(p));
+        _buffers_mutex.unlock();
+    }
+
+    static buffer *get_buffer()
+    {
+        buffer *b = static_cast<buffer *>(pthread_getspecific(_key));
+        if (!b)
+        {
+            _buffers_mutex.lock();
+            if (_free_buffers.empty())
+            {
+                b = new buffer;
+                b->lane = _buffers.size();
+                b->count = 0;
+                _buffers.push_back(b);
+            }
+            else
+            {
+                b = _free_buffers.back();
+                _free_buffers.pop_back();
+            }
+            _buffers_mutex.unlock();
+            (void)pthread_setspecific(_key, b);
+        }
+        return b;
+    }
+
+#if HAVE_SIGACTION
+    static void signal_dump(int)
+    {
+        _dump_requested = 1;
+    }
+#endif
+
+    static void dump_at_exit()
+    {
+        try
+        {
+            dump();
+        }
+        catch (std::exception &e)
+        {
+            msg::err("%s", e.what());
+        }
+    }
+
+    void init(const std::string &filename)
+    {
+        if (_enabled)
+        {
+            return;
+        }
+        int e = pthread_key_create(&_key, release_buffer);
+        if (e != 0)
+        {
+            throw exc(std::string("Cannot initialize tracing: ") + std::strerror(e), e);
+        }
+        _filename = filename;
+        _start_time = timer::get_microseconds(timer::monotonic);
+        _enabled = true;
+        std::atexit(dump_at_exit);
+#if HAVE_SIGACTION
+        struct sigaction signal_handler;
+        signal_handler.sa_handler = signal_dump;
+        sigemptyset(&signal_handler.sa_mask);
+        signal_handler.sa_flags = SA_RESTART;
+        (void)sigaction(SIGUSR1, &signal_handler, NULL);
+#endif
+    }
+
+    void record(const char *name, int64_t start, int64_t duration)
+    {
+        buffer *b = get_buffer();
+        event &e = b->events[b->count % buffer_capacity];
+        e.name = name;
+        e.start = start;
+        e.duration = duration;
+        atomic::increment(&b->count);
+    }
+
+    void dump()
+    {
+        if (!_enabled)
+        {
+            return;
+        }
+        FILE *f = std::fopen(_filename.c_str(), "w");
+        if (!f)
+        {
+            throw exc(std::string("Cannot open ") + _filename, errno);
+        }
+        std::fputs("{\"traceEvents\":[\n", f);
+        bool first_event = true;
+        _buffers_mutex.lock();
+        for (size_t i = 0; i < _buffers.size(); i++)
+        {
+            // Events that are overwritten while we read them may be garbled;
+            // this only affects the oldest events of a busy thread.
+            const buffer *b = _buffers[i];
+            unsigned long n = atomic::fetch(&_buffers[i]->count);
+            unsigned long j = (n > buffer_capacity ? n - buffer_capacity : 0);
+            for (; j < n; j++)
+            {
+                const event &e = b->events[j % buffer_capacity];
+                std::fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"bino\",\"ph\":\"X\","
+                        "\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d}",
+                        first_event ? "" : ",\n", e.name,
+                        static_cast<long long>(e.start - _start_time),
+                        static_cast<long long>(e.duration), b->lane);
+                first_event = false;
+            }
+        }
+        _buffers_mutex.unlock();
+        std::fputs("\n]}\n", f);
+        if (std::fflush(f) != 0 || std::ferror(f))
+        {
+            int errnum = errno;
+            std::fclose(f);
+            throw exc(std::string("Cannot write ") + _filename, errnum);
+        }
+        std::fclose(f);
+        msg::inf("Trace written to " + _filename);
+    }
+
+    void handle_dump_request()
+    {
+        if (_dump_requested)
+        {
+            _dump_requested = 0;
+            try
+            {
+                dump();
+            }
+            catch (std::exception &e)
+            {
+                msg::err("%s", e.what());
+            }
+        }
+    }
+}
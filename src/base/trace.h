@@ -0,0 +1,104 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file trace.h
+ *
+ * Timeline tracing.
+ *
+ * Scoped spans are recorded into per-thread ring buffers without locking, and
+ * written in the Chrome trace event format (JSON) that can be loaded into
+ * chrome://tracing or Perfetto. When tracing is not enabled, a span costs a
+ * single flag test.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <stdint.h>
+
+#include "timer.h"
+
+
+namespace trace
+{
+    // Do not access this directly; use enabled().
+    extern bool _enabled;
+
+    /* Enable tracing. The recorded events are written to the given file when
+     * dump() is called, at program exit, and when SIGUSR1 is received (if the
+     * platform supports it; see handle_dump_request()). */
+    void init(const std::string &filename);
+
+    /* Return whether tracing is enabled. */
+    inline bool enabled()
+    {
+        return _enabled;
+    }
+
+    /* Record a complete event for the calling thread. The name must be a string
+     * literal (only the pointer is stored). Times are in microseconds. */
+    void record(const char *name, int64_t start, int64_t duration);
+
+    /* Write all recorded events to the trace file. */
+    void dump();
+
+    /* Write the trace file if a dump was requested via signal. Signal handlers
+     * cannot safely do that themselves, so this must be called periodically
+     * from a regular thread. */
+    void handle_dump_request();
+
+    /* A span that lasts from construction to destruction (or to end()).
+     * The TRACE_SCOPE macro creates an anonymous one for the enclosing block. */
+    class scope
+    {
+    private:
+        const char *_name;
+        int64_t _start;
+
+    public:
+        scope(const char *name) :
+            _name(name), _start(enabled() ? timer::get_microseconds(timer::monotonic) : -1)
+        {
+        }
+
+        ~scope()
+        {
+            end();
+        }
+
+        // End the span before the object goes out of scope.
+        void end()
+        {
+            if (_start >= 0)
+            {
+                record(_name, _start, timer::get_microseconds(timer::monotonic) - _start);
+                _start = -1;
+            }
+        }
+    };
+}
+
+#define TRACE_SCOPE_CAT2(a, b) a ## b
+#define TRACE_SCOPE_CAT(a, b) TRACE_SCOPE_CAT2(a, b)
+#define TRACE_SCOPE(name) trace::scope TRACE_SCOPE_CAT(__trace_scope_, __LINE__)(name)
+
+#endif
@@ -32,18 +32,24 @@
 
 // The single player instance
 extern player *global_player;
+// The registered controllers
 extern std::vector<controller *> global_controllers;
+extern mutex global_controllers_mutex;
 
-controller::controller(bool receive_notifications) throw ()
+controller::controller(bool receive_notifications) throw () :
+    _thread(pthread_self())
 {
     if (receive_notifications)
     {
+        global_controllers_mutex.lock();
         global_controllers.push_back(this);
+        global_controllers_mutex.unlock();
     }
 }
 
 controller::~controller()
 {
+    global_controllers_mutex.lock();
     for (size_t i = 0; i < global_controllers.size(); i++)
     {
         if (global_controllers[i] == this)
@@ -52,13 +58,67 @@ controller::~controller()
             break;
         }
     }
+    global_controllers_mutex.unlock();
 }
 
 void controller::send_cmd(const command &cmd)
 {
     if (global_player)
     {
-        global_player->receive_cmd(cmd);
+        global_player->queue_cmd(cmd);
+    }
+}
+
+void controller::queue_notification(const notification &note)
+{
+    _notifications.push(note);
+}
+
+// Check if the controller is still registered. Controllers may be destroyed
+// while notifications are delivered, e.g. when the player is closed.
+static bool is_registered(controller *c)
+{
+    bool r = false;
+    global_controllers_mutex.lock();
+    for (size_t i = 0; i < global_controllers.size() && !r; i++)
+    {
+        r = (global_controllers[i] == c);
+    }
+    global_controllers_mutex.unlock();
+    return r;
+}
+
+void controller::process_notifications()
+{
+    pthread_t self = pthread_self();
+    std::vector<notification> notes;
+    size_t i = 0;
+    for (;;)
+    {
+        // Find the next controller that was created by this thread
+        controller *c = NULL;
+        global_controllers_mutex.lock();
+        for (; i < global_controllers.size() && !c; i++)
+        {
+            if (pthread_equal(global_controllers[i]->_thread, self))
+            {
+                c = global_controllers[i];
+            }
+        }
+        global_controllers_mutex.unlock();
+        if (!c)
+        {
+            break;
+        }
+        // Deliver its notifications
+        notes.clear();
+        if (c->_notifications.take(notes))
+        {
+            for (size_t j = 0; j < notes.size() && is_registered(c); j++)
+            {
+                c->receive_notification(notes[j]);
+            }
+        }
     }
 }
 
@@ -22,9 +22,9 @@
 #define CONTROLLER_H
 
 #include <string>
-#include <sstream>
+#include <pthread.h>
 
-#include "s11n.h"
+#include "thread.h"
 
 
 /* A controller can send commands to the player (e.g. "pause", "seek",
@@ -38,8 +38,99 @@
  * the video is now paused. The video output could use this notification to display
  * a pause symbol on screen, and the audio output controller may play a pause jingle
  * (however, in the case of pause, both currently simply ignore the notification).
+ *
+ * Commands and notifications are passed through queues, so that controllers
+ * may live in any thread. Commands can be sent from any thread; the player
+ * executes them at the beginning of its next step. Notifications are queued
+ * for each controller, and delivered when the thread that created the
+ * controller calls controller::process_notifications().
  */
 
+// The parameter of a command, or a value transported by a notification.
+// This is a small tagged union: apart from strings, it needs no memory
+// allocation and no serialization.
+
+class payload
+{
+public:
+    enum type
+    {
+        none,                           // no value
+        boolean,                        // bool
+        integer,                        // int
+        floating,                       // float
+        integer_boolean,                // int and bool (e.g. stereo layout and swap flag)
+        floating3,                      // 3 floats (e.g. crosstalk levels for R, G, B)
+        string                          // std::string
+    };
+
+private:
+    enum type _type;
+    union
+    {
+        struct
+        {
+            int i;
+            bool b;
+        } ib;                           // boolean, integer, integer_boolean
+        float f[3];                     // floating, floating3
+    } _u;
+    std::string _s;                     // string
+
+public:
+    payload() : _type(none)
+    {
+    }
+    explicit payload(bool b) : _type(boolean)
+    {
+        _u.ib.b = b;
+    }
+    explicit payload(int i) : _type(integer)
+    {
+        _u.ib.i = i;
+    }
+    explicit payload(float f) : _type(floating)
+    {
+        _u.f[0] = f;
+    }
+    payload(int i, bool b) : _type(integer_boolean)
+    {
+        _u.ib.i = i;
+        _u.ib.b = b;
+    }
+    payload(float f0, float f1, float f2) : _type(floating3)
+    {
+        _u.f[0] = f0;
+        _u.f[1] = f1;
+        _u.f[2] = f2;
+    }
+    explicit payload(const std::string &s) : _type(string), _s(s)
+    {
+    }
+
+    enum type type() const
+    {
+        return _type;
+    }
+
+    bool get_bool() const
+    {
+        return ((_type == boolean || _type == integer_boolean) ? _u.ib.b : false);
+    }
+    int get_int() const
+    {
+        return ((_type == integer || _type == integer_boolean) ? _u.ib.i : 0);
+    }
+    float get_float(int i = 0) const
+    {
+        return ((_type == floating && i == 0) || (_type == floating3 && i >= 0 && i < 3) ? _u.f[i] : 0.0f);
+    }
+    const std::string &get_string() const
+    {
+        return _s;
+    }
+};
+
 // A command that can be sent to the player by a controller.
 
 class command
@@ -81,27 +172,31 @@ public:
     };
     
     type type;
-    std::string param;
+    payload param;
 
     command(enum type t) :
-        type(t)
+        type(t), param()
     {
     }
 
     command(enum type t, int p) :
-        type(t)
+        type(t), param(p)
     {
-        std::ostringstream oss;
-        s11n::save(oss, p);
-        param = oss.str();
     }
 
     command(enum type t, float p) :
-        type(t)
+        type(t), param(p)
+    {
+    }
+
+    command(enum type t, int p, bool b) :
+        type(t), param(p, b)
+    {
+    }
+
+    command(enum type t, float p0, float p1, float p2) :
+        type(t), param(p0, p1, p2)
     {
-        std::ostringstream oss;
-        s11n::save(oss, p);
-        param = oss.str();
     }
 
     command(enum type t, const std::string &p) :
@@ -142,70 +237,68 @@ public:
     };
     
     type type;
-    std::string previous;       // previous value of the state indicated by type
-    std::string current;        // current value of the state indicated by type
+    payload previous;           // previous value of the state indicated by type
+    payload current;            // current value of the state indicated by type
 
     notification(enum type t) :
-        type(t)
+        type(t), previous(), current()
     {
     }
 
     notification(enum type t, bool p, bool c) :
-        type(t)
+        type(t), previous(p), current(c)
     {
-        std::ostringstream ossp;
-        s11n::save(ossp, p);
-        previous = ossp.str();
-        std::ostringstream ossc;
-        s11n::save(ossc, c);
-        current = ossc.str();
     }
 
     notification(enum type t, int p, int c) :
-        type(t)
+        type(t), previous(p), current(c)
     {
-        std::ostringstream ossp;
-        s11n::save(ossp, p);
-        previous = ossp.str();
-        std::ostringstream ossc;
-        s11n::save(ossc, c);
-        current = ossc.str();
     }
 
     notification(enum type t, float p, float c) :
-        type(t)
+        type(t), previous(p), current(c)
     {
-        std::ostringstream ossp;
-        s11n::save(ossp, p);
-        previous = ossp.str();
-        std::ostringstream ossc;
-        s11n::save(ossc, c);
-        current = ossc.str();
     }
 
     notification(enum type t, const std::string &p, const std::string &c) :
         type(t), previous(p), current(c)
     {
     }
+
+    notification(enum type t, const payload &p, const payload &c) :
+        type(t), previous(p), current(c)
+    {
+    }
 };
 
 // The controller interface.
 
 class controller
 {
+private:
+    pthread_t _thread;                          // The thread that created this controller
+    mpsc_queue<notification> _notifications;    // Notifications not yet delivered
+
 public:
     /* A controller usually receives notifications, but may choose not to, e.g. when it
      * never will react on any notification anyway. */
     controller(bool receive_notifications = true) throw ();
     virtual ~controller();
 
-    /* Send a command to the player. */
+    /* Send a command to the player. This can be done from any thread. */
     void send_cmd(const command &cmd);
     void send_cmd(enum command::type t) { send_cmd(command(t)); }                               // convenience wrapper
     void send_cmd(enum command::type t, int p) { send_cmd(command(t, p)); }                     // convenience wrapper
     void send_cmd(enum command::type t, float p) { send_cmd(command(t, p)); }                   // convenience wrapper
     void send_cmd(enum command::type t, const std::string &p) { send_cmd(command(t, p)); }      // convenience wrapper
 
+    /* Queue a notification for this controller. This is used by the player. */
+    void queue_notification(const notification &note);
+
+    /* Deliver the queued notifications of all controllers that were created by the
+     * calling thread. Threads that own controllers must call this regularly. */
+    static void process_notifications();
+
     /* Receive notifications via this function. The default implementation
      * simply ignores the notification. */
     virtual void receive_notification(const notification &note);
@@ -22,11 +22,17 @@
 
 #include "config.h"
 
+#include <fstream>
+#include <cerrno>
 #include <cstring>
 
 #include "dbg.h"
+#include "exc.h"
 #include "msg.h"
 #include "opt.h"
+#include "str.h"
+#include "thread.h"
+#include "trace.h"
 
 #include "player.h"
 #include "player_qt.h"
@@ -37,6 +43,130 @@
 #include "lib_versions.h"
 
 
+/* Read a playlist file. Each line is one item; the URLs of an item that
+ * consists of several inputs are separated by tabs. Empty lines and lines that
+ * start with '#' are ignored, so that simple M3U files can be used. */
+static void read_playlist(const std::string &filename, std::vector<std::vector<std::string> > &playlist)
+{
+    std::ifstream f(filename.c_str());
+    if (!f)
+    {
+        throw exc(std::string("Cannot open ") + filename, errno);
+    }
+    std::string line;
+    while (std::getline(f, line))
+    {
+        if (line.length() > 0 && line[line.length() - 1] == '\r')
+        {
+            line.erase(line.length() - 1);
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::vector<std::string> item;
+        size_t i = 0, j;
+        while ((j = line.find('\t', i)) != std::string::npos)
+        {
+            item.push_back(line.substr(i, j - i));
+            i = j + 1;
+        }
+        item.push_back(line.substr(i));
+        playlist.push_back(item);
+    }
+    if (f.bad())
+    {
+        throw exc(std::string("Cannot read ") + filename, errno);
+    }
+}
+
+/* Split an argument of the form ROLE:SETTING of one of the thread options. */
+static thread::role_t thread_role_option(const std::string &option, const std::string &arg, std::string &setting)
+{
+    thread::role_t role;
+    size_t colon = arg.find(':');
+    if (colon == std::string::npos || !thread::role_from_string(arg.substr(0, colon), role)
+            || role == thread::generic)
+    {
+        throw exc("Invalid argument for --" + option + ": " + arg
+                + " (expected io, decode, audio, or render, followed by ':')");
+    }
+    setting = arg.substr(colon + 1);
+    return role;
+}
+
+/* Configure the thread roles from the --thread-affinity, --thread-priority
+ * and --thread-stack options. */
+static void set_thread_roles(const std::vector<std::string> &affinity,
+        const std::vector<std::string> &priority, const std::vector<std::string> &stack)
+{
+    std::string setting;
+    for (size_t i = 0; i < affinity.size(); i++)
+    {
+        // A comma-separated list of CPUs and CPU ranges, e.g. 0,2-3
+        thread::role_t role = thread_role_option("thread-affinity", affinity[i], setting);
+        thread::role_attributes attr = thread::get_role_attributes(role);
+        attr.cpus.clear();
+        size_t j = 0;
+        while (j <= setting.length())
+        {
+            size_t k = setting.find(',', j);
+            std::string range = setting.substr(j, k == std::string::npos ? std::string::npos : k - j);
+            size_t dash = range.find('-');
+            int first = str::to<int>(range.substr(0, dash));
+            int last = (dash == std::string::npos ? first : str::to<int>(range.substr(dash + 1)));
+            if (first < 0 || last < first)
+            {
+                throw exc("Invalid CPU range for --thread-affinity: " + range);
+            }
+            for (int cpu = first; cpu <= last; cpu++)
+            {
+                attr.cpus.push_back(cpu);
+            }
+            j = (k == std::string::npos ? std::string::npos : k + 1);
+        }
+        thread::set_role_attributes(role, attr);
+    }
+    for (size_t i = 0; i < priority.size(); i++)
+    {
+        // Either a nice level, or fifo:N for real time priority N
+        thread::role_t role = thread_role_option("thread-priority", priority[i], setting);
+        thread::role_attributes attr = thread::get_role_attributes(role);
+        if (setting.compare(0, 5, "fifo:") == 0)
+        {
+            attr.fifo_priority = str::to<int>(setting.substr(5));
+            if (attr.fifo_priority < 1 || attr.fifo_priority > 99)
+            {
+                throw exc("Invalid real time priority for --thread-priority: " + setting);
+            }
+        }
+        else
+        {
+            attr.fifo_priority = 0;
+            attr.set_nice = true;
+            attr.nice = str::to<int>(setting);
+            if (attr.nice < -20 || attr.nice > 19)
+            {
+                throw exc("Invalid nice level for --thread-priority: " + setting);
+            }
+        }
+        thread::set_role_attributes(role, attr);
+    }
+    for (size_t i = 0; i < stack.size(); i++)
+    {
+        // Stack size in KiB
+        thread::role_t role = thread_role_option("thread-stack", stack[i], setting);
+        thread::role_attributes attr = thread::get_role_attributes(role);
+        int kib = str::to<int>(setting);
+        if (kib < 0)
+        {
+            throw exc("Invalid stack size for --thread-stack: " + setting);
+        }
+        attr.stack_size = static_cast<size_t>(kib) * 1024;
+        thread::set_role_attributes(role, attr);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     /* Initialization */
@@ -122,6 +252,22 @@ int main(int argc, char *argv[])
     options.push_back(&swap_eyes);
     opt::flag benchmark("benchmark", 'b', opt::optional);
     options.push_back(&benchmark);
+    std::vector<std::string> audio_buffering_modes;
+    audio_buffering_modes.push_back("low-latency");
+    audio_buffering_modes.push_back("normal");
+    audio_buffering_modes.push_back("robust");
+    opt::val<std::string> audio_buffering("audio-buffering", '\0', opt::optional, audio_buffering_modes, "normal");
+    options.push_back(&audio_buffering);
+    opt::val<std::string> trace_file("trace", '\0', opt::optional);
+    options.push_back(&trace_file);
+    opt::val<std::string> playlist_file("playlist", '\0', opt::optional);
+    options.push_back(&playlist_file);
+    opt::val<std::string> thread_affinity("thread-affinity", '\0', opt::optional);
+    options.push_back(&thread_affinity);
+    opt::val<std::string> thread_priority("thread-priority", '\0', opt::optional);
+    options.push_back(&thread_priority);
+    opt::val<std::string> thread_stack("thread-stack", '\0', opt::optional);
+    options.push_back(&thread_stack);
     opt::val<float> parallax("parallax", 'P', opt::optional, -1.0f, +1.0f, parameters().parallax);
     options.push_back(&parallax);
     opt::tuple<float> crosstalk("crosstalk", 'C', opt::optional, 0.0f, 1.0f, std::vector<float>(3, parameters().crosstalk_r), 3);
@@ -139,6 +285,8 @@ int main(int argc, char *argv[])
     options.push_back(&eq_logfile);
     opt::val<std::string> eq_render_client("eq-render-client", '\0', opt::optional);
     options.push_back(&eq_render_client);
+    opt::flag broadcast_packets("broadcast-packets", '\0', opt::optional);
+    options.push_back(&broadcast_packets);
 
     std::vector<std::string> arguments;
 #ifdef __APPLE__
@@ -233,6 +381,20 @@ int main(int argc, char *argv[])
                 "                           values for the R,G,B channels.\n"
                 "  -G|--ghostbust=VAL       Amount of ghostbusting to apply (0 to 1).\n"
                 "  -b|--benchmark           Benchmark mode (no audio, show fps).\n"
+                "  --audio-buffering=MODE   Audio buffering (low-latency/normal/robust).\n"
+                "  --trace=FILE             Write a timeline trace of the playback pipeline\n"
+                "                           to FILE (Chrome trace event format).\n"
+                "  --playlist=FILE          Play the items listed in FILE after the given\n"
+                "                           input (one item per line).\n"
+                "  --thread-affinity=ROLE:CPUS\n"
+                "                           Run the threads of ROLE (io, decode, audio, or\n"
+                "                           render) on the given CPUs, e.g. decode:1-3.\n"
+                "  --thread-priority=ROLE:PRIO\n"
+                "                           Run the threads of ROLE with the given nice\n"
+                "                           level, or with real time priority N (fifo:N).\n"
+                "  --thread-stack=ROLE:KIB  Stack size for the threads of ROLE.\n"
+                "  --broadcast-packets      Equalizer: read the input only on the application\n"
+                "                           node, and send the packets to the render nodes.\n"
                 "\n"
                 "Interactive control:\n"
                 "  q or ESC                 Quit.\n"
@@ -287,6 +449,8 @@ int main(int argc, char *argv[])
     else if (log_level.value() == "debug")
     {
         init_data.log_level = msg::DBG;
+        // Debug output is heavy; do not let it block the decoding threads.
+        msg::set_async(true);
     }
     else if (log_level.value() == "info")
     {
@@ -346,6 +510,9 @@ int main(int argc, char *argv[])
     init_data.fullscreen = fullscreen.value();
     init_data.center = center.value();
     init_data.benchmark = benchmark.value();
+    init_data.audio_buffering = (audio_buffering.value() == "low-latency" ? audio_output::low_latency
+            : audio_buffering.value() == "robust" ? audio_output::robust
+            : audio_output::normal);
     if (init_data.benchmark)
     {
         msg::inf("Benchmark mode: audio and time synchronization disabled.");
@@ -361,10 +528,32 @@ int main(int argc, char *argv[])
     player *player = NULL;
     try
     {
+        if (trace_file.value() != "")
+        {
+            trace::init(trace_file.value());
+        }
+        set_thread_roles(thread_affinity.values(), thread_priority.values(), thread_stack.values());
+        // This thread does the presentation and feeds the audio output
+        thread::apply_role(thread::render);
+        if (playlist_file.value() != "")
+        {
+            read_playlist(playlist_file.value(), init_data.playlist);
+            if (init_data.urls.empty() && !init_data.playlist.empty())
+            {
+                init_data.urls = init_data.playlist.front();
+                init_data.playlist.erase(init_data.playlist.begin());
+            }
+        }
         if (equalizer)
         {
 #if HAVE_LIBEQUALIZER
-            player = new class player_equalizer(&argc, argv, equalizer_flat_screen);
+            if (!init_data.playlist.empty())
+            {
+                // The render clients cannot follow the master to the next item
+                msg::wrn("Playlists are not supported in Equalizer mode; playing only the first item.");
+                init_data.playlist.clear();
+            }
+            player = new class player_equalizer(&argc, argv, equalizer_flat_screen, broadcast_packets.value());
 #else
             throw exc("This version of Bino was compiled without support for Equalizer.");
 #endif
@@ -381,7 +570,7 @@ int main(int argc, char *argv[])
         }
         else
         {
-            if (arguments.size() == 0)
+            if (init_data.urls.size() == 0)
             {
                 throw exc("No video to play.");
             }
@@ -266,58 +266,82 @@ static int next_multiple_of_4(int x)
 
 void video_frame::copy_plane(int view, int plane, void *buf) const
 {
-    char *dst = reinterpret_cast<char *>(buf);
-    const char *src = NULL;
-    size_t src_offset = 0;
-    size_t src_row_size = 0;
-    size_t dst_row_width = 0;
-    size_t dst_row_size = 0;
-    size_t lines = 0;
+    copy_plane(view, plane, buf, 0, 0, width, height);
+}
 
+static void get_plane_properties(video_frame::layout_t layout, int plane,
+        int *bytes_per_pixel, int *width_divisor, int *height_divisor)
+{
+    *bytes_per_pixel = 1;
+    *width_divisor = 1;
+    *height_divisor = 1;
     switch (layout)
     {
-    case bgra32:
-        dst_row_width = width * 4;
-        dst_row_size = dst_row_width;
-        lines = height;
+    case video_frame::bgra32:
+        *bytes_per_pixel = 4;
         break;
 
-    case yuv444p:
-        dst_row_width = width;
-        dst_row_size = next_multiple_of_4(dst_row_width);
-        lines = height;
+    case video_frame::yuv444p:
         break;
 
-    case yuv422p:
-        if (plane == 0)
-        {
-            dst_row_width = width;
-            dst_row_size = next_multiple_of_4(dst_row_width);
-            lines = height;
-        }
-        else
+    case video_frame::yuv422p:
+        if (plane != 0)
         {
-            dst_row_width = width / 2;
-            dst_row_size = next_multiple_of_4(dst_row_width);
-            lines = height;
+            *width_divisor = 2;
         }
         break;
 
-    case yuv420p:
-        if (plane == 0)
+    case video_frame::yuv420p:
+        if (plane != 0)
         {
-            dst_row_width = width;
-            dst_row_size = next_multiple_of_4(dst_row_width);
-            lines = height;
+            *width_divisor = 2;
+            *height_divisor = 2;
         }
-        else
+        break;
+    }
+}
+
+// Copy lines of dst_row_width bytes. Destination lines are padded to multiples of 4 bytes.
+static void copy_lines(char *dst, const char *src, size_t src_offset, size_t src_row_size,
+        size_t dst_row_width, size_t lines)
+{
+    size_t dst_row_size = next_multiple_of_4(dst_row_width);
+    if (src_row_size == dst_row_size && src_offset % src_row_size == 0)
+    {
+        // Whole lines starting at column 0: copy them in one go
+        std::memcpy(dst, src + src_offset, lines * src_row_size);
+    }
+    else
+    {
+        size_t dst_offset = 0;
+        for (size_t line = 0; line < lines; line++)
         {
-            dst_row_width = width / 2;
-            dst_row_size = next_multiple_of_4(dst_row_width);
-            lines = height / 2;
+            std::memcpy(dst + dst_offset, src + src_offset, dst_row_width);
+            dst_offset += dst_row_size;
+            src_offset += src_row_size;
         }
-        break;
     }
+}
+
+void video_frame::copy_plane(int view, int plane, void *buf, int x, int y, int w, int h) const
+{
+    char *dst = reinterpret_cast<char *>(buf);
+    const char *src = NULL;
+    size_t src_offset = 0;
+    size_t src_row_size = 0;
+    size_t dst_row_width = 0;
+    size_t lines = 0;
+    size_t view_row_width = 0;
+    size_t view_lines = 0;
+    int bytes_per_pixel;
+    int width_divisor;
+    int height_divisor;
+
+    get_plane_properties(layout, plane, &bytes_per_pixel, &width_divisor, &height_divisor);
+    view_row_width = width / width_divisor * bytes_per_pixel;
+    view_lines = height / height_divisor;
+    dst_row_width = w / width_divisor * bytes_per_pixel;
+    lines = h / height_divisor;
 
     if (stereo_layout_swap)
     {
@@ -339,13 +363,13 @@ void video_frame::copy_plane(int view, int plane, void *buf) const
     case top_bottom_half:
         src = static_cast<const char *>(data[0][plane]);
         src_row_size = line_size[0][plane];
-        src_offset = view * lines * src_row_size;
+        src_offset = view * view_lines * src_row_size;
         break;
     case left_right:
     case left_right_half:
         src = static_cast<const char *>(data[0][plane]);
         src_row_size = line_size[0][plane];
-        src_offset = view * dst_row_width;
+        src_offset = view * view_row_width;
         break;
     case even_odd_rows:
         src = static_cast<const char *>(data[0][plane]);
@@ -353,21 +377,21 @@ void video_frame::copy_plane(int view, int plane, void *buf) const
         src_offset = view * line_size[0][plane];
         break;
     }
+    src_offset += (y / height_divisor) * src_row_size + (x / width_divisor) * bytes_per_pixel;
+    copy_lines(dst, src, src_offset, src_row_size, dst_row_width, lines);
+}
 
-    if (src_row_size == dst_row_size)
-    {
-        std::memcpy(dst, src + src_offset, lines * src_row_size);
-    }
-    else
-    {
-        size_t dst_offset = 0;
-        for (size_t y = 0; y < lines; y++)
-        {
-            std::memcpy(dst + dst_offset, src + src_offset, dst_row_width);
-            dst_offset += dst_row_size;
-            src_offset += src_row_size;
-        }
-    }
+void video_frame::copy_packed_plane(int plane, void *buf, int x, int y, int w, int h) const
+{
+    int bytes_per_pixel;
+    int width_divisor;
+    int height_divisor;
+
+    get_plane_properties(layout, plane, &bytes_per_pixel, &width_divisor, &height_divisor);
+    size_t src_row_size = line_size[0][plane];
+    size_t src_offset = (y / height_divisor) * src_row_size + (x / width_divisor) * bytes_per_pixel;
+    copy_lines(reinterpret_cast<char *>(buf), static_cast<const char *>(data[0][plane]),
+            src_offset, src_row_size, w / width_divisor * bytes_per_pixel, h / height_divisor);
 }
 
 audio_blob::audio_blob() :
@@ -746,40 +770,63 @@ void parameters::stereo_mode_from_string(const std::string &s, stereo_mode_t &st
     }
 }
 
-void parameters::save(std::ostream &os) const
+// The same code serializes to streams and to s11n::writer / s11n::reader.
+template<typename S>
+static void save_parameters(S &os, const parameters &p)
 {
-    s11n::save(os, static_cast<int>(stereo_mode));
-    s11n::save(os, stereo_mode_swap);
-    s11n::save(os, parallax);
-    s11n::save(os, crosstalk_r);
-    s11n::save(os, crosstalk_g);
-    s11n::save(os, crosstalk_b);
-    s11n::save(os, ghostbust);
-    s11n::save(os, contrast);
-    s11n::save(os, brightness);
-    s11n::save(os, hue);
-    s11n::save(os, saturation);
-    s11n::save(os, subtitles_color);
-    s11n::save(os, subtitles_font);
-    s11n::save(os, subtitles_encoding);
+    s11n::save(os, static_cast<int>(p.stereo_mode));
+    s11n::save(os, p.stereo_mode_swap);
+    s11n::save(os, p.parallax);
+    s11n::save(os, p.crosstalk_r);
+    s11n::save(os, p.crosstalk_g);
+    s11n::save(os, p.crosstalk_b);
+    s11n::save(os, p.ghostbust);
+    s11n::save(os, p.contrast);
+    s11n::save(os, p.brightness);
+    s11n::save(os, p.hue);
+    s11n::save(os, p.saturation);
+    s11n::save(os, p.subtitles_color);
+    s11n::save(os, p.subtitles_font);
+    s11n::save(os, p.subtitles_encoding);
 }
 
-void parameters::load(std::istream &is)
+template<typename S>
+static void load_parameters(S &is, parameters &p)
 {
     int x;
     s11n::load(is, x);
-    stereo_mode = static_cast<stereo_mode_t>(x);
-    s11n::load(is, stereo_mode_swap);
-    s11n::load(is, parallax);
-    s11n::load(is, crosstalk_r);
-    s11n::load(is, crosstalk_g);
-    s11n::load(is, crosstalk_b);
-    s11n::load(is, ghostbust);
-    s11n::load(is, contrast);
-    s11n::load(is, brightness);
-    s11n::load(is, hue);
-    s11n::load(is, saturation);
-    s11n::load(is, subtitles_color);
-    s11n::load(is, subtitles_font);
-    s11n::load(is, subtitles_encoding);
+    p.stereo_mode = static_cast<parameters::stereo_mode_t>(x);
+    s11n::load(is, p.stereo_mode_swap);
+    s11n::load(is, p.parallax);
+    s11n::load(is, p.crosstalk_r);
+    s11n::load(is, p.crosstalk_g);
+    s11n::load(is, p.crosstalk_b);
+    s11n::load(is, p.ghostbust);
+    s11n::load(is, p.contrast);
+    s11n::load(is, p.brightness);
+    s11n::load(is, p.hue);
+    s11n::load(is, p.saturation);
+    s11n::load(is, p.subtitles_color);
+    s11n::load(is, p.subtitles_font);
+    s11n::load(is, p.subtitles_encoding);
+}
+
+void parameters::save(std::ostream &os) const
+{
+    save_parameters(os, *this);
+}
+
+void parameters::load(std::istream &is)
+{
+    load_parameters(is, *this);
+}
+
+void parameters::save(s11n::writer &w) const
+{
+    save_parameters(w, *this);
+}
+
+void parameters::load(s11n::reader &r)
+{
+    load_parameters(r, *this);
 }
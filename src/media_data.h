@@ -109,6 +109,19 @@ public:
     // Copy the data of the given view (0=left, 1=right) and the given plane (see layout)
     // to the given destination.
     void copy_plane(int view, int plane, void *dst) const;
+    // Copy only the given rectangle of the view, in pixels from the top left corner.
+    // The rectangle must be aligned to the chroma subsampling of the layout.
+    void copy_plane(int view, int plane, void *dst, int x, int y, int w, int h) const;
+
+    // Do both views share one frame (top_bottom*, left_right*, even_odd_rows)?
+    bool has_packed_views() const
+    {
+        return (stereo_layout != mono && stereo_layout != separate);
+    }
+    // Copy the given rectangle of the given plane of a frame with packed views, without
+    // separating the views. The rectangle is in pixels from the top left corner of the
+    // raw frame, and must be aligned to the chroma subsampling of the layout.
+    void copy_packed_plane(int plane, void *dst, int x, int y, int w, int h) const;
 
     // Return a string describing the format (layout, color space, value range, chroma location)
     std::string format_info() const;    // Human readable information
@@ -255,6 +268,8 @@ public:
     // Serialization
     void save(std::ostream &os) const;
     void load(std::istream &is);
+    void save(s11n::writer &w) const;
+    void load(s11n::reader &r);
 };
 
 #endif
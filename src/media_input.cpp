@@ -28,10 +28,32 @@
 #include "exc.h"
 #include "msg.h"
 #include "str.h"
+#include "thread.h"
 
 #include "media_input.h"
 
 
+// Opens a media object. Used to open the media objects of an input
+// concurrently, since probing a file can take a long time.
+class media_object_open_thread : public thread
+{
+private:
+    std::string _url;
+    media_object *_media_object;
+
+public:
+    media_object_open_thread(const std::string &url, media_object *media_object) :
+        thread(thread::io), _url(url), _media_object(media_object)
+    {
+    }
+
+    void run()
+    {
+        _media_object->open(_url);
+    }
+};
+
+
 media_input::media_input() :
     _active_video_stream(-1), _active_audio_stream(-1), _active_subtitle_stream(-1),
     _have_active_video_read(false), _have_active_audio_read(false), _have_active_subtitle_read(false),
@@ -94,6 +116,44 @@ void media_input::get_subtitle_stream(int stream, int &media_object, int &media_
     }
 }
 
+bool media_input::media_object_is_read(int media_object) const
+{
+    int o, s;
+    if (_active_video_stream >= 0)
+    {
+        get_video_stream(_active_video_stream, o, s);
+        if (o == media_object)
+        {
+            return true;
+        }
+        if (_video_frame.stereo_layout == video_frame::separate)
+        {
+            get_video_stream(1, o, s);
+            if (o == media_object)
+            {
+                return true;
+            }
+        }
+    }
+    if (_active_audio_stream >= 0)
+    {
+        get_audio_stream(_active_audio_stream, o, s);
+        if (o == media_object)
+        {
+            return true;
+        }
+    }
+    if (_active_subtitle_stream >= 0)
+    {
+        get_subtitle_stream(_active_subtitle_stream, o, s);
+        if (o == media_object)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Get the basename of an URL (just the file name, without leading paths)
 static std::string basename(const std::string &url)
 {
@@ -114,15 +174,47 @@ static std::string basename(const std::string &url)
     }
 }
 
-void media_input::open(const std::vector<std::string> &urls)
+void media_input::open(const std::vector<std::string> &urls,
+        const std::vector<std::string> &stream_descriptions)
 {
     assert(urls.size() > 0);
+    assert(stream_descriptions.empty() || stream_descriptions.size() == urls.size());
 
-    // Open media objects
+    // Open media objects. With more than one object, they are opened in
+    // parallel; the stream lists are merged below in the order of the URLs.
+    // Remote media objects open quickly since they do not access their URL.
     _media_objects.resize(urls.size());
-    for (size_t i = 0; i < urls.size(); i++)
+    if (!stream_descriptions.empty())
+    {
+        for (size_t i = 0; i < urls.size(); i++)
+        {
+            _media_objects[i].open_remote(urls[i], stream_descriptions[i]);
+        }
+    }
+    else if (urls.size() == 1)
     {
-        _media_objects[i].open(urls[i]);
+        _media_objects[0].open(urls[0]);
+    }
+    else
+    {
+        std::vector<media_object_open_thread> open_threads;
+        for (size_t i = 0; i < urls.size(); i++)
+        {
+            open_threads.push_back(media_object_open_thread(urls[i], &(_media_objects[i])));
+        }
+        for (size_t i = 0; i < open_threads.size(); i++)
+        {
+            open_threads[i].start();
+        }
+        // Wait for all threads before reporting the first error, if any
+        for (size_t i = 0; i < open_threads.size(); i++)
+        {
+            open_threads[i].wait();
+        }
+        for (size_t i = 0; i < open_threads.size(); i++)
+        {
+            open_threads[i].finish();
+        }
     }
 
     // Construct id for this input
@@ -309,6 +401,16 @@ void media_input::open(const std::vector<std::string> &urls)
     }
 }
 
+std::vector<std::string> media_input::stream_descriptions() const
+{
+    std::vector<std::string> descriptions;
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        descriptions.push_back(_media_objects[i].stream_description());
+    }
+    return descriptions;
+}
+
 const std::string &media_input::id() const
 {
     return _id;
@@ -445,18 +547,11 @@ void media_input::set_stereo_layout(video_frame::stereo_layout_t layout, bool sw
 
 void media_input::select_video_stream(int video_stream)
 {
+    // Only the video read is affected; audio and subtitle reads can continue.
     if (_have_active_video_read)
     {
         (void)finish_video_frame_read();
     }
-    if (_have_active_audio_read)
-    {
-        (void)finish_audio_blob_read();
-    }
-    if (_have_active_subtitle_read)
-    {
-        (void)finish_subtitle_box_read();
-    }
     assert(video_stream >= 0);
     assert(video_stream < video_streams());
     if (_video_frame.stereo_layout == video_frame::separate)
@@ -487,23 +582,19 @@ void media_input::select_video_stream(int video_stream)
 
 void media_input::select_audio_stream(int audio_stream)
 {
-    if (_have_active_video_read)
-    {
-        (void)finish_video_frame_read();
-    }
+    // Only the audio read is affected; video and subtitle reads can continue.
+    // A pending audio read belongs to the old stream and is thrown away.
     if (_have_active_audio_read)
     {
         (void)finish_audio_blob_read();
     }
-    if (_have_active_subtitle_read)
-    {
-        (void)finish_subtitle_box_read();
-    }
     assert(audio_stream >= 0);
     assert(audio_stream < audio_streams());
-    _active_audio_stream = audio_stream;
     int o, s;
-    get_audio_stream(_active_audio_stream, o, s);
+    get_audio_stream(audio_stream, o, s);
+    bool object_was_read = media_object_is_read(o);
+    int64_t pos = tell();
+    _active_audio_stream = audio_stream;
     for (size_t i = 0; i < _media_objects.size(); i++)
     {
         for (int j = 0; j < _media_objects[i].audio_streams(); j++)
@@ -511,27 +602,27 @@ void media_input::select_audio_stream(int audio_stream)
             _media_objects[i].audio_stream_set_active(j, (i == static_cast<size_t>(o) && j == s));
         }
     }
+    if (!object_was_read && pos > std::numeric_limits<int64_t>::min())
+    {
+        // The read position of this media object is stale.
+        _media_objects[o].seek(pos);
+    }
 }
 
 void media_input::select_subtitle_stream(int subtitle_stream)
 {
-    if (_have_active_video_read)
-    {
-        (void)finish_video_frame_read();
-    }
-    if (_have_active_audio_read)
-    {
-        (void)finish_audio_blob_read();
-    }
+    // Only the subtitle read is affected; video and audio reads can continue.
     if (_have_active_subtitle_read)
     {
         (void)finish_subtitle_box_read();
     }
     assert(subtitle_stream >= 0);
     assert(subtitle_stream < subtitle_streams());
-    _active_subtitle_stream = subtitle_stream;
     int o, s;
-    get_subtitle_stream(_active_subtitle_stream, o, s);
+    get_subtitle_stream(subtitle_stream, o, s);
+    bool object_was_read = media_object_is_read(o);
+    int64_t pos = tell();
+    _active_subtitle_stream = subtitle_stream;
     for (size_t i = 0; i < _media_objects.size(); i++)
     {
         for (int j = 0; j < _media_objects[i].subtitle_streams(); j++)
@@ -539,6 +630,11 @@ void media_input::select_subtitle_stream(int subtitle_stream)
             _media_objects[i].subtitle_stream_set_active(j, (i == static_cast<size_t>(o) && j == s));
         }
     }
+    if (!object_was_read && pos > std::numeric_limits<int64_t>::min())
+    {
+        // The read position of this media object is stale.
+        _media_objects[o].seek(pos);
+    }
 }
 
 void media_input::start_video_frame_read()
@@ -582,6 +678,10 @@ video_frame media_input::finish_video_frame_read()
         video_frame f1 = _media_objects[o1].finish_video_frame_read(s1);
         if (f0.is_valid() && f1.is_valid())
         {
+            if (f0.raw_width != _video_frame.raw_width || f0.raw_height != _video_frame.raw_height)
+            {
+                update_video_frame_size(f0);
+            }
             frame = _video_frame;
             for (int p = 0; p < 3; p++)
             {
@@ -600,6 +700,10 @@ video_frame media_input::finish_video_frame_read()
         video_frame f = _media_objects[o].finish_video_frame_read(s);
         if (f.is_valid())
         {
+            if (f.raw_width != _video_frame.raw_width || f.raw_height != _video_frame.raw_height)
+            {
+                update_video_frame_size(f);
+            }
             frame = _video_frame;
             for (int p = 0; p < 3; p++)
             {
@@ -614,6 +718,21 @@ video_frame media_input::finish_video_frame_read()
     return frame;
 }
 
+void media_input::update_video_frame_size(const video_frame &frame)
+{
+    // This happens if the stream information from the probe cache was wrong.
+    // Keep the stereo layout if it still fits to the new size.
+    _video_frame.raw_width = frame.raw_width;
+    _video_frame.raw_height = frame.raw_height;
+    _video_frame.raw_aspect_ratio = frame.raw_aspect_ratio;
+    if (!stereo_layout_is_supported(_video_frame.stereo_layout, _video_frame.stereo_layout_swap))
+    {
+        _video_frame.stereo_layout = frame.stereo_layout;
+        _video_frame.stereo_layout_swap = frame.stereo_layout_swap;
+    }
+    _video_frame.set_view_dimensions();
+}
+
 void media_input::start_audio_blob_read(size_t size)
 {
     assert(_active_audio_stream >= 0);
@@ -704,6 +823,31 @@ void media_input::seek(int64_t pos)
     }
 }
 
+void media_input::set_packet_export(bool enable)
+{
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        _media_objects[i].set_packet_export(enable);
+    }
+}
+
+void media_input::export_packets(std::vector<std::string> &packets)
+{
+    packets.resize(_media_objects.size());
+    for (size_t i = 0; i < _media_objects.size(); i++)
+    {
+        _media_objects[i].export_packets(packets[i]);
+    }
+}
+
+void media_input::import_packets(const std::vector<std::string> &packets)
+{
+    for (size_t i = 0; i < _media_objects.size() && i < packets.size(); i++)
+    {
+        _media_objects[i].import_packets(packets[i]);
+    }
+}
+
 void media_input::close()
 {
     try
@@ -60,6 +60,10 @@ private:
     void get_video_stream(int stream, int &media_object, int &media_object_video_stream) const;
     void get_audio_stream(int stream, int &media_object, int &media_object_audio_stream) const;
     void get_subtitle_stream(int stream, int &media_object, int &media_object_subtitle_stream) const;
+    // Whether any of the active streams is read from the given media object.
+    bool media_object_is_read(int media_object) const;
+    // Adapt the video frame template to a frame whose size differs from it.
+    void update_video_frame_size(const video_frame &frame);
 
 public:
 
@@ -68,9 +72,16 @@ public:
     media_input();
     ~media_input();
 
-    /* Open this input by combining the media objects at the given URLS. */
+    /* Open this input by combining the media objects at the given URLS.
+     * If stream descriptions of the media objects are given (see below), the
+     * media objects are opened as remote media objects that do not access the
+     * URLs and get their packets via import_packets(). */
 
-    void open(const std::vector<std::string> &urls);
+    void open(const std::vector<std::string> &urls,
+            const std::vector<std::string> &stream_descriptions = std::vector<std::string>());
+
+    /* Get the stream descriptions of the media objects. */
+    std::vector<std::string> stream_descriptions() const;
 
     /* Get information */
 
@@ -207,6 +218,17 @@ public:
      * stream, ...) */
     void seek(int64_t pos);
 
+    /*
+     * Packet distribution
+     */
+
+    /* Export the compressed packets of the active video stream(s) of all media
+     * objects, or import them into the media objects of a remote input. See
+     * media_object for details. There is one string of packets per media object. */
+    void set_packet_export(bool enable);
+    void export_packets(std::vector<std::string> &packets);
+    void import_packets(const std::vector<std::string> &packets);
+
     /*
      * Cleanup
      */
@@ -28,13 +28,16 @@ extern "C"
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
+#include <libavutil/pixdesc.h>
 }
 
 #include <deque>
+#include <algorithm>
 #include <limits>
 #include <cerrno>
 #include <cstring>
 #include <cctype>
+#include <sstream>
 
 #if HAVE_SYSCONF
 #  include <unistd.h>
@@ -46,15 +49,21 @@ extern "C"
 #include "blob.h"
 #include "exc.h"
 #include "msg.h"
+#include "s11n.h"
 #include "str.h"
+#include "task.h"
 #include "thread.h"
+#include "trace.h"
 
 #include "media_object.h"
+#include "probe_cache.h"
 
 
 // The read thread.
 // This thread reads packets from the AVFormatContext and stores them in the
-// appropriate packet queues.
+// appropriate packet queues. For remote media objects, the packets are imported
+// from elsewhere instead, and this thread does nothing; the video decoders wait
+// until packets are imported.
 class read_thread : public thread
 {
 private:
@@ -70,11 +79,17 @@ public:
     {
         return _eof;
     }
+    void set_eof()
+    {
+        _eof = true;
+    }
 };
 
-// The video decode thread.
-// This thread reads packets from its packet queue and decodes them to video frames.
-class video_decode_thread : public thread
+// The video decode task.
+// This task reads packets from its packet queue and decodes them to video frames.
+// It runs on the process-wide task pool, as do the slice threading jobs of the
+// decoder and the pixel format conversion.
+class video_decode_task : public task
 {
 private:
     std::string _url;
@@ -85,7 +100,7 @@ private:
     int64_t handle_timestamp(int64_t timestamp);
 
 public:
-    video_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int video_stream);
+    video_decode_task(const std::string &url, struct ffmpeg_stuff *ffmpeg, int video_stream);
     void run();
     const video_frame &frame()
     {
@@ -114,9 +129,9 @@ public:
     }
 };
 
-// The subtitle decode thread.
-// This thread reads packets from its packet queue and decodes them to subtitle boxes.
-class subtitle_decode_thread : public thread
+// The subtitle decode task.
+// This task reads packets from its packet queue and decodes them to subtitle boxes.
+class subtitle_decode_task : public task
 {
 private:
     std::string _url;
@@ -127,7 +142,7 @@ private:
     int64_t handle_timestamp(int64_t timestamp);
 
 public:
-    subtitle_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int subtitle_stream);
+    subtitle_decode_task(const std::string &url, struct ffmpeg_stuff *ffmpeg, int subtitle_stream);
     void run();
     const subtitle_box &box()
     {
@@ -144,25 +159,38 @@ static const size_t audio_tmpbuf_size = (AVCODEC_MAX_AUDIO_FRAME_SIZE * 3) / 2;
 struct ffmpeg_stuff
 {
     AVFormatContext *format_ctx;
+    bool probe_cache_used;
 
     bool have_active_audio_stream;
     int64_t pos;
 
     read_thread *reader;
+    mutex stream_state_mutex;   // held while reading a packet or (de)activating a stream
+    int *stop_request;          // if set and nonzero, reading is aborted (accessed atomically)
+
+    bool remote;                        // opened from a stream description; packets are imported
+    bool packet_export;                 // record the packets of active video streams?
+    mutex packet_export_mutex;          // protects exported_packets
+    std::string exported_packets;       // packet records not yet exported
+    std::string imported_packets;       // packet records kept back until the next seek
 
     std::vector<int> video_streams;
     std::vector<AVCodecContext *> video_codec_ctxs;
     std::vector<video_frame> video_frame_templates;
     std::vector<struct SwsContext *> video_img_conv_ctxs;
+    std::vector<std::vector<struct SwsContext *> > video_img_conv_band_ctxs;   // for parallel conversion
+    std::vector<std::vector<int> > video_img_conv_bands;                       // first row of each band
     std::vector<AVCodec *> video_codecs;
     std::vector<std::deque<AVPacket> > video_packet_queues;
     std::vector<mutex> video_packet_queue_mutexes;
+    std::vector<condition> video_packet_queue_conds;    // signaled when packets are imported
     std::vector<AVPacket> video_packets;
-    std::vector<video_decode_thread> video_decode_threads;
+    std::vector<video_decode_task> video_decode_tasks;
     std::vector<AVFrame *> video_frames;
     std::vector<AVFrame *> video_out_frames;
     std::vector<uint8_t *> video_buffers;
     std::vector<int64_t> video_last_timestamps;
+    std::vector<bool> video_previews;
 
     std::vector<int> audio_streams;
     std::vector<AVCodecContext *> audio_codec_ctxs;
@@ -182,34 +210,183 @@ struct ffmpeg_stuff
     std::vector<AVCodec *> subtitle_codecs;
     std::vector<std::deque<AVPacket> > subtitle_packet_queues;
     std::vector<mutex> subtitle_packet_queue_mutexes;
-    std::vector<subtitle_decode_thread> subtitle_decode_threads;
+    std::vector<subtitle_decode_task> subtitle_decode_tasks;
     std::vector<std::deque<subtitle_box> > subtitle_box_buffers;
     std::vector<int64_t> subtitle_last_timestamps;
 };
 
-// Use one decoding thread per processor for video decoding.
-static int video_decoding_threads()
+static bool stop_requested(const struct ffmpeg_stuff *ffmpeg)
+{
+    return (ffmpeg->stop_request && atomic::fetch(ffmpeg->stop_request));
+}
+
+// The number of video decoders that are currently open, in all media objects.
+// The workers of the task pool are shared among them. Preview decoders do not
+// count: they decode on their own low priority thread and must not reduce the
+// share of the playback decoders.
+static int active_video_decoders = 0;
+
+// The number of pool workers that one video stream may use at a time.
+static int video_decoding_budget()
 {
-    static long n = -1;
-    if (n < 0)
+    int active = std::max(active_video_decoders, 1);
+    return std::max(task::workers() / active, 1);
+}
+
+// Replacements for FFmpeg's execute() and execute2() functions, which run
+// slice threading jobs. The jobs are executed on the task pool, within the
+// budget of the stream.
+class ffmpeg_execute_job : public parallel_job
+{
+private:
+    AVCodecContext *_ctx;
+    int (*_func)(AVCodecContext *, void *);
+    int (*_func2)(AVCodecContext *, void *, int, int);
+    char *_arg;
+    int *_ret;
+    int _size;
+
+public:
+    ffmpeg_execute_job(AVCodecContext *ctx, int (*func)(AVCodecContext *, void *),
+            int (*func2)(AVCodecContext *, void *, int, int), void *arg, int *ret, int size) :
+        _ctx(ctx), _func(func), _func2(func2), _arg(static_cast<char *>(arg)), _ret(ret), _size(size)
     {
-#ifdef HAVE_SYSCONF
-        n = sysconf(_SC_NPROCESSORS_ONLN);
-#else
-        SYSTEM_INFO si;
-        GetSystemInfo(&si);
-        n = si.dwNumberOfProcessors;
-#endif
-        if (n < 1)
+    }
+
+    void run(int index, int slot)
+    {
+        int r = (_func ? _func(_ctx, _arg + index * _size) : _func2(_ctx, _arg, index, slot));
+        if (_ret)
+        {
+            _ret[index] = r;
+        }
+    }
+};
+
+static int ffmpeg_execute(AVCodecContext *ctx, int (*func)(AVCodecContext *, void *),
+        void *arg, int *ret, int count, int size)
+{
+    ffmpeg_execute_job job(ctx, func, NULL, arg, ret, size);
+    parallel_run(job, count, video_decoding_budget());
+    return 0;
+}
+
+static int ffmpeg_execute2(AVCodecContext *ctx, int (*func)(AVCodecContext *, void *, int, int),
+        void *arg, int *ret, int count)
+{
+    ffmpeg_execute_job job(ctx, NULL, func, arg, ret, 0);
+    // func2 uses the slot as its thread number, which must be lower than thread_count.
+    parallel_run(job, count, std::min(video_decoding_budget(), ctx->thread_count));
+    return 0;
+}
+
+// Convert a decoded frame to BGRA in horizontal bands, in parallel.
+class video_conversion_job : public parallel_job
+{
+private:
+    const std::vector<struct SwsContext *> &_ctxs;
+    const std::vector<int> &_bands;
+    int _height;
+    int _log2_chroma_h;
+    const AVFrame *_src;
+    AVFrame *_dst;
+
+public:
+    video_conversion_job(const std::vector<struct SwsContext *> &ctxs, const std::vector<int> &bands,
+            int height, int log2_chroma_h, const AVFrame *src, AVFrame *dst) :
+        _ctxs(ctxs), _bands(bands), _height(height), _log2_chroma_h(log2_chroma_h), _src(src), _dst(dst)
+    {
+    }
+
+    void run(int index, int)
+    {
+        int y0 = _bands[index];
+        int y1 = (index + 1 < static_cast<int>(_bands.size()) ? _bands[index + 1] : _height);
+        const uint8_t *src[4];
+        for (int p = 0; p < 4; p++)
         {
-            n = 1;
+            int y = ((p == 1 || p == 2) ? (y0 >> _log2_chroma_h) : y0);
+            src[p] = (_src->data[p] ? _src->data[p] + y * _src->linesize[p] : NULL);
         }
-        else if (n > 16)
+        uint8_t *dst[4] = { _dst->data[0] + y0 * _dst->linesize[0], NULL, NULL, NULL };
+        sws_scale(_ctxs[index], const_cast<uint8_t **>(src), const_cast<int *>(_src->linesize),
+                0, y1 - y0, dst, _dst->linesize);
+    }
+};
+
+// Set up and release the software conversion of decoded frames to the layout of
+// the video frame template. This is only needed for bgra32 frames.
+static void open_video_conversion(const std::string &url, struct ffmpeg_stuff *ffmpeg, int index)
+{
+    const AVCodecContext *codec_ctx = ffmpeg->video_codec_ctxs[index];
+    int stream = ffmpeg->video_streams[index];
+    const video_frame &t = ffmpeg->video_frame_templates[index];
+    if (t.layout == video_frame::bgra32)
+    {
+        // Initialize things needed for software pixel format conversion (and
+        // scaling, for previews)
+        int bufsize = avpicture_get_size(PIX_FMT_BGRA, t.raw_width, t.raw_height);
+        ffmpeg->video_out_frames[index] = avcodec_alloc_frame();
+        ffmpeg->video_buffers[index] = static_cast<uint8_t *>(av_malloc(bufsize));
+        if (!ffmpeg->video_out_frames[index] || !ffmpeg->video_buffers[index])
         {
-            n = 16;
+            throw exc(HERE + ": " + strerror(ENOMEM));
+        }
+        avpicture_fill(reinterpret_cast<AVPicture *>(ffmpeg->video_out_frames[index]), ffmpeg->video_buffers[index],
+                PIX_FMT_BGRA, t.raw_width, t.raw_height);
+        bool scale = (t.raw_width != codec_ctx->width || t.raw_height != codec_ctx->height);
+        ffmpeg->video_img_conv_ctxs[index] = sws_getContext(
+                codec_ctx->width, codec_ctx->height, codec_ctx->pix_fmt,
+                t.raw_width, t.raw_height, PIX_FMT_BGRA,
+                scale ? SWS_FAST_BILINEAR : SWS_POINT, NULL, NULL, NULL);
+        if (!ffmpeg->video_img_conv_ctxs[index])
+        {
+            throw exc(url + " stream " + str::from(stream) + ": Cannot initialize conversion context.");
+        }
+        // Without scaling, each row is converted independently, so the frame can
+        // be converted in bands in parallel. Band boundaries are multiples of 16
+        // rows, which keeps them aligned to the chroma subsampling.
+        const AVPixFmtDescriptor &desc = av_pix_fmt_descriptors[codec_ctx->pix_fmt];
+        int bands = std::min(task::workers(), codec_ctx->height / 64);
+        if (!scale && !(desc.flags & (PIX_FMT_PAL | PIX_FMT_BITSTREAM)) && bands > 1)
+        {
+            for (int i = 0; i < bands; i++)
+            {
+                int y0 = (codec_ctx->height * i / bands) / 16 * 16;
+                int y1 = (codec_ctx->height * (i + 1) / bands) / 16 * 16;
+                if (i == bands - 1)
+                {
+                    y1 = codec_ctx->height;
+                }
+                struct SwsContext *ctx = sws_getContext(
+                        codec_ctx->width, y1 - y0, codec_ctx->pix_fmt,
+                        codec_ctx->width, y1 - y0, PIX_FMT_BGRA,
+                        SWS_POINT, NULL, NULL, NULL);
+                if (!ctx)
+                {
+                    throw exc(url + " stream " + str::from(stream) + ": Cannot initialize conversion context.");
+                }
+                ffmpeg->video_img_conv_band_ctxs[index].push_back(ctx);
+                ffmpeg->video_img_conv_bands[index].push_back(y0);
+            }
         }
     }
-    return n;
+}
+
+static void close_video_conversion(struct ffmpeg_stuff *ffmpeg, int index)
+{
+    sws_freeContext(ffmpeg->video_img_conv_ctxs[index]);
+    ffmpeg->video_img_conv_ctxs[index] = NULL;
+    for (size_t i = 0; i < ffmpeg->video_img_conv_band_ctxs[index].size(); i++)
+    {
+        sws_freeContext(ffmpeg->video_img_conv_band_ctxs[index][i]);
+    }
+    ffmpeg->video_img_conv_band_ctxs[index].clear();
+    ffmpeg->video_img_conv_bands[index].clear();
+    av_free(ffmpeg->video_buffers[index]);
+    ffmpeg->video_buffers[index] = NULL;
+    av_free(ffmpeg->video_out_frames[index]);
+    ffmpeg->video_out_frames[index] = NULL;
 }
 
 // Return FFmpeg error as std::string.
@@ -280,6 +457,37 @@ static void my_av_log(void *ptr, int level, const char *fmt, va_list vl)
     line_mutex.unlock();
 }
 
+// Let FFmpeg protect its non-thread-safe functions (e.g. avcodec_open) with our
+// mutexes, so that media objects can be opened from different threads.
+static int my_av_lockmgr(void **m, enum AVLockOp op)
+{
+    mutex **mtx = reinterpret_cast<mutex **>(m);
+    try
+    {
+        switch (op)
+        {
+        case AV_LOCK_CREATE:
+            *mtx = new mutex;
+            break;
+        case AV_LOCK_OBTAIN:
+            (*mtx)->lock();
+            break;
+        case AV_LOCK_RELEASE:
+            (*mtx)->unlock();
+            break;
+        case AV_LOCK_DESTROY:
+            delete *mtx;
+            *mtx = NULL;
+            break;
+        }
+    }
+    catch (...)
+    {
+        return 1;
+    }
+    return 0;
+}
+
 // Handle timestamps
 static int64_t timestamp_helper(int64_t &last_timestamp, int64_t timestamp)
 {
@@ -309,9 +517,423 @@ static int64_t stream_duration(AVStream *stream, AVFormatContext *format)
     }
 }
 
+/* The stream information that av_find_stream_info() determines, as stored in
+ * the probe cache. The video frame and audio blob templates are derived from
+ * these values, so they are not stored separately. */
+class probe_info : public s11n
+{
+public:
+    class stream : public s11n
+    {
+    public:
+        int codec_type, codec_id;
+        int64_t start_time, duration;
+        int r_frame_rate_num, r_frame_rate_den;
+        int sample_aspect_ratio_num, sample_aspect_ratio_den;
+        int codec_time_base_num, codec_time_base_den;
+        int codec_sample_aspect_ratio_num, codec_sample_aspect_ratio_den;
+        int width, height, pix_fmt, has_b_frames;
+        int colorspace, color_range, chroma_sample_location;
+        int channels, sample_rate, sample_fmt, block_align, frame_size;
+        int bit_rate;
+
+        void save(std::ostream &os) const
+        {
+            s11n::save(os, codec_type);
+            s11n::save(os, codec_id);
+            s11n::save(os, start_time);
+            s11n::save(os, duration);
+            s11n::save(os, r_frame_rate_num);
+            s11n::save(os, r_frame_rate_den);
+            s11n::save(os, sample_aspect_ratio_num);
+            s11n::save(os, sample_aspect_ratio_den);
+            s11n::save(os, codec_time_base_num);
+            s11n::save(os, codec_time_base_den);
+            s11n::save(os, codec_sample_aspect_ratio_num);
+            s11n::save(os, codec_sample_aspect_ratio_den);
+            s11n::save(os, width);
+            s11n::save(os, height);
+            s11n::save(os, pix_fmt);
+            s11n::save(os, has_b_frames);
+            s11n::save(os, colorspace);
+            s11n::save(os, color_range);
+            s11n::save(os, chroma_sample_location);
+            s11n::save(os, channels);
+            s11n::save(os, sample_rate);
+            s11n::save(os, sample_fmt);
+            s11n::save(os, block_align);
+            s11n::save(os, frame_size);
+            s11n::save(os, bit_rate);
+        }
+
+        void load(std::istream &is)
+        {
+            s11n::load(is, codec_type);
+            s11n::load(is, codec_id);
+            s11n::load(is, start_time);
+            s11n::load(is, duration);
+            s11n::load(is, r_frame_rate_num);
+            s11n::load(is, r_frame_rate_den);
+            s11n::load(is, sample_aspect_ratio_num);
+            s11n::load(is, sample_aspect_ratio_den);
+            s11n::load(is, codec_time_base_num);
+            s11n::load(is, codec_time_base_den);
+            s11n::load(is, codec_sample_aspect_ratio_num);
+            s11n::load(is, codec_sample_aspect_ratio_den);
+            s11n::load(is, width);
+            s11n::load(is, height);
+            s11n::load(is, pix_fmt);
+            s11n::load(is, has_b_frames);
+            s11n::load(is, colorspace);
+            s11n::load(is, color_range);
+            s11n::load(is, chroma_sample_location);
+            s11n::load(is, channels);
+            s11n::load(is, sample_rate);
+            s11n::load(is, sample_fmt);
+            s11n::load(is, block_align);
+            s11n::load(is, frame_size);
+            s11n::load(is, bit_rate);
+        }
+    };
+
+    int64_t start_time, duration;
+    int bit_rate;
+    std::vector<stream> streams;
+
+    void save(std::ostream &os) const
+    {
+        s11n::save(os, start_time);
+        s11n::save(os, duration);
+        s11n::save(os, bit_rate);
+        s11n::save(os, static_cast<int>(streams.size()));
+        for (size_t i = 0; i < streams.size(); i++)
+        {
+            s11n::save(os, streams[i]);
+        }
+    }
+
+    void load(std::istream &is)
+    {
+        int n;
+        s11n::load(is, start_time);
+        s11n::load(is, duration);
+        s11n::load(is, bit_rate);
+        s11n::load(is, n);
+        // Do not trust the stream count: the entry might be damaged
+        streams.clear();
+        for (int i = 0; i < n && i < 1024 && is.good(); i++)
+        {
+            streams.push_back(stream());
+            s11n::load(is, streams.back());
+        }
+        if (!is.good() || static_cast<int>(streams.size()) != n)
+        {
+            streams.clear();
+            is.setstate(std::ios::failbit);
+        }
+    }
+};
+
+// Identify the FFmpeg versions that produced probe cache entries
+static std::string probe_cache_version()
+{
+    return str::asprintf("1 lavf %u lavc %u", LIBAVFORMAT_VERSION_INT, LIBAVCODEC_VERSION_INT);
+}
+
+// Extract the stream information that should go into the probe cache
+static void get_probe_info(const AVFormatContext *format_ctx, probe_info &info)
+{
+    info.start_time = format_ctx->start_time;
+    info.duration = format_ctx->duration;
+    info.bit_rate = format_ctx->bit_rate;
+    info.streams.resize(format_ctx->nb_streams);
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    {
+        const AVStream *st = format_ctx->streams[i];
+        const AVCodecContext *c = st->codec;
+        probe_info::stream &s = info.streams[i];
+        s.codec_type = c->codec_type;
+        s.codec_id = c->codec_id;
+        s.start_time = st->start_time;
+        s.duration = st->duration;
+        s.r_frame_rate_num = st->r_frame_rate.num;
+        s.r_frame_rate_den = st->r_frame_rate.den;
+        s.sample_aspect_ratio_num = st->sample_aspect_ratio.num;
+        s.sample_aspect_ratio_den = st->sample_aspect_ratio.den;
+        s.codec_time_base_num = c->time_base.num;
+        s.codec_time_base_den = c->time_base.den;
+        s.codec_sample_aspect_ratio_num = c->sample_aspect_ratio.num;
+        s.codec_sample_aspect_ratio_den = c->sample_aspect_ratio.den;
+        s.width = c->width;
+        s.height = c->height;
+        s.pix_fmt = c->pix_fmt;
+        s.has_b_frames = c->has_b_frames;
+        s.colorspace = c->colorspace;
+        s.color_range = c->color_range;
+        s.chroma_sample_location = c->chroma_sample_location;
+        s.channels = c->channels;
+        s.sample_rate = c->sample_rate;
+        s.sample_fmt = c->sample_fmt;
+        s.block_align = c->block_align;
+        s.frame_size = c->frame_size;
+        s.bit_rate = c->bit_rate;
+    }
+}
+
+// Fill in the stream information from the probe cache, but only if it fits
+// to what av_open_input_file() found. Returns false if it does not fit.
+static bool apply_probe_info(AVFormatContext *format_ctx, const probe_info &info)
+{
+    if (info.streams.size() != format_ctx->nb_streams)
+    {
+        return false;
+    }
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    {
+        const AVCodecContext *c = format_ctx->streams[i]->codec;
+        const probe_info::stream &s = info.streams[i];
+        if (c->codec_type != s.codec_type || c->codec_id != s.codec_id
+                || (c->width > 0 && c->width != s.width)
+                || (c->height > 0 && c->height != s.height)
+                || (c->channels > 0 && c->channels != s.channels)
+                || (c->sample_rate > 0 && c->sample_rate != s.sample_rate))
+        {
+            return false;
+        }
+    }
+    format_ctx->start_time = info.start_time;
+    format_ctx->duration = info.duration;
+    format_ctx->bit_rate = info.bit_rate;
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    {
+        AVStream *st = format_ctx->streams[i];
+        AVCodecContext *c = st->codec;
+        const probe_info::stream &s = info.streams[i];
+        st->start_time = s.start_time;
+        st->duration = s.duration;
+        st->r_frame_rate.num = s.r_frame_rate_num;
+        st->r_frame_rate.den = s.r_frame_rate_den;
+        st->sample_aspect_ratio.num = s.sample_aspect_ratio_num;
+        st->sample_aspect_ratio.den = s.sample_aspect_ratio_den;
+        c->time_base.num = s.codec_time_base_num;
+        c->time_base.den = s.codec_time_base_den;
+        c->sample_aspect_ratio.num = s.codec_sample_aspect_ratio_num;
+        c->sample_aspect_ratio.den = s.codec_sample_aspect_ratio_den;
+        c->width = s.width;
+        c->height = s.height;
+        c->pix_fmt = static_cast<enum PixelFormat>(s.pix_fmt);
+        c->has_b_frames = s.has_b_frames;
+        c->colorspace = static_cast<enum AVColorSpace>(s.colorspace);
+        c->color_range = static_cast<enum AVColorRange>(s.color_range);
+        c->chroma_sample_location = static_cast<enum AVChromaLocation>(s.chroma_sample_location);
+        c->channels = s.channels;
+        c->sample_rate = s.sample_rate;
+        c->sample_fmt = static_cast<enum SampleFormat>(s.sample_fmt);
+        c->block_align = s.block_align;
+        c->frame_size = s.frame_size;
+        c->bit_rate = s.bit_rate;
+    }
+    return true;
+}
+
+/* The stream description of a media object, from which a remote media object
+ * can be opened: the probed stream information plus everything else that the
+ * decoders and the frame templates need. */
+class remote_info : public s11n
+{
+public:
+    probe_info probe;
+    std::vector<int> time_base_nums, time_base_dens;
+    std::vector<std::string> extradata;
+    std::vector<std::string> tag_names, tag_values;
+
+    void save(std::ostream &os) const
+    {
+        s11n::save(os, probe);
+        s11n::save(os, time_base_nums);
+        s11n::save(os, time_base_dens);
+        s11n::save(os, extradata);
+        s11n::save(os, tag_names);
+        s11n::save(os, tag_values);
+    }
+
+    void load(std::istream &is)
+    {
+        s11n::load(is, probe);
+        s11n::load(is, time_base_nums);
+        s11n::load(is, time_base_dens);
+        s11n::load(is, extradata);
+        s11n::load(is, tag_names);
+        s11n::load(is, tag_values);
+        if (time_base_nums.size() != probe.streams.size()
+                || time_base_dens.size() != probe.streams.size()
+                || extradata.size() != probe.streams.size()
+                || tag_names.size() != tag_values.size())
+        {
+            is.setstate(std::ios::failbit);
+        }
+    }
+};
+
+// Free a format context that was created by create_remote_format_ctx()
+static void destroy_remote_format_ctx(AVFormatContext *format_ctx)
+{
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    {
+        AVStream *st = format_ctx->streams[i];
+        av_free(st->codec->extradata);
+        av_free(st->codec);
+        av_metadata_free(&st->metadata);
+        av_free(st);
+    }
+    av_metadata_free(&format_ctx->metadata);
+    av_free(format_ctx);
+}
+
+// Create a format context that has the described streams, but no input
+static AVFormatContext *create_remote_format_ctx(const remote_info &info)
+{
+    AVFormatContext *format_ctx = avformat_alloc_context();
+    if (!format_ctx)
+    {
+        return NULL;
+    }
+    for (size_t i = 0; i < info.probe.streams.size(); i++)
+    {
+        AVStream *st = av_new_stream(format_ctx, i);
+        if (!st)
+        {
+            destroy_remote_format_ctx(format_ctx);
+            return NULL;
+        }
+        st->codec->codec_type = static_cast<enum CodecType>(info.probe.streams[i].codec_type);
+        st->codec->codec_id = static_cast<enum CodecID>(info.probe.streams[i].codec_id);
+        st->time_base.num = info.time_base_nums[i];
+        st->time_base.den = info.time_base_dens[i];
+        if (!info.extradata[i].empty())
+        {
+            size_t size = info.extradata[i].size();
+            st->codec->extradata = static_cast<uint8_t *>(av_mallocz(size + FF_INPUT_BUFFER_PADDING_SIZE));
+            if (!st->codec->extradata)
+            {
+                destroy_remote_format_ctx(format_ctx);
+                return NULL;
+            }
+            std::memcpy(st->codec->extradata, info.extradata[i].data(), size);
+            st->codec->extradata_size = size;
+        }
+    }
+    (void)apply_probe_info(format_ctx, info.probe);
+    return format_ctx;
+}
+
+// Exported packets are stored as a sequence of records
+static const int packet_record_packet = 0;     // a packet of a video stream
+static const int packet_record_seek = 1;       // the exporting media object was seeked
+static const int packet_record_eof = 2;        // the exporting media object reached EOF
+
+static void save_packet_record(std::string &records, int record)
+{
+    std::ostringstream oss;
+    s11n::save(oss, record);
+    records += oss.str();
+}
+
+static void save_packet_record(std::string &records, int video_stream, const AVPacket &packet)
+{
+    std::ostringstream oss;
+    s11n::save(oss, packet_record_packet);
+    s11n::save(oss, video_stream);
+    s11n::save(oss, static_cast<int64_t>(packet.pts));
+    s11n::save(oss, static_cast<int64_t>(packet.dts));
+    s11n::save(oss, packet.flags);
+    s11n::save(oss, packet.duration);
+    s11n::save(oss, packet.size);
+    s11n::save(oss, packet.data, packet.size);
+    records += oss.str();
+}
+
+// Wake the video decoders of a remote media object that wait for imported
+// packets, e.g. because EOF was reached.
+static void wake_video_decoders(struct ffmpeg_stuff *ffmpeg)
+{
+    for (size_t i = 0; i < ffmpeg->video_streams.size(); i++)
+    {
+        ffmpeg->video_packet_queue_mutexes[i].lock();
+        ffmpeg->video_packet_queue_conds[i].wake_all();
+        ffmpeg->video_packet_queue_mutexes[i].unlock();
+    }
+}
+
+// Put imported packets into the queues of their video streams. The records
+// that follow a seek are kept back until this media object is seeked, too.
+static void load_packet_records(struct ffmpeg_stuff *ffmpeg, const std::string &url, const std::string &records)
+{
+    std::istringstream iss(records);
+    while (iss.peek() != std::char_traits<char>::eof())
+    {
+        int record;
+        s11n::load(iss, record);
+        if (record == packet_record_seek)
+        {
+            ffmpeg->imported_packets += records.substr(static_cast<size_t>(iss.tellg()));
+            return;
+        }
+        else if (record == packet_record_eof)
+        {
+            ffmpeg->reader->set_eof();
+            wake_video_decoders(ffmpeg);
+        }
+        else
+        {
+            int video_stream;
+            int64_t pts, dts;
+            int flags, duration, size;
+            s11n::load(iss, video_stream);
+            s11n::load(iss, pts);
+            s11n::load(iss, dts);
+            s11n::load(iss, flags);
+            s11n::load(iss, duration);
+            s11n::load(iss, size);
+            AVPacket packet;
+            if (!iss.good() || record != packet_record_packet
+                    || video_stream < 0 || video_stream >= static_cast<int>(ffmpeg->video_streams.size())
+                    || size < 0 || av_new_packet(&packet, size) < 0)
+            {
+                throw exc(url + ": Invalid imported packet.");
+            }
+            s11n::load(iss, packet.data, size);
+            packet.stream_index = ffmpeg->video_streams[video_stream];
+            packet.pts = pts;
+            packet.dts = dts;
+            packet.flags = flags;
+            packet.duration = duration;
+            ffmpeg->video_packet_queue_mutexes[video_stream].lock();
+            if (ffmpeg->format_ctx->streams[packet.stream_index]->discard != AVDISCARD_ALL)
+            {
+                ffmpeg->video_packet_queues[video_stream].push_back(packet);
+                ffmpeg->video_packet_queue_conds[video_stream].wake_all();
+            }
+            else
+            {
+                av_free_packet(&packet);
+            }
+            ffmpeg->video_packet_queue_mutexes[video_stream].unlock();
+        }
+    }
+}
+
 
 media_object::media_object() : _ffmpeg(NULL)
 {
+    static mutex init_mutex;
+    static bool lockmgr_registered = false;
+    init_mutex.lock();
+    if (!lockmgr_registered)
+    {
+        lockmgr_registered = (av_lockmgr_register(my_av_lockmgr) == 0);
+    }
+    init_mutex.unlock();
     av_register_all();
     switch (msg::level())
     {
@@ -620,30 +1242,129 @@ void media_object::set_subtitle_box_template(int index)
 }
 
 void media_object::open(const std::string &url)
+{
+    bool probe_cache_used = false;
+    try
+    {
+        open(url, NULL, true, &probe_cache_used);
+    }
+    catch (std::exception &e)
+    {
+        if (!probe_cache_used)
+        {
+            throw;
+        }
+        // The cached stream information might be wrong. Probe again.
+        msg::dbg(url + ": Opening with cached stream information failed: " + e.what());
+        close();
+        probe_cache::remove(url);
+        open(url, NULL, false, &probe_cache_used);
+    }
+}
+
+void media_object::open_remote(const std::string &url, const std::string &stream_description)
+{
+    bool probe_cache_used;
+    open(url, &stream_description, false, &probe_cache_used);
+}
+
+std::string media_object::stream_description() const
+{
+    remote_info info;
+    get_probe_info(_ffmpeg->format_ctx, info.probe);
+    for (unsigned int i = 0; i < _ffmpeg->format_ctx->nb_streams; i++)
+    {
+        const AVStream *st = _ffmpeg->format_ctx->streams[i];
+        info.time_base_nums.push_back(st->time_base.num);
+        info.time_base_dens.push_back(st->time_base.den);
+        info.extradata.push_back(st->codec->extradata
+                ? std::string(reinterpret_cast<const char *>(st->codec->extradata), st->codec->extradata_size)
+                : std::string());
+    }
+    info.tag_names = _tag_names;
+    info.tag_values = _tag_values;
+    std::ostringstream oss;
+    info.save(oss);
+    return oss.str();
+}
+
+void media_object::open(const std::string &url, const std::string *stream_description,
+        bool use_probe_cache, bool *probe_cache_used)
 {
     assert(!_ffmpeg);
 
     _url = url;
+    _tag_names.clear();
+    _tag_values.clear();
     _ffmpeg = new struct ffmpeg_stuff;
+    _ffmpeg->format_ctx = NULL;
     _ffmpeg->reader = new read_thread(_url, _ffmpeg);
+    _ffmpeg->remote = (stream_description != NULL);
+    _ffmpeg->packet_export = false;
+    _ffmpeg->stop_request = NULL;
+    *probe_cache_used = false;
+    _ffmpeg->probe_cache_used = false;
     int e;
 
-    if ((e = av_open_input_file(&_ffmpeg->format_ctx, _url.c_str(), NULL, 0, NULL)) != 0)
+    if (_ffmpeg->remote)
     {
-        throw exc(_url + ": " + my_av_strerror(e));
+        std::istringstream iss(*stream_description);
+        remote_info info;
+        info.load(iss);
+        if (!iss.good())
+        {
+            throw exc(_url + ": Invalid stream description.");
+        }
+        _ffmpeg->format_ctx = create_remote_format_ctx(info);
+        if (!_ffmpeg->format_ctx)
+        {
+            throw exc(_url + ": Cannot create streams from description.");
+        }
+        _tag_names = info.tag_names;
+        _tag_values = info.tag_values;
     }
-    if ((e = av_find_stream_info(_ffmpeg->format_ctx)) < 0)
+    else
     {
-        throw exc(_url + ": Cannot read stream info: " + my_av_strerror(e));
-    }
-    dump_format(_ffmpeg->format_ctx, 0, _url.c_str(), 0);
+        if ((e = av_open_input_file(&_ffmpeg->format_ctx, _url.c_str(), NULL, 0, NULL)) != 0)
+        {
+            throw exc(_url + ": " + my_av_strerror(e));
+        }
+        // Probing the stream information can take a long time. Use the results of
+        // an earlier probe of the same file if possible.
+        std::string cached_info;
+        if (use_probe_cache && probe_cache::get(_url, probe_cache_version(), cached_info))
+        {
+            std::istringstream iss(cached_info);
+            probe_info info;
+            info.load(iss);
+            *probe_cache_used = (iss.good() && apply_probe_info(_ffmpeg->format_ctx, info));
+            if (!*probe_cache_used)
+            {
+                msg::dbg(_url + ": Cached stream information does not match.");
+            }
+        }
+        _ffmpeg->probe_cache_used = *probe_cache_used;
+        if (!*probe_cache_used)
+        {
+            if ((e = av_find_stream_info(_ffmpeg->format_ctx)) < 0)
+            {
+                throw exc(_url + ": Cannot read stream info: " + my_av_strerror(e));
+            }
+            std::ostringstream oss;
+            probe_info info;
+            get_probe_info(_ffmpeg->format_ctx, info);
+            info.save(oss);
+            probe_cache::put(_url, probe_cache_version(), oss.str());
+        }
+        dump_format(_ffmpeg->format_ctx, 0, _url.c_str(), 0);
 
-    /* Metadata */
-    AVMetadataTag *tag = NULL;
-    while ((tag = av_metadata_get(_ffmpeg->format_ctx->metadata, "", tag, AV_METADATA_IGNORE_SUFFIX)))
-    {
-        _tag_names.push_back(tag->key);
-        _tag_values.push_back(tag->value);
+        /* Metadata */
+        AVMetadataTag *tag = NULL;
+        while ((tag = av_metadata_get(_ffmpeg->format_ctx->metadata, "", tag, AV_METADATA_IGNORE_SUFFIX)))
+        {
+            _tag_names.push_back(tag->key);
+            _tag_values.push_back(tag->value);
+        }
     }
 
     _ffmpeg->have_active_audio_stream = false;
@@ -659,66 +1380,39 @@ void media_object::open(const std::string &url)
             int j = _ffmpeg->video_streams.size() - 1;
             msg::dbg(_url + " stream " + str::from(i) + " is video stream " + str::from(j) + ".");
             _ffmpeg->video_codec_ctxs.push_back(_ffmpeg->format_ctx->streams[i]->codec);
+            // The decoder and its buffers are set up when the stream is activated
+            _ffmpeg->video_codecs.push_back(NULL);
+            _ffmpeg->video_frames.push_back(NULL);
+            _ffmpeg->video_out_frames.push_back(NULL);
+            _ffmpeg->video_buffers.push_back(NULL);
+            _ffmpeg->video_img_conv_ctxs.push_back(NULL);
+            _ffmpeg->video_img_conv_band_ctxs.push_back(std::vector<struct SwsContext *>());
+            _ffmpeg->video_img_conv_bands.push_back(std::vector<int>());
             if (_ffmpeg->video_codec_ctxs[j]->width < 1 || _ffmpeg->video_codec_ctxs[j]->height < 1)
             {
                 throw exc(_url + " stream " + str::from(i) + ": Invalid frame size.");
             }
-            _ffmpeg->video_codec_ctxs[j]->thread_count = video_decoding_threads();
-            if (avcodec_thread_init(_ffmpeg->video_codec_ctxs[j], _ffmpeg->video_codec_ctxs[j]->thread_count) != 0)
-            {
-                _ffmpeg->video_codec_ctxs[j]->thread_count = 1;
-            }
-            _ffmpeg->video_codecs.push_back(avcodec_find_decoder(_ffmpeg->video_codec_ctxs[j]->codec_id));
+            // The decoder may split its work into one job per pool worker; how many
+            // of these jobs run concurrently depends on the number of active streams.
+            _ffmpeg->video_codec_ctxs[j]->thread_count = task::workers();
+#ifdef FF_THREAD_SLICE
+            // Frame threading would decode in threads of FFmpeg's own; only the
+            // jobs of slice threading can be run on the task pool.
+            _ffmpeg->video_codec_ctxs[j]->thread_type = FF_THREAD_SLICE;
+#endif
+            _ffmpeg->video_codecs[j] = avcodec_find_decoder(_ffmpeg->video_codec_ctxs[j]->codec_id);
             if (!_ffmpeg->video_codecs[j])
             {
                 throw exc(_url + " stream " + str::from(i) + ": Unsupported video codec.");
             }
-            if ((e = avcodec_open(_ffmpeg->video_codec_ctxs[j], _ffmpeg->video_codecs[j])) < 0)
-            {
-                _ffmpeg->video_codecs[j] = NULL;
-                throw exc(_url + " stream " + str::from(i) + ": Cannot open video codec: " + my_av_strerror(e));
-            }
             // Determine frame template.
             _ffmpeg->video_frame_templates.push_back(video_frame());
             set_video_frame_template(j);
-            // Allocate things required for decoding
             _ffmpeg->video_packets.push_back(AVPacket());
             av_init_packet(&(_ffmpeg->video_packets[j]));
-            _ffmpeg->video_decode_threads.push_back(video_decode_thread(_url, _ffmpeg, j));
-            _ffmpeg->video_frames.push_back(avcodec_alloc_frame());
-            if (!_ffmpeg->video_frames[j])
-            {
-                throw exc(HERE + ": " + strerror(ENOMEM));
-            }
-            if (_ffmpeg->video_frame_templates[j].layout == video_frame::bgra32)
-            {
-                // Initialize things needed for software pixel format conversion
-                int bufsize = avpicture_get_size(PIX_FMT_BGRA,
-                        _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height);
-                _ffmpeg->video_out_frames.push_back(avcodec_alloc_frame());
-                _ffmpeg->video_buffers.push_back(static_cast<uint8_t *>(av_malloc(bufsize)));
-                if (!_ffmpeg->video_out_frames[j] || !_ffmpeg->video_buffers[j])
-                {
-                    throw exc(HERE + ": " + strerror(ENOMEM));
-                }
-                avpicture_fill(reinterpret_cast<AVPicture *>(_ffmpeg->video_out_frames[j]), _ffmpeg->video_buffers[j],
-                        PIX_FMT_BGRA, _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height);
-                _ffmpeg->video_img_conv_ctxs.push_back(sws_getContext(
-                            _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height, _ffmpeg->video_codec_ctxs[j]->pix_fmt,
-                            _ffmpeg->video_codec_ctxs[j]->width, _ffmpeg->video_codec_ctxs[j]->height, PIX_FMT_BGRA,
-                            SWS_POINT, NULL, NULL, NULL));
-                if (!_ffmpeg->video_img_conv_ctxs[j])
-                {
-                    throw exc(_url + " stream " + str::from(i) + ": Cannot initialize conversion context.");
-                }
-            }
-            else
-            {
-                _ffmpeg->video_out_frames.push_back(NULL);
-                _ffmpeg->video_buffers.push_back(NULL);
-                _ffmpeg->video_img_conv_ctxs.push_back(NULL);
-            }
+            _ffmpeg->video_decode_tasks.push_back(video_decode_task(_url, _ffmpeg, j));
             _ffmpeg->video_last_timestamps.push_back(std::numeric_limits<int64_t>::min());
+            _ffmpeg->video_previews.push_back(false);
         }
         else if (_ffmpeg->format_ctx->streams[i]->codec->codec_type == CODEC_TYPE_AUDIO)
         {
@@ -726,26 +1420,17 @@ void media_object::open(const std::string &url)
             int j = _ffmpeg->audio_streams.size() - 1;
             msg::dbg(_url + " stream " + str::from(i) + " is audio stream " + str::from(j) + ".");
             _ffmpeg->audio_codec_ctxs.push_back(_ffmpeg->format_ctx->streams[i]->codec);
-            _ffmpeg->audio_codecs.push_back(avcodec_find_decoder(_ffmpeg->audio_codec_ctxs[j]->codec_id));
+            // The decoder and its buffers are set up when the stream is activated
+            _ffmpeg->audio_codecs.push_back(NULL);
+            _ffmpeg->audio_tmpbufs.push_back(NULL);
+            _ffmpeg->audio_codecs[j] = avcodec_find_decoder(_ffmpeg->audio_codec_ctxs[j]->codec_id);
             if (!_ffmpeg->audio_codecs[j])
             {
                 throw exc(_url + " stream " + str::from(i) + ": Unsupported audio codec.");
             }
-            if ((e = avcodec_open(_ffmpeg->audio_codec_ctxs[j], _ffmpeg->audio_codecs[j])) < 0)
-            {
-                _ffmpeg->audio_codecs[j] = NULL;
-                throw exc(_url + " stream " + str::from(i) + ": Cannot open audio codec: " + my_av_strerror(e));
-            }
             _ffmpeg->audio_blob_templates.push_back(audio_blob());
             set_audio_blob_template(j);
             _ffmpeg->audio_decode_threads.push_back(audio_decode_thread(_url, _ffmpeg, j));
-            // Manage audio_tmpbufs with av_malloc/av_free, to guarantee correct alignment.
-            // Not doing this results in hard to debug crashes on some systems.
-            _ffmpeg->audio_tmpbufs.push_back(static_cast<unsigned char*>(av_malloc(audio_tmpbuf_size)));
-            if (!_ffmpeg->audio_tmpbufs[j])
-            {
-                throw exc(HERE + ": " + strerror(ENOMEM));
-            }
             _ffmpeg->audio_blobs.push_back(blob());
             _ffmpeg->audio_buffers.push_back(std::vector<unsigned char>());
             _ffmpeg->audio_last_timestamps.push_back(std::numeric_limits<int64_t>::min());
@@ -756,19 +1441,15 @@ void media_object::open(const std::string &url)
             int j = _ffmpeg->subtitle_streams.size() - 1;
             msg::dbg(_url + " stream " + str::from(i) + " is subtitle stream " + str::from(j) + ".");
             _ffmpeg->subtitle_codec_ctxs.push_back(_ffmpeg->format_ctx->streams[i]->codec);
+            // The decoder is set up when the stream is activated
             _ffmpeg->subtitle_codecs.push_back(avcodec_find_decoder(_ffmpeg->subtitle_codec_ctxs[j]->codec_id));
             if (!_ffmpeg->subtitle_codecs[j])
             {
                 throw exc(_url + " stream " + str::from(i) + ": Unsupported subtitle codec.");
             }
-            if ((e = avcodec_open(_ffmpeg->subtitle_codec_ctxs[j], _ffmpeg->subtitle_codecs[j])) < 0)
-            {
-                _ffmpeg->subtitle_codecs[j] = NULL;
-                throw exc(_url + " stream " + str::from(i) + ": Cannot open subtitle codec: " + my_av_strerror(e));
-            }
             _ffmpeg->subtitle_box_templates.push_back(subtitle_box());
             set_subtitle_box_template(j);
-            _ffmpeg->subtitle_decode_threads.push_back(subtitle_decode_thread(_url, _ffmpeg, j));
+            _ffmpeg->subtitle_decode_tasks.push_back(subtitle_decode_task(_url, _ffmpeg, j));
             _ffmpeg->subtitle_box_buffers.push_back(std::deque<subtitle_box>());
             _ffmpeg->subtitle_last_timestamps.push_back(std::numeric_limits<int64_t>::min());
         }
@@ -781,6 +1462,7 @@ void media_object::open(const std::string &url)
     _ffmpeg->audio_packet_queues.resize(audio_streams());
     _ffmpeg->subtitle_packet_queues.resize(subtitle_streams());
     _ffmpeg->video_packet_queue_mutexes.resize(video_streams());
+    _ffmpeg->video_packet_queue_conds.resize(video_streams());
     _ffmpeg->audio_packet_queue_mutexes.resize(audio_streams());
     _ffmpeg->subtitle_packet_queue_mutexes.resize(subtitle_streams());
 
@@ -864,91 +1546,328 @@ int media_object::subtitle_streams() const
     return _ffmpeg->subtitle_streams.size();
 }
 
+void media_object::open_video_decoder(int index)
+{
+    AVCodecContext *codec_ctx = _ffmpeg->video_codec_ctxs[index];
+    if (codec_ctx->codec)
+    {
+        return;
+    }
+    int e;
+    int stream = _ffmpeg->video_streams[index];
+    // Run the slice threading jobs on the shared task pool instead of the
+    // decoder's own threads. The decoder supports replacing these functions.
+    if (codec_ctx->thread_count > 1)
+    {
+        codec_ctx->execute = ffmpeg_execute;
+        codec_ctx->execute2 = ffmpeg_execute2;
+    }
+    if ((e = avcodec_open(codec_ctx, _ffmpeg->video_codecs[index])) < 0)
+    {
+        if (_ffmpeg->probe_cache_used)
+        {
+            probe_cache::remove(_url);
+        }
+        throw exc(_url + " stream " + str::from(stream) + ": Cannot open video codec: " + my_av_strerror(e));
+    }
+    if (!_ffmpeg->video_previews[index])
+    {
+        atomic::add_and_fetch(&active_video_decoders, 1);
+    }
+    if (codec_ctx->thread_count > 1)
+    {
+        // Versions of libavcodec with frame threading set up their own slice
+        // threads on opening and install their execute functions. Those threads
+        // then stay idle.
+        codec_ctx->execute = ffmpeg_execute;
+        codec_ctx->execute2 = ffmpeg_execute2;
+    }
+    _ffmpeg->video_frames[index] = avcodec_alloc_frame();
+    if (!_ffmpeg->video_frames[index])
+    {
+        throw exc(HERE + ": " + strerror(ENOMEM));
+    }
+    open_video_conversion(_url, _ffmpeg, index);
+}
+
+void media_object::close_video_decoder(int index)
+{
+    close_video_conversion(_ffmpeg, index);
+    av_free(_ffmpeg->video_frames[index]);
+    _ffmpeg->video_frames[index] = NULL;
+    if (_ffmpeg->video_codec_ctxs[index]->codec)
+    {
+        avcodec_close(_ffmpeg->video_codec_ctxs[index]);
+        if (!_ffmpeg->video_previews[index])
+        {
+            atomic::sub_and_fetch(&active_video_decoders, 1);
+        }
+    }
+}
+
+void media_object::open_audio_decoder(int index)
+{
+    AVCodecContext *codec_ctx = _ffmpeg->audio_codec_ctxs[index];
+    if (codec_ctx->codec)
+    {
+        return;
+    }
+    int e;
+    if ((e = avcodec_open(codec_ctx, _ffmpeg->audio_codecs[index])) < 0)
+    {
+        if (_ffmpeg->probe_cache_used)
+        {
+            probe_cache::remove(_url);
+        }
+        throw exc(_url + " stream " + str::from(_ffmpeg->audio_streams[index])
+                + ": Cannot open audio codec: " + my_av_strerror(e));
+    }
+    // Manage audio_tmpbufs with av_malloc/av_free, to guarantee correct alignment.
+    // Not doing this results in hard to debug crashes on some systems.
+    _ffmpeg->audio_tmpbufs[index] = static_cast<unsigned char*>(av_malloc(audio_tmpbuf_size));
+    if (!_ffmpeg->audio_tmpbufs[index])
+    {
+        throw exc(HERE + ": " + strerror(ENOMEM));
+    }
+}
+
+void media_object::close_audio_decoder(int index)
+{
+    av_free(_ffmpeg->audio_tmpbufs[index]);
+    _ffmpeg->audio_tmpbufs[index] = NULL;
+    if (_ffmpeg->audio_codec_ctxs[index]->codec)
+    {
+        avcodec_close(_ffmpeg->audio_codec_ctxs[index]);
+    }
+}
+
+void media_object::open_subtitle_decoder(int index)
+{
+    AVCodecContext *codec_ctx = _ffmpeg->subtitle_codec_ctxs[index];
+    if (codec_ctx->codec)
+    {
+        return;
+    }
+    int e;
+    if ((e = avcodec_open(codec_ctx, _ffmpeg->subtitle_codecs[index])) < 0)
+    {
+        if (_ffmpeg->probe_cache_used)
+        {
+            probe_cache::remove(_url);
+        }
+        throw exc(_url + " stream " + str::from(_ffmpeg->subtitle_streams[index])
+                + ": Cannot open subtitle codec: " + my_av_strerror(e));
+    }
+}
+
+void media_object::close_subtitle_decoder(int index)
+{
+    if (_ffmpeg->subtitle_codec_ctxs[index]->codec)
+    {
+        avcodec_close(_ffmpeg->subtitle_codec_ctxs[index]);
+    }
+}
+
+// Throw away the queued packets of a stream
+static void clear_packet_queue(std::deque<AVPacket> &queue)
+{
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        av_free_packet(&queue[i]);
+    }
+    queue.clear();
+}
+
 void media_object::video_stream_set_active(int index, bool active)
 {
     assert(index >= 0);
     assert(index < video_streams());
-    // Stop decoder threads
-    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->video_streams.at(index)];
+    if ((stream->discard != AVDISCARD_ALL) == active)
     {
-        _ffmpeg->video_decode_threads[i].finish();
+        return;
     }
-    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    // Only this stream is affected: its decoder task is idle, and the other
+    // streams keep decoding while we change its state.
+    _ffmpeg->video_decode_tasks[index].finish();
+    // The reader must not read packets while the decoder is set up or released.
+    _ffmpeg->stream_state_mutex.lock();
+    try
     {
-        _ffmpeg->audio_decode_threads[i].finish();
+        if (active)
+        {
+            open_video_decoder(index);
+        }
+        else
+        {
+            close_video_decoder(index);
+        }
     }
-    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    catch (...)
     {
-        _ffmpeg->subtitle_decode_threads[i].finish();
+        _ffmpeg->stream_state_mutex.unlock();
+        throw;
+    }
+    // A newly activated stream starts with the packets that follow the
+    // current demuxer position.
+    _ffmpeg->video_packet_queue_mutexes[index].lock();
+    clear_packet_queue(_ffmpeg->video_packet_queues[index]);
+    _ffmpeg->video_last_timestamps[index] = std::numeric_limits<int64_t>::min();
+    stream->discard = (!active ? AVDISCARD_ALL
+            : _ffmpeg->video_previews[index] ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT);
+    _ffmpeg->video_packet_queue_mutexes[index].unlock();
+    _ffmpeg->stream_state_mutex.unlock();
+    if (active)
+    {
+        // Start filling the packet queue of the new stream
+        _ffmpeg->reader->start();
     }
-    // Stop reading packets
-    _ffmpeg->reader->finish();
-    // Set status
-    _ffmpeg->format_ctx->streams[_ffmpeg->video_streams.at(index)]->discard =
-        (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
-    // Restart reader
-    _ffmpeg->reader->start();
 }
 
 void media_object::audio_stream_set_active(int index, bool active)
 {
     assert(index >= 0);
     assert(index < audio_streams());
-    // Stop decoder threads
-    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(index)];
+    if ((stream->discard == AVDISCARD_DEFAULT) == active)
     {
-        _ffmpeg->video_decode_threads[i].finish();
+        return;
     }
-    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    // Only this stream is affected: its decoder thread is idle, and the other
+    // streams keep decoding while we change its state.
+    _ffmpeg->audio_decode_threads[index].finish();
+    // The reader must not read packets while the decoder is set up or released.
+    _ffmpeg->stream_state_mutex.lock();
+    try
     {
-        _ffmpeg->audio_decode_threads[i].finish();
+        if (active)
+        {
+            open_audio_decoder(index);
+        }
+        else
+        {
+            close_audio_decoder(index);
+        }
     }
-    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    catch (...)
     {
-        _ffmpeg->subtitle_decode_threads[i].finish();
-    }
-    // Stop reading packets
-    _ffmpeg->reader->finish();
-    // Set status
-    _ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(index)]->discard =
-        (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
+        _ffmpeg->stream_state_mutex.unlock();
+        throw;
+    }
+    // A newly activated stream starts with the packets that follow the
+    // current demuxer position.
+    _ffmpeg->audio_packet_queue_mutexes[index].lock();
+    clear_packet_queue(_ffmpeg->audio_packet_queues[index]);
+    _ffmpeg->audio_last_timestamps[index] = std::numeric_limits<int64_t>::min();
+    stream->discard = (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
+    _ffmpeg->audio_packet_queue_mutexes[index].unlock();
+    _ffmpeg->audio_buffers[index].clear();
     _ffmpeg->have_active_audio_stream = false;
     for (int i = 0; i < audio_streams(); i++)
     {
-        if (_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(index)]->discard == AVDISCARD_DEFAULT)
+        if (_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams.at(i)]->discard == AVDISCARD_DEFAULT)
         {
             _ffmpeg->have_active_audio_stream = true;
             break;
         }
     }
-    // Restart reader
-    _ffmpeg->reader->start();
+    _ffmpeg->stream_state_mutex.unlock();
+    if (active)
+    {
+        // Start filling the packet queue of the new stream
+        _ffmpeg->reader->start();
+    }
 }
 
 void media_object::subtitle_stream_set_active(int index, bool active)
 {
     assert(index >= 0);
     assert(index < subtitle_streams());
-    // Stop decoder threads
-    for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+    AVStream *stream = _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams.at(index)];
+    if ((stream->discard == AVDISCARD_DEFAULT) == active)
     {
-        _ffmpeg->video_decode_threads[i].finish();
+        return;
     }
-    for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
+    // Only this stream is affected: its decoder task is idle, and the other
+    // streams keep decoding while we change its state.
+    _ffmpeg->subtitle_decode_tasks[index].finish();
+    // The reader must not read packets while the decoder is set up or released.
+    _ffmpeg->stream_state_mutex.lock();
+    try
     {
-        _ffmpeg->audio_decode_threads[i].finish();
+        if (active)
+        {
+            open_subtitle_decoder(index);
+        }
+        else
+        {
+            close_subtitle_decoder(index);
+        }
     }
-    for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
+    catch (...)
     {
-        _ffmpeg->subtitle_decode_threads[i].finish();
+        _ffmpeg->stream_state_mutex.unlock();
+        throw;
     }
-    // Stop reading packets
-    _ffmpeg->reader->finish();
-    // Set status
-    _ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams.at(index)]->discard =
-        (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
-    // Restart reader
-    _ffmpeg->reader->start();
+    // A newly activated stream starts with the packets that follow the
+    // current demuxer position.
+    _ffmpeg->subtitle_packet_queue_mutexes[index].lock();
+    clear_packet_queue(_ffmpeg->subtitle_packet_queues[index]);
+    _ffmpeg->subtitle_last_timestamps[index] = std::numeric_limits<int64_t>::min();
+    stream->discard = (active ? AVDISCARD_DEFAULT : AVDISCARD_ALL);
+    _ffmpeg->subtitle_packet_queue_mutexes[index].unlock();
+    _ffmpeg->subtitle_box_buffers[index].clear();
+    _ffmpeg->stream_state_mutex.unlock();
+    if (active)
+    {
+        // Start filling the packet queue of the new stream
+        _ffmpeg->reader->start();
+    }
+}
+
+void media_object::video_stream_set_preview(int index, int max_width, int max_height)
+{
+    assert(index >= 0);
+    assert(index < video_streams());
+    assert(max_width > 0 && max_height > 0);
+    AVCodecContext *codec_ctx = _ffmpeg->video_codec_ctxs[index];
+    AVCodec *codec = _ffmpeg->video_codecs[index];
+    assert(!codec_ctx->codec);
+    _ffmpeg->video_previews[index] = true;
+    // Decode only key frames, in a single thread, and skip the loop filter
+    codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+    codec_ctx->thread_count = 1;
+    // Let the decoder reduce the resolution, as long as the result is still
+    // larger than the preview
+    int lowres = 0;
+    while (lowres < codec->max_lowres
+            && (codec_ctx->width >> (lowres + 1)) >= max_width
+            && (codec_ctx->height >> (lowres + 1)) >= max_height)
+    {
+        lowres++;
+    }
+    codec_ctx->lowres = lowres;
+    if (lowres > 0)
+    {
+        codec_ctx->flags |= CODEC_FLAG_EMU_EDGE;
+    }
+    // Deliver BGRA frames that fit into the preview size
+    video_frame &t = _ffmpeg->video_frame_templates[index];
+    int w = max_width;
+    int h = std::max(static_cast<int>(static_cast<int64_t>(w) * t.raw_height / t.raw_width), 1);
+    if (h > max_height)
+    {
+        h = max_height;
+        w = std::max(static_cast<int>(static_cast<int64_t>(h) * t.raw_width / t.raw_height), 1);
+    }
+    t.raw_width = w;
+    t.raw_height = h;
+    t.layout = video_frame::bgra32;
+    t.color_space = video_frame::srgb;
+    t.value_range = video_frame::u8_full;
+    t.chroma_location = video_frame::center;
+    t.set_view_dimensions();
 }
 
 const video_frame &media_object::video_frame_template(int video_stream) const
@@ -1014,14 +1933,20 @@ int64_t media_object::subtitle_duration(int index) const
 }
 
 read_thread::read_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg) :
-    _url(url), _ffmpeg(ffmpeg), _eof(false)
+    thread(thread::io), _url(url), _ffmpeg(ffmpeg), _eof(false)
 {
 }
 
 void read_thread::run()
 {
-    while (!_eof)
+    if (_ffmpeg->remote)
     {
+        // The packets are imported by someone else.
+        return;
+    }
+    while (!_eof && !stop_requested(_ffmpeg))
+    {
+        TRACE_SCOPE("read packet");
         // We need another packet if the number of queued packets for an active stream is below a threshold.
         const size_t video_stream_low_threshold = 2;    // Often, 1 packet results in one video frame
         const size_t audio_stream_low_threshold = 5;    // Often, 3-4 packets are needed for one buffer fill
@@ -1029,7 +1954,7 @@ void read_thread::run()
         bool need_another_packet = false;
         for (size_t i = 0; !need_another_packet && i < _ffmpeg->video_streams.size(); i++)
         {
-            if (_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->discard == AVDISCARD_DEFAULT)
+            if (_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->discard != AVDISCARD_ALL)
             {
                 _ffmpeg->video_packet_queue_mutexes[i].lock();
                 need_another_packet = _ffmpeg->video_packet_queues[i].size() < video_stream_low_threshold;
@@ -1056,19 +1981,27 @@ void read_thread::run()
         }
         if (!need_another_packet)
         {
-            msg::dbg(_url + ": No need to read more packets.");
+            MSG_DBG(_url + ": No need to read more packets.");
             break;
         }
         // Read a packet.
-        msg::dbg(_url + ": Reading a packet.");
+        MSG_DBG(_url + ": Reading a packet.");
         AVPacket packet;
+        _ffmpeg->stream_state_mutex.lock();
         int e = av_read_frame(_ffmpeg->format_ctx, &packet);
+        _ffmpeg->stream_state_mutex.unlock();
         if (e < 0)
         {
             if (e == AVERROR_EOF)
             {
-                msg::dbg(_url + ": EOF.");
+                MSG_DBG(_url + ": EOF.");
                 _eof = true;
+                if (_ffmpeg->packet_export)
+                {
+                    _ffmpeg->packet_export_mutex.lock();
+                    save_packet_record(_ffmpeg->exported_packets, packet_record_eof);
+                    _ffmpeg->packet_export_mutex.unlock();
+                }
                 return;
             }
             else
@@ -1087,17 +2020,28 @@ void read_thread::run()
                 // 1. The video decoder might fill in a timestamp for us
                 // 2. We cannot drop video packets anyway, because of their
                 //    interdependencies. We would mess up decoding.
-                if (av_dup_packet(&packet) < 0)
+                // Packets of streams that were deactivated in the meantime are dropped.
+                _ffmpeg->video_packet_queue_mutexes[i].lock();
+                if (_ffmpeg->format_ctx->streams[packet.stream_index]->discard != AVDISCARD_ALL)
                 {
-                    throw exc(_url + ": Cannot duplicate packet.");
+                    if (av_dup_packet(&packet) < 0)
+                    {
+                        _ffmpeg->video_packet_queue_mutexes[i].unlock();
+                        throw exc(_url + ": Cannot duplicate packet.");
+                    }
+                    _ffmpeg->video_packet_queues[i].push_back(packet);
+                    packet_queued = true;
+                    if (_ffmpeg->packet_export)
+                    {
+                        _ffmpeg->packet_export_mutex.lock();
+                        save_packet_record(_ffmpeg->exported_packets, i, packet);
+                        _ffmpeg->packet_export_mutex.unlock();
+                    }
+                    MSG_DBG(_url + ": "
+                            + str::from(_ffmpeg->video_packet_queues[i].size())
+                            + " packets queued in video stream " + str::from(i) + ".");
                 }
-                _ffmpeg->video_packet_queue_mutexes[i].lock();
-                _ffmpeg->video_packet_queues[i].push_back(packet);
                 _ffmpeg->video_packet_queue_mutexes[i].unlock();
-                packet_queued = true;
-                msg::dbg(_url + ": "
-                        + str::from(_ffmpeg->video_packet_queues[i].size())
-                        + " packets queued in video stream " + str::from(i) + ".");
             }
         }
         for (size_t i = 0; i < _ffmpeg->audio_streams.size() && !packet_queued; i++)
@@ -1105,13 +2049,17 @@ void read_thread::run()
             if (packet.stream_index == _ffmpeg->audio_streams[i])
             {
                 _ffmpeg->audio_packet_queue_mutexes[i].lock();
-                if (_ffmpeg->audio_packet_queues[i].empty()
+                if (_ffmpeg->format_ctx->streams[packet.stream_index]->discard != AVDISCARD_DEFAULT)
+                {
+                    // The stream was deactivated in the meantime.
+                }
+                else if (_ffmpeg->audio_packet_queues[i].empty()
                         && _ffmpeg->audio_last_timestamps[i] == std::numeric_limits<int64_t>::min()
                         && packet.dts == static_cast<int64_t>(AV_NOPTS_VALUE))
                 {
                     // We have no packet in the queue and no last timestamp, probably
                     // because we just seeked. We *need* a packet with a timestamp.
-                    msg::dbg(_url + ": audio stream " + str::from(i)
+                    MSG_DBG(_url + ": audio stream " + str::from(i)
                             + ": dropping packet because it has no timestamp");
                 }
                 else
@@ -1123,7 +2071,7 @@ void read_thread::run()
                     }
                     _ffmpeg->audio_packet_queues[i].push_back(packet);
                     packet_queued = true;
-                    msg::dbg(_url + ": "
+                    MSG_DBG(_url + ": "
                             + str::from(_ffmpeg->audio_packet_queues[i].size())
                             + " packets queued in audio stream " + str::from(i) + ".");
                 }
@@ -1135,13 +2083,17 @@ void read_thread::run()
             if (packet.stream_index == _ffmpeg->subtitle_streams[i])
             {
                 _ffmpeg->subtitle_packet_queue_mutexes[i].lock();
-                if (_ffmpeg->subtitle_packet_queues[i].empty()
+                if (_ffmpeg->format_ctx->streams[packet.stream_index]->discard != AVDISCARD_DEFAULT)
+                {
+                    // The stream was deactivated in the meantime.
+                }
+                else if (_ffmpeg->subtitle_packet_queues[i].empty()
                         && _ffmpeg->subtitle_last_timestamps[i] == std::numeric_limits<int64_t>::min()
                         && packet.dts == static_cast<int64_t>(AV_NOPTS_VALUE))
                 {
                     // We have no packet in the queue and no last timestamp, probably
                     // because we just seeked. We want a packet with a timestamp.
-                    msg::dbg(_url + ": subtitle stream " + str::from(i)
+                    MSG_DBG(_url + ": subtitle stream " + str::from(i)
                             + ": dropping packet because it has no timestamp");
                 }
                 else
@@ -1153,7 +2105,7 @@ void read_thread::run()
                     }
                     _ffmpeg->subtitle_packet_queues[i].push_back(packet);
                     packet_queued = true;
-                    msg::dbg(_url + ": "
+                    MSG_DBG(_url + ": "
                             + str::from(_ffmpeg->subtitle_packet_queues[i].size())
                             + " packets queued in subtitle stream " + str::from(i) + ".");
                 }
@@ -1173,12 +2125,12 @@ void read_thread::reset()
     _eof = false;
 }
 
-video_decode_thread::video_decode_thread(const std::string& url, ffmpeg_stuff* ffmpeg, int video_stream) :
+video_decode_task::video_decode_task(const std::string& url, ffmpeg_stuff* ffmpeg, int video_stream) :
     _url(url), _ffmpeg(ffmpeg), _video_stream(video_stream), _frame()
 {
 }
 
-int64_t video_decode_thread::handle_timestamp(int64_t timestamp)
+int64_t video_decode_task::handle_timestamp(int64_t timestamp)
 {
     int64_t ts = timestamp_helper(_ffmpeg->video_last_timestamps[_video_stream], timestamp);
     if (!_ffmpeg->have_active_audio_stream || _ffmpeg->pos == std::numeric_limits<int64_t>::min())
@@ -1188,14 +2140,20 @@ int64_t video_decode_thread::handle_timestamp(int64_t timestamp)
     return ts;
 }
 
-void video_decode_thread::run()
+void video_decode_task::run()
 {
+    TRACE_SCOPE("decode video");
     int frame_finished = 0;
     do
     {
         bool empty;
         do
         {
+            if (stop_requested(_ffmpeg))
+            {
+                _frame = video_frame();
+                return;
+            }
             _ffmpeg->video_packet_queue_mutexes[_video_stream].lock();
             empty = _ffmpeg->video_packet_queues[_video_stream].empty();
             _ffmpeg->video_packet_queue_mutexes[_video_stream].unlock();
@@ -1206,9 +2164,22 @@ void video_decode_thread::run()
                     _frame = video_frame();
                     return;
                 }
-                msg::dbg(_url + ": video stream " + str::from(_video_stream) + ": need to wait for packets...");
-                _ffmpeg->reader->start();
-                _ffmpeg->reader->finish();
+                MSG_DBG(_url + ": video stream " + str::from(_video_stream) + ": need to wait for packets...");
+                if (_ffmpeg->remote)
+                {
+                    _ffmpeg->video_packet_queue_mutexes[_video_stream].lock();
+                    while (_ffmpeg->video_packet_queues[_video_stream].empty() && !_ffmpeg->reader->eof())
+                    {
+                        _ffmpeg->video_packet_queue_conds[_video_stream].wait(
+                                _ffmpeg->video_packet_queue_mutexes[_video_stream]);
+                    }
+                    _ffmpeg->video_packet_queue_mutexes[_video_stream].unlock();
+                }
+                else
+                {
+                    _ffmpeg->reader->start();
+                    _ffmpeg->reader->finish();
+                }
             }
         }
         while (empty);
@@ -1217,22 +2188,58 @@ void video_decode_thread::run()
         _ffmpeg->video_packets[_video_stream] = _ffmpeg->video_packet_queues[_video_stream].front();
         _ffmpeg->video_packet_queues[_video_stream].pop_front();
         _ffmpeg->video_packet_queue_mutexes[_video_stream].unlock();
-        _ffmpeg->reader->start();       // Refill the packet queue
+        if (!_ffmpeg->remote)
+        {
+            _ffmpeg->reader->start();   // Refill the packet queue
+        }
         avcodec_decode_video2(_ffmpeg->video_codec_ctxs[_video_stream],
                 _ffmpeg->video_frames[_video_stream], &frame_finished,
                 &(_ffmpeg->video_packets[_video_stream]));
     }
     while (!frame_finished);
 
-    _frame = _ffmpeg->video_frame_templates[_video_stream];
+    video_frame &t = _ffmpeg->video_frame_templates[_video_stream];
+    const AVCodecContext *codec_ctx = _ffmpeg->video_codec_ctxs[_video_stream];
+    if (_ffmpeg->probe_cache_used && !_ffmpeg->video_previews[_video_stream]
+            && (codec_ctx->width != t.raw_width || codec_ctx->height != t.raw_height))
+    {
+        // The cached stream information was wrong. Continue with the actual
+        // frame size (keeping the sample aspect ratio), and let the stream be
+        // probed again on next open.
+        msg::wrn(_url + ": video stream " + str::from(_video_stream)
+                + ": frame size differs from the cached stream information.");
+        probe_cache::remove(_url);
+        float sample_aspect_ratio = t.raw_aspect_ratio * t.raw_height / t.raw_width;
+        t.raw_width = codec_ctx->width;
+        t.raw_height = codec_ctx->height;
+        t.raw_aspect_ratio = sample_aspect_ratio * t.raw_width / t.raw_height;
+        t.set_view_dimensions();
+        close_video_conversion(_ffmpeg, _video_stream);
+        open_video_conversion(_url, _ffmpeg, _video_stream);
+    }
+    _frame = t;
     if (_frame.layout == video_frame::bgra32)
     {
-        sws_scale(_ffmpeg->video_img_conv_ctxs[_video_stream],
-                _ffmpeg->video_frames[_video_stream]->data,
-                _ffmpeg->video_frames[_video_stream]->linesize,
-                0, _frame.raw_height,
-                _ffmpeg->video_out_frames[_video_stream]->data,
-                _ffmpeg->video_out_frames[_video_stream]->linesize);
+        if (_ffmpeg->video_img_conv_band_ctxs[_video_stream].size() > 0)
+        {
+            video_conversion_job job(
+                    _ffmpeg->video_img_conv_band_ctxs[_video_stream],
+                    _ffmpeg->video_img_conv_bands[_video_stream],
+                    _ffmpeg->video_codec_ctxs[_video_stream]->height,
+                    av_pix_fmt_descriptors[_ffmpeg->video_codec_ctxs[_video_stream]->pix_fmt].log2_chroma_h,
+                    _ffmpeg->video_frames[_video_stream],
+                    _ffmpeg->video_out_frames[_video_stream]);
+            parallel_run(job, _ffmpeg->video_img_conv_bands[_video_stream].size(), video_decoding_budget());
+        }
+        else
+        {
+            sws_scale(_ffmpeg->video_img_conv_ctxs[_video_stream],
+                    _ffmpeg->video_frames[_video_stream]->data,
+                    _ffmpeg->video_frames[_video_stream]->linesize,
+                    0, _ffmpeg->video_codec_ctxs[_video_stream]->height,
+                    _ffmpeg->video_out_frames[_video_stream]->data,
+                    _ffmpeg->video_out_frames[_video_stream]->linesize);
+        }
         // TODO: Handle sws_scale errors. How?
         _frame.data[0][0] = _ffmpeg->video_out_frames[_video_stream]->data[0];
         _frame.line_size[0][0] = _ffmpeg->video_out_frames[_video_stream]->linesize[0];
@@ -1255,13 +2262,13 @@ void video_decode_thread::run()
     }
     else if (_ffmpeg->video_last_timestamps[_video_stream] != std::numeric_limits<int64_t>::min())
     {
-        msg::wrn(_url + ": video stream " + str::from(_video_stream)
+        MSG_WRN(_url + ": video stream " + str::from(_video_stream)
                 + ": no timestamp available, using a questionable guess");
         _frame.presentation_time = _ffmpeg->video_last_timestamps[_video_stream];
     }
     else
     {
-        msg::wrn(_url + ": video stream " + str::from(_video_stream)
+        MSG_WRN(_url + ": video stream " + str::from(_video_stream)
                 + ": no timestamp available, using a bad guess");
         _frame.presentation_time = _ffmpeg->pos;
     }
@@ -1271,19 +2278,29 @@ void media_object::start_video_frame_read(int video_stream)
 {
     assert(video_stream >= 0);
     assert(video_stream < video_streams());
-    _ffmpeg->video_decode_threads[video_stream].start();
+    if (!_ffmpeg->video_previews[video_stream])
+    {
+        _ffmpeg->video_decode_tasks[video_stream].start();
+    }
 }
 
 video_frame media_object::finish_video_frame_read(int video_stream)
 {
     assert(video_stream >= 0);
     assert(video_stream < video_streams());
-    _ffmpeg->video_decode_threads[video_stream].finish();
-    return _ffmpeg->video_decode_threads[video_stream].frame();
+    if (_ffmpeg->video_previews[video_stream])
+    {
+        _ffmpeg->video_decode_tasks[video_stream].run();
+    }
+    else
+    {
+        _ffmpeg->video_decode_tasks[video_stream].finish();
+    }
+    return _ffmpeg->video_decode_tasks[video_stream].frame();
 }
 
 audio_decode_thread::audio_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int audio_stream) :
-    _url(url), _ffmpeg(ffmpeg), _audio_stream(audio_stream), _blob()
+    thread(thread::audio), _url(url), _ffmpeg(ffmpeg), _audio_stream(audio_stream), _blob()
 {
 }
 
@@ -1296,6 +2313,7 @@ int64_t audio_decode_thread::handle_timestamp(int64_t timestamp)
 
 void audio_decode_thread::run()
 {
+    TRACE_SCOPE("decode audio");
     size_t size = _ffmpeg->audio_blobs[_audio_stream].size();
     void *buffer = _ffmpeg->audio_blobs[_audio_stream].ptr();
     int64_t timestamp = std::numeric_limits<int64_t>::min();
@@ -1330,7 +2348,7 @@ void audio_decode_thread::run()
                         _blob = audio_blob();
                         return;
                     }
-                    msg::dbg(_url + ": audio stream " + str::from(_audio_stream) + ": need to wait for packets...");
+                    MSG_DBG(_url + ": audio stream " + str::from(_audio_stream) + ": need to wait for packets...");
                     _ffmpeg->reader->start();
                     _ffmpeg->reader->finish();
                 }
@@ -1381,7 +2399,7 @@ void audio_decode_thread::run()
     }
     if (timestamp == std::numeric_limits<int64_t>::min())
     {
-        msg::wrn(_url + ": audio stream " + str::from(_audio_stream)
+        MSG_WRN(_url + ": audio stream " + str::from(_audio_stream)
                 + ": no timestamp available, using a bad guess");
         timestamp = _ffmpeg->pos;
     }
@@ -1408,20 +2426,21 @@ audio_blob media_object::finish_audio_blob_read(int audio_stream)
     return _ffmpeg->audio_decode_threads[audio_stream].blob();
 }
 
-subtitle_decode_thread::subtitle_decode_thread(const std::string &url, struct ffmpeg_stuff *ffmpeg, int subtitle_stream) :
+subtitle_decode_task::subtitle_decode_task(const std::string &url, struct ffmpeg_stuff *ffmpeg, int subtitle_stream) :
     _url(url), _ffmpeg(ffmpeg), _subtitle_stream(subtitle_stream), _box()
 {
 }
 
-int64_t subtitle_decode_thread::handle_timestamp(int64_t timestamp)
+int64_t subtitle_decode_task::handle_timestamp(int64_t timestamp)
 {
     int64_t ts = timestamp_helper(_ffmpeg->subtitle_last_timestamps[_subtitle_stream], timestamp);
     _ffmpeg->pos = ts;
     return ts;
 }
 
-void subtitle_decode_thread::run()
+void subtitle_decode_task::run()
 {
+    TRACE_SCOPE("decode subtitle");
     if (_ffmpeg->subtitle_box_buffers[_subtitle_stream].empty())
     {
         // Read more subtitle data
@@ -1439,7 +2458,7 @@ void subtitle_decode_thread::run()
                     _box = subtitle_box();
                     return;
                 }
-                msg::dbg(_url + ": subtitle stream " + str::from(_subtitle_stream) + ": need to wait for packets...");
+                MSG_DBG(_url + ": subtitle stream " + str::from(_subtitle_stream) + ": need to wait for packets...");
                 _ffmpeg->reader->start();
                 _ffmpeg->reader->finish();
             }
@@ -1484,7 +2503,7 @@ void subtitle_decode_thread::run()
                 {
                 case SUBTITLE_BITMAP:
                     // TODO
-                    msg::wrn(_url + ": subtitle stream " + str::from(_subtitle_stream)
+                    MSG_WRN(_url + ": subtitle stream " + str::from(_subtitle_stream)
                             + ": bitmap subtitles are not yet supported");
                     box.str = "???";
                     break;
@@ -1503,7 +2522,7 @@ void subtitle_decode_thread::run()
                     else
                     {
                         // Very naive - return text after third comma
-                        msg::wrn(_url + ": subtitle stream " + str::from(_subtitle_stream)
+                        MSG_WRN(_url + ": subtitle stream " + str::from(_subtitle_stream)
                                 + ": guessing text approximation for ASS subtitle");
                         const char *text_pos = rect->ass;
                         for (int j = 0; j < 3; j++)
@@ -1549,15 +2568,20 @@ void media_object::start_subtitle_box_read(int subtitle_stream)
 {
     assert(subtitle_stream >= 0);
     assert(subtitle_stream < subtitle_streams());
-    _ffmpeg->subtitle_decode_threads[subtitle_stream].start();
+    _ffmpeg->subtitle_decode_tasks[subtitle_stream].start();
 }
 
 subtitle_box media_object::finish_subtitle_box_read(int subtitle_stream)
 {
     assert(subtitle_stream >= 0);
     assert(subtitle_stream < subtitle_streams());
-    _ffmpeg->subtitle_decode_threads[subtitle_stream].finish();
-    return _ffmpeg->subtitle_decode_threads[subtitle_stream].box();
+    _ffmpeg->subtitle_decode_tasks[subtitle_stream].finish();
+    return _ffmpeg->subtitle_decode_tasks[subtitle_stream].box();
+}
+
+void media_object::set_stop_request(int *stop_request)
+{
+    _ffmpeg->stop_request = stop_request;
 }
 
 int64_t media_object::tell()
@@ -1569,10 +2593,10 @@ void media_object::seek(int64_t dest_pos)
 {
     msg::dbg(_url + ": Seeking from " + str::from(_ffmpeg->pos / 1e6f) + " to " + str::from(dest_pos / 1e6f) + ".");
 
-    // Stop decoder threads
+    // Stop decoders
     for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
     {
-        _ffmpeg->video_decode_threads[i].finish();
+        _ffmpeg->video_decode_tasks[i].finish();
     }
     for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
     {
@@ -1580,22 +2604,35 @@ void media_object::seek(int64_t dest_pos)
     }
     for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
     {
-        _ffmpeg->subtitle_decode_threads[i].finish();
+        _ffmpeg->subtitle_decode_tasks[i].finish();
     }
     // Stop reading packets
     _ffmpeg->reader->finish();
-    // Seek
-    int e = av_seek_frame(_ffmpeg->format_ctx, -1,
-            dest_pos * AV_TIME_BASE / 1000000,
-            dest_pos < _ffmpeg->pos ?  AVSEEK_FLAG_BACKWARD : 0);
-    if (e < 0)
+    // Seek. A remote media object only needs to forget its packets, since it
+    // will be given the packets that the exporting media object reads next.
+    if (!_ffmpeg->remote)
+    {
+        int e = av_seek_frame(_ffmpeg->format_ctx, -1,
+                dest_pos * AV_TIME_BASE / 1000000,
+                dest_pos < _ffmpeg->pos ?  AVSEEK_FLAG_BACKWARD : 0);
+        if (e < 0)
+        {
+            msg::err(_url + ": Seeking failed.");
+        }
+    }
+    if (_ffmpeg->packet_export)
     {
-        msg::err(_url + ": Seeking failed.");
+        _ffmpeg->packet_export_mutex.lock();
+        save_packet_record(_ffmpeg->exported_packets, packet_record_seek);
+        _ffmpeg->packet_export_mutex.unlock();
     }
     // Throw away all queued packets
     for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
     {
-        avcodec_flush_buffers(_ffmpeg->format_ctx->streams[_ffmpeg->video_streams[i]]->codec);
+        if (_ffmpeg->video_codec_ctxs[i]->codec)
+        {
+            avcodec_flush_buffers(_ffmpeg->video_codec_ctxs[i]);
+        }
         for (size_t j = 0; j < _ffmpeg->video_packet_queues[i].size(); j++)
         {
             av_free_packet(&_ffmpeg->video_packet_queues[i][j]);
@@ -1604,7 +2641,10 @@ void media_object::seek(int64_t dest_pos)
     }
     for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
     {
-        avcodec_flush_buffers(_ffmpeg->format_ctx->streams[_ffmpeg->audio_streams[i]]->codec);
+        if (_ffmpeg->audio_codec_ctxs[i]->codec)
+        {
+            avcodec_flush_buffers(_ffmpeg->audio_codec_ctxs[i]);
+        }
         _ffmpeg->audio_buffers[i].clear();
         for (size_t j = 0; j < _ffmpeg->audio_packet_queues[i].size(); j++)
         {
@@ -1614,7 +2654,10 @@ void media_object::seek(int64_t dest_pos)
     }
     for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
     {
-        avcodec_flush_buffers(_ffmpeg->format_ctx->streams[_ffmpeg->subtitle_streams[i]]->codec);
+        if (_ffmpeg->subtitle_codec_ctxs[i]->codec)
+        {
+            avcodec_flush_buffers(_ffmpeg->subtitle_codec_ctxs[i]);
+        }
         _ffmpeg->subtitle_box_buffers[i].clear();
         for (size_t j = 0; j < _ffmpeg->subtitle_packet_queues[i].size(); j++)
         {
@@ -1638,17 +2681,75 @@ void media_object::seek(int64_t dest_pos)
     _ffmpeg->pos = std::numeric_limits<int64_t>::min();
     // Restart packet reading
     _ffmpeg->reader->reset();
+    if (_ffmpeg->remote)
+    {
+        std::string records;
+        records.swap(_ffmpeg->imported_packets);
+        load_packet_records(_ffmpeg, _url, records);
+    }
     _ffmpeg->reader->start();
 }
 
+void media_object::set_packet_export(bool enable)
+{
+    // Stop reading packets, so that the queues do not change
+    _ffmpeg->reader->finish();
+    _ffmpeg->packet_export_mutex.lock();
+    _ffmpeg->exported_packets.clear();
+    if (enable)
+    {
+        for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
+        {
+            for (size_t j = 0; j < _ffmpeg->video_packet_queues[i].size(); j++)
+            {
+                save_packet_record(_ffmpeg->exported_packets, i, _ffmpeg->video_packet_queues[i][j]);
+            }
+        }
+        if (_ffmpeg->reader->eof())
+        {
+            save_packet_record(_ffmpeg->exported_packets, packet_record_eof);
+        }
+    }
+    _ffmpeg->packet_export = enable;
+    _ffmpeg->packet_export_mutex.unlock();
+}
+
+void media_object::export_packets(std::string &packets)
+{
+    packets.clear();
+    _ffmpeg->packet_export_mutex.lock();
+    packets.swap(_ffmpeg->exported_packets);
+    _ffmpeg->packet_export_mutex.unlock();
+}
+
+void media_object::import_packets(const std::string &packets)
+{
+    assert(_ffmpeg->remote);
+    if (!_ffmpeg->imported_packets.empty())
+    {
+        // There is a seek pending; everything else comes after it
+        _ffmpeg->imported_packets += packets;
+    }
+    else
+    {
+        load_packet_records(_ffmpeg, _url, packets);
+    }
+}
+
 void media_object::close()
 {
     try
     {
-        // Stop decoder threads
+        // Remote decoders might be waiting for packets that will not come
+        if (_ffmpeg->remote)
+        {
+            _ffmpeg->reader->set_eof();
+            wake_video_decoders(_ffmpeg);
+        }
+        // Stop decoders
         for (size_t i = 0; i < _ffmpeg->video_streams.size(); i++)
         {
-            _ffmpeg->video_decode_threads[i].finish();
+            _ffmpeg->video_decode_tasks[i].finish();
         }
         for (size_t i = 0; i < _ffmpeg->audio_streams.size(); i++)
         {
@@ -1656,7 +2757,7 @@ void media_object::close()
         }
         for (size_t i = 0; i < _ffmpeg->subtitle_streams.size(); i++)
         {
-            _ffmpeg->subtitle_decode_threads[i].finish();
+            _ffmpeg->subtitle_decode_tasks[i].finish();
         }
         // Stop reading packets
         _ffmpeg->reader->finish();
@@ -1664,28 +2765,9 @@ void media_object::close()
     catch (...)
     {
     }
-    for (size_t i = 0; i < _ffmpeg->video_frames.size(); i++)
-    {
-        av_free(_ffmpeg->video_frames[i]);
-    }
-    for (size_t i = 0; i < _ffmpeg->video_out_frames.size(); i++)
-    {
-        av_free(_ffmpeg->video_out_frames[i]);
-    }
-    for (size_t i = 0; i < _ffmpeg->video_buffers.size(); i++)
-    {
-        av_free(_ffmpeg->video_buffers[i]);
-    }
     for (size_t i = 0; i < _ffmpeg->video_codec_ctxs.size(); i++)
     {
-        if (i < _ffmpeg->video_codecs.size() && _ffmpeg->video_codecs[i])
-        {
-            avcodec_close(_ffmpeg->video_codec_ctxs[i]);
-        }
-    }
-    for (size_t i = 0; i < _ffmpeg->video_img_conv_ctxs.size(); i++)
-    {
-        sws_freeContext(_ffmpeg->video_img_conv_ctxs[i]);
+        close_video_decoder(i);
     }
     for (size_t i = 0; i < _ffmpeg->video_packet_queues.size(); i++)
     {
@@ -1705,10 +2787,7 @@ void media_object::close()
     }
     for (size_t i = 0; i < _ffmpeg->audio_codec_ctxs.size(); i++)
     {
-        if (i < _ffmpeg->audio_codecs.size() && _ffmpeg->audio_codecs[i])
-        {
-            avcodec_close(_ffmpeg->audio_codec_ctxs[i]);
-        }
+        close_audio_decoder(i);
     }
     for (size_t i = 0; i < _ffmpeg->audio_packet_queues.size(); i++)
     {
@@ -1722,16 +2801,9 @@ void media_object::close()
             av_free_packet(&_ffmpeg->audio_packet_queues[i][j]);
         }
     }
-    for (size_t i = 0; i < _ffmpeg->audio_tmpbufs.size(); i++)
-    {
-        av_free(_ffmpeg->audio_tmpbufs[i]);
-    }
     for (size_t i = 0; i < _ffmpeg->subtitle_codec_ctxs.size(); i++)
     {
-        if (i < _ffmpeg->subtitle_codecs.size() && _ffmpeg->subtitle_codecs[i])
-        {
-            avcodec_close(_ffmpeg->subtitle_codec_ctxs[i]);
-        }
+        close_subtitle_decoder(i);
     }
     for (size_t i = 0; i < _ffmpeg->subtitle_packet_queues.size(); i++)
     {
@@ -1747,7 +2819,14 @@ void media_object::close()
     }
     if (_ffmpeg->format_ctx)
     {
-        av_close_input_file(_ffmpeg->format_ctx);
+        if (_ffmpeg->remote)
+        {
+            destroy_remote_format_ctx(_ffmpeg->format_ctx);
+        }
+        else
+        {
+            av_close_input_file(_ffmpeg->format_ctx);
+        }
     }
     delete _ffmpeg->reader;
     delete _ffmpeg;
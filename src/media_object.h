@@ -42,6 +42,21 @@ private:
     void set_audio_blob_template(int audio_stream);
     void set_subtitle_box_template(int subtitle_stream);
 
+    // Set up and release the decoder of a stream, including the buffers needed
+    // for decoding. This is only done for active streams.
+    void open_video_decoder(int video_stream);
+    void close_video_decoder(int video_stream);
+    void open_audio_decoder(int audio_stream);
+    void close_audio_decoder(int audio_stream);
+    void open_subtitle_decoder(int subtitle_stream);
+    void close_subtitle_decoder(int subtitle_stream);
+
+    // Open the media object, optionally using stream information from the
+    // probe cache instead of probing the input. If a stream description is
+    // given, the input itself is not accessed at all.
+    void open(const std::string &url, const std::string *stream_description,
+            bool use_probe_cache, bool *probe_cache_used);
+
     // The threaded implementation can access private members
     friend class read_thread;
     friend class video_decode_thread;
@@ -61,6 +76,16 @@ public:
     /* Open a media object. The URL may simply be a file name. */
     void open(const std::string &url);
 
+    /* Open a media object from the stream description of another media object
+     * with the same URL, without accessing the URL. Such a remote media object
+     * cannot read packets itself; its packets must be imported from the other
+     * media object (see below). */
+    void open_remote(const std::string &url, const std::string &stream_description);
+
+    /* Get the description of the streams of this media object, for
+     * open_remote(). */
+    std::string stream_description() const;
+
     /* Get metadata */
     const std::string &url() const;
     size_t tags() const;
@@ -73,11 +98,22 @@ public:
     int audio_streams() const;
     int subtitle_streams() const;
 
-    /* Activate a media stream for usage. Inactive streams will not be accessible. */
+    /* Activate a media stream for usage. Inactive streams will not be accessible.
+     * Only the given stream is affected; reads from other streams may continue.
+     * There must be no active read from the given stream. A newly activated
+     * stream starts at the current read position of the media object. */
     void video_stream_set_active(int video_stream, bool active);
     void audio_stream_set_active(int audio_stream, bool active);
     void subtitle_stream_set_active(int subtitle_stream, bool active);
 
+    /* Use a video stream for previews: only key frames are decoded, at reduced
+     * resolution if the decoder supports it, and the frames are delivered in
+     * BGRA layout, scaled to fit into the given size. The video frame template
+     * is changed accordingly. Preview frames are decoded by the thread that calls
+     * finish_video_frame_read(), not by the task pool, so that they get the
+     * priority of that thread. This must be called before the stream is activated. */
+    void video_stream_set_preview(int video_stream, int max_width, int max_height);
+
     /* Get information about video streams. */
     // Return a video frame with all properties filled in (but without any data).
     // Note that this is only a hint; the properties of actual video frames may differ!
@@ -125,6 +161,12 @@ public:
      * An invalid box means that EOF was reached. */
     subtitle_box finish_subtitle_box_read(int subtitle_stream);
 
+    /* Give up reading as soon as the given flag becomes nonzero (it is read with
+     * atomic::fetch()): no more packets are read, and video frame reads return
+     * an invalid frame. The flag must remain valid until the media object is
+     * closed. This must be called after opening. */
+    void set_stop_request(int *stop_request);
+
     /* Return the last position in microseconds, of the last packet that was read in any
      * stream. If the position is unkown, the minimum possible value is returned. */
     int64_t tell();
@@ -137,6 +179,24 @@ public:
      * by the stream, ...) */
     void seek(int64_t pos);
 
+    /*
+     * Packet distribution
+     */
+
+    /* Export the compressed packets of the active video streams. When this is
+     * enabled, all packets that are read from now on (and those that are
+     * already queued) are recorded, together with seek and EOF events. There
+     * must be no active read when this is called. */
+    void set_packet_export(bool enable);
+    /* Get the packets recorded since the last call, and forget them. */
+    void export_packets(std::string &packets);
+    /* Import the packets that another media object exported, into a media
+     * object that was opened with open_remote(). The importing media object
+     * must have the same active video streams, and must be seeked whenever
+     * the exporting media object was. Packets recorded after a seek are kept
+     * back until then. */
+    void import_packets(const std::string &packets);
+
     /*
      * Cleanup
      */
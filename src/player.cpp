@@ -22,12 +22,17 @@
 #include "config.h"
 
 #include <vector>
+#include <limits>
+#include <cstring>
 #include <unistd.h>
 
+#include "dbg.h"
 #include "exc.h"
 #include "str.h"
 #include "msg.h"
+#include "thread.h"
 #include "timer.h"
+#include "trace.h"
 
 #include "controller.h"
 #include "media_data.h"
@@ -40,10 +45,12 @@
 player_init_data::player_init_data() :
     log_level(msg::INF),
     urls(),
+    playlist(),
     video_stream(0),
     audio_stream(0),
     subtitle_stream(-1),
     benchmark(false),
+    audio_buffering(audio_output::normal),
     fullscreen(false),
     center(false),
     stereo_layout_override(false),
@@ -64,10 +71,12 @@ void player_init_data::save(std::ostream &os) const
 {
     s11n::save(os, static_cast<int>(log_level));
     s11n::save(os, urls);
+    s11n::save(os, playlist);
     s11n::save(os, video_stream);
     s11n::save(os, audio_stream);
     s11n::save(os, subtitle_stream);
     s11n::save(os, benchmark);
+    s11n::save(os, static_cast<int>(audio_buffering));
     s11n::save(os, fullscreen);
     s11n::save(os, center);
     s11n::save(os, stereo_layout_override);
@@ -85,10 +94,13 @@ void player_init_data::load(std::istream &is)
     s11n::load(is, x);
     log_level = static_cast<msg::level_t>(x);
     s11n::load(is, urls);
+    s11n::load(is, playlist);
     s11n::load(is, video_stream);
     s11n::load(is, audio_stream);
     s11n::load(is, subtitle_stream);
     s11n::load(is, benchmark);
+    s11n::load(is, x);
+    audio_buffering = static_cast<audio_output::buffering_t>(x);
     s11n::load(is, fullscreen);
     s11n::load(is, center);
     s11n::load(is, stereo_layout_override);
@@ -103,14 +115,83 @@ void player_init_data::load(std::istream &is)
 }
 
 
+/* The playlist loader opens the next playlist item in a background thread,
+ * selects its streams, and reads its first video frame and audio blob. The
+ * player can then switch to it without waiting for FFmpeg to probe the input
+ * and open the codecs. */
+
+class playlist_loader : public thread
+{
+private:
+    std::vector<std::string> _urls;
+    player_init_data _init_data;
+    size_t _audio_size;
+
+public:
+    media_input *input;
+    video_frame first_video_frame;
+    audio_blob first_audio_blob;
+
+    playlist_loader(const std::vector<std::string> &urls, const player_init_data &init_data, size_t audio_size) :
+        thread(thread::io), _urls(urls), _init_data(init_data), _audio_size(audio_size), input(NULL)
+    {
+    }
+
+    ~playlist_loader()
+    {
+        if (input)
+        {
+            try { input->close(); } catch (...) {}
+            delete input;
+        }
+    }
+
+    void run()
+    {
+        input = new media_input();
+        input->open(_urls);
+        if (input->video_streams() == 0)
+        {
+            throw exc("No video streams found.");
+        }
+        // Use the stream choices of the first item where they apply to this one
+        if (_init_data.stereo_layout_override
+                && input->stereo_layout_is_supported(_init_data.stereo_layout, _init_data.stereo_layout_swap))
+        {
+            input->set_stereo_layout(_init_data.stereo_layout, _init_data.stereo_layout_swap);
+        }
+        input->select_video_stream(_init_data.video_stream < input->video_streams() ? _init_data.video_stream : 0);
+        if (input->audio_streams() > 0)
+        {
+            input->select_audio_stream(_init_data.audio_stream < input->audio_streams() ? _init_data.audio_stream : 0);
+        }
+        if (input->subtitle_streams() > 0 && _init_data.subtitle_stream >= 0)
+        {
+            input->select_subtitle_stream(_init_data.subtitle_stream < input->subtitle_streams() ? _init_data.subtitle_stream : 0);
+        }
+        // Pre-roll
+        input->start_video_frame_read();
+        first_video_frame = input->finish_video_frame_read();
+        if (input->audio_streams() > 0 && _audio_size > 0)
+        {
+            input->start_audio_blob_read(_audio_size);
+            first_audio_blob = input->finish_audio_blob_read();
+        }
+        msg::dbg("Next playlist item is ready.");
+    }
+};
+
+
 // The single player instance
 player *global_player = NULL;
 
 // The registered controllers
 std::vector<controller *> global_controllers;
+mutex global_controllers_mutex;
 
 player::player(type t) :
-    _media_input(NULL), _audio_output(NULL), _video_output(NULL)
+    _media_input(NULL), _audio_output(NULL), _video_output(NULL),
+    _playlist_index(0), _playlist_loader(NULL)
 {
     if (t == master)
     {
@@ -125,6 +206,7 @@ player::~player()
     {
         global_player = NULL;
     }
+    stop_playlist_loader();
     delete _media_input;
     delete _audio_output;
     delete _video_output;
@@ -147,6 +229,7 @@ void player::reset_playstate()
     _drop_next_frame = false;
     _previous_frame_dropped = false;
     _in_pause = false;
+    _audio_resync = false;
     _quit_request = false;
     _pause_request = false;
     _seek_request = 0;
@@ -164,6 +247,127 @@ void player::stop_playback()
     notify(notification::play, true, false);
 }
 
+void player::choose_stereo_mode()
+{
+    if (_init_data.stereo_mode_override)
+    {
+        _params.stereo_mode = _init_data.stereo_mode;
+        _params.stereo_mode_swap = _init_data.stereo_mode_swap;
+    }
+    else
+    {
+        if (_media_input->video_frame_template().stereo_layout == video_frame::mono)
+        {
+            _params.stereo_mode = parameters::mono_left;
+        }
+        else if (_video_output && _video_output->supports_stereo())
+        {
+            _params.stereo_mode = parameters::stereo;
+        }
+        else
+        {
+            _params.stereo_mode = parameters::red_cyan_dubois;
+        }
+        _params.stereo_mode_swap = false;
+    }
+}
+
+void player::start_playlist_loader()
+{
+    assert(!_playlist_loader);
+    if (_playlist_index < _init_data.playlist.size())
+    {
+        _playlist_loader = new playlist_loader(_init_data.playlist[_playlist_index], _init_data,
+                _audio_output ? _audio_output->required_initial_data_size() : 0);
+        _playlist_index++;
+        _playlist_loader->start();
+    }
+}
+
+void player::stop_playlist_loader()
+{
+    if (_playlist_loader)
+    {
+        _playlist_loader->wait();
+        delete _playlist_loader;
+        _playlist_loader = NULL;
+    }
+    _preroll_video_frame = video_frame();
+    _preroll_audio_blob = audio_blob();
+}
+
+bool player::next_playlist_item()
+{
+    while (_playlist_loader)
+    {
+        playlist_loader *loader = _playlist_loader;
+        _playlist_loader = NULL;
+        try
+        {
+            loader->finish();
+        }
+        catch (std::exception &e)
+        {
+            // Skip items that cannot be played
+            msg::err("%s", e.what());
+            delete loader;
+            start_playlist_loader();
+            continue;
+        }
+
+        // Replace the media input. The output stays as it is, so that the
+        // last frame of this item is shown until the first one of the next.
+        msg::dbg("Switching to the next playlist item.");
+        if (_video_output)
+        {
+            _video_output->wait_for_frame_copy();
+        }
+        try { _media_input->close(); } catch (...) {}
+        delete _media_input;
+        _media_input = loader->input;
+        loader->input = NULL;
+        _preroll_video_frame = loader->first_video_frame;
+        _preroll_audio_blob = loader->first_audio_blob;
+        delete loader;
+
+        // Adapt the audio output to the new input
+        if (_audio_output)
+        {
+            _audio_output->stop();
+            if (_media_input->audio_streams() == 0)
+            {
+                try { _audio_output->deinit(); } catch (...) {}
+                delete _audio_output;
+                _audio_output = NULL;
+                _preroll_audio_blob = audio_blob();
+            }
+        }
+        else if (_media_input->audio_streams() > 0 && !_benchmark)
+        {
+            _audio_output = create_audio_output();
+            if (_audio_output)
+            {
+                _audio_output->set_buffering(_init_data.audio_buffering);
+                _audio_output->init();
+            }
+        }
+
+        // Adapt the output parameters to the new input
+        parameters::stereo_mode_t old_stereo_mode = _params.stereo_mode;
+        bool old_stereo_mode_swap = _params.stereo_mode_swap;
+        choose_stereo_mode();
+        if (_video_output && (_params.stereo_mode != old_stereo_mode || _params.stereo_mode_swap != old_stereo_mode_swap))
+        {
+            _video_output->set_parameters(_params);
+        }
+
+        reset_playstate();
+        start_playlist_loader();
+        return true;
+    }
+    return false;
+}
+
 video_output *player::create_video_output()
 {
     return new video_output_qt(_benchmark);
@@ -174,6 +378,11 @@ audio_output *player::create_audio_output()
     return new audio_output();
 }
 
+void player::open_media_input(media_input *input, const std::vector<std::string> &urls)
+{
+    input->open(urls);
+}
+
 void player::make_master()
 {
     if (global_player)
@@ -188,11 +397,12 @@ void player::open(const player_init_data &init_data)
     // Initialize basics
     msg::set_level(init_data.log_level);
     _benchmark = init_data.benchmark;
+    _init_data = init_data;
     reset_playstate();
 
     // Create media input
     _media_input = new media_input();
-    _media_input->open(init_data.urls);
+    open_media_input(_media_input, init_data.urls);
     if (_media_input->video_streams() == 0)
     {
         throw exc("No video streams found.");
@@ -234,6 +444,7 @@ void player::open(const player_init_data &init_data)
     }
     if (_audio_output)
     {
+        _audio_output->set_buffering(init_data.audio_buffering);
         _audio_output->init();
     }
 
@@ -247,27 +458,7 @@ void player::open(const player_init_data &init_data)
     // Initialize output parameters
     _params = init_data.params;
     _params.set_defaults();
-    if (init_data.stereo_mode_override)
-    {
-        _params.stereo_mode = init_data.stereo_mode;
-        _params.stereo_mode_swap = init_data.stereo_mode_swap;
-    }
-    else
-    {
-        if (_media_input->video_frame_template().stereo_layout == video_frame::mono)
-        {
-            _params.stereo_mode = parameters::mono_left;
-        }
-        else if (_video_output && _video_output->supports_stereo())
-        {
-            _params.stereo_mode = parameters::stereo;
-        }
-        else
-        {
-            _params.stereo_mode = parameters::red_cyan_dubois;
-        }
-        _params.stereo_mode_swap = false;
-    }
+    choose_stereo_mode();
 
     // Set initial parameters
     if (_video_output)
@@ -288,6 +479,10 @@ void player::open(const player_init_data &init_data)
         }
         _video_output->process_events();
     }
+
+    // Start preparing the next playlist item
+    _playlist_index = 0;
+    start_playlist_loader();
 }
 
 void player::set_current_subtitle_box()
@@ -300,8 +495,86 @@ void player::set_current_subtitle_box()
     }
 }
 
+// Return the duration of an audio blob in microseconds
+static int64_t audio_blob_duration(const audio_blob &blob)
+{
+    size_t frame_size = blob.channels * blob.sample_bits() / 8;
+    return static_cast<int64_t>(blob.size / frame_size) * 1000000 / blob.rate;
+}
+
+bool player::align_audio_blob(audio_blob &blob)
+{
+    // Gaps larger than this are not filled with silence; the master time
+    // jumps instead, as it does for gaps inside a stream.
+    const int64_t max_gap = 2000000;
+    if (blob.presentation_time == std::numeric_limits<int64_t>::min())
+    {
+        return true;
+    }
+    size_t frame_size = blob.channels * blob.sample_bits() / 8;
+    int64_t offset = blob.presentation_time - _audio_end_pos;
+    int64_t offset_frames = offset * blob.rate / 1000000;
+    if (offset_frames < 0)
+    {
+        // The beginning of the blob was already covered by the previous stream
+        size_t skip = static_cast<size_t>(-offset_frames) * frame_size;
+        if (skip >= blob.size)
+        {
+            return false;
+        }
+        blob.data = static_cast<char *>(blob.data) + skip;
+        blob.size -= skip;
+    }
+    else if (offset_frames > 0)
+    {
+        if (offset > max_gap)
+        {
+            return true;
+        }
+        // The new stream starts later; fill the gap with silence
+        size_t gap = static_cast<size_t>(offset_frames) * frame_size;
+        _audio_resync_buffer.resize(gap + blob.size);
+        std::memset(_audio_resync_buffer.ptr(), (blob.sample_format == audio_blob::u8 ? 0x80 : 0x00), gap);
+        std::memcpy(_audio_resync_buffer.ptr(gap), blob.data, blob.size);
+        blob.data = _audio_resync_buffer.ptr();
+        blob.size += gap;
+    }
+    blob.presentation_time = _audio_end_pos;
+    return true;
+}
+
+void player::continue_with_new_audio_stream()
+{
+    if (_running && _audio_output)
+    {
+        // The audio output keeps playing the data it has. The first blob of the
+        // new stream is aligned to its end, so that the master time does not jump.
+        _media_input->start_audio_blob_read(_audio_output->required_update_data_size());
+        _audio_resync = true;
+    }
+}
+
+void player::continue_with_new_subtitle_stream()
+{
+    if (_running)
+    {
+        // Get the first subtitle of the new stream that is not over yet
+        do
+        {
+            _media_input->start_subtitle_box_read();
+            _next_subtitle_box = _media_input->finish_subtitle_box_read();
+        }
+        while (_next_subtitle_box.is_valid()
+                && _next_subtitle_box.presentation_stop_time < _video_pos);
+        set_current_subtitle_box();
+    }
+}
+
 int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool *drop_frame, bool *display_frame)
 {
+    TRACE_SCOPE("player step");
+    trace::handle_dump_request();
+    process_commands();
     *more_steps = false;
     *seek_to = -1;
     *prep_frame = false;
@@ -315,9 +588,18 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
     }
     else if (!_running)
     {
-        // Read initial data and start output
-        _media_input->start_video_frame_read();
-        _video_frame = _media_input->finish_video_frame_read();
+        // Read initial data and start output. For playlist items, the first
+        // video frame and audio blob were already read in the background.
+        if (_preroll_video_frame.is_valid())
+        {
+            _video_frame = _preroll_video_frame;
+            _preroll_video_frame = video_frame();
+        }
+        else
+        {
+            _media_input->start_video_frame_read();
+            _video_frame = _media_input->finish_video_frame_read();
+        }
         if (!_video_frame.is_valid())
         {
             msg::dbg("Empty video input.");
@@ -342,8 +624,17 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
         }
         if (_audio_output)
         {
-            _media_input->start_audio_blob_read(_audio_output->required_initial_data_size());
-            audio_blob blob = _media_input->finish_audio_blob_read();
+            audio_blob blob;
+            if (_preroll_audio_blob.is_valid())
+            {
+                blob = _preroll_audio_blob;
+                _preroll_audio_blob = audio_blob();
+            }
+            else
+            {
+                _media_input->start_audio_blob_read(_audio_output->required_initial_data_size());
+                blob = _media_input->finish_audio_blob_read();
+            }
             if (!blob.is_valid())
             {
                 msg::dbg("Empty audio input.");
@@ -351,8 +642,10 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
                 return 0;
             }
             _audio_pos = blob.presentation_time;
+            _audio_end_pos = _audio_pos + audio_blob_duration(blob);
             _audio_output->data(blob);
             _media_input->start_audio_blob_read(_audio_output->required_update_data_size());
+            _audio_resync = false;
             _master_time_start = _audio_output->start();
             _master_time_pos = _audio_pos;
             _current_pos = _audio_pos;
@@ -416,6 +709,11 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
         }
         _seek_request = 0;
         _set_pos_request = -1.0f;
+        // The video output may still be copying the data of the current frame
+        if (_video_output)
+        {
+            _video_output->wait_for_frame_copy();
+        }
         _media_input->seek(*seek_to);
 
         _media_input->start_video_frame_read();
@@ -454,8 +752,10 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
                 return 0;
             }
             _audio_pos = blob.presentation_time;
+            _audio_end_pos = _audio_pos + audio_blob_duration(blob);
             _audio_output->data(blob);
             _media_input->start_audio_blob_read(_audio_output->required_update_data_size());
+            _audio_resync = false;
             _master_time_start = _audio_output->start();
             _master_time_pos = _audio_pos;
             _current_pos = _audio_pos;
@@ -506,6 +806,11 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
             else
             {
                 msg::dbg("End of video stream.");
+                if (next_playlist_item())
+                {
+                    *more_steps = true;
+                    return 0;
+                }
                 stop_playback();
                 return 0;
             }
@@ -550,6 +855,11 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
     }
     else if (_need_frame_soon)
     {
+        // The next frame may overwrite the data of the current one
+        if (_video_output)
+        {
+            _video_output->wait_for_frame_copy();
+        }
         _media_input->start_video_frame_read();
         _need_frame_soon = false;
         *more_steps = true;
@@ -580,13 +890,25 @@ int64_t player::step(bool *more_steps, int64_t *seek_to, bool *prep_frame, bool
             if (need_audio_data)
             {
                 audio_blob blob = _media_input->finish_audio_blob_read();
+                while (_audio_resync && blob.is_valid() && !align_audio_blob(blob))
+                {
+                    _media_input->start_audio_blob_read(_audio_output->required_update_data_size());
+                    blob = _media_input->finish_audio_blob_read();
+                }
+                _audio_resync = false;
                 if (!blob.is_valid())
                 {
                     msg::dbg("End of audio stream.");
+                    if (next_playlist_item())
+                    {
+                        *more_steps = true;
+                        return 0;
+                    }
                     stop_playback();
                     return 0;
                 }
                 _audio_pos = blob.presentation_time;
+                _audio_end_pos = _audio_pos + audio_blob_duration(blob);
                 _master_time_start += (_audio_pos - _master_time_pos);
                 _master_time_pos = _audio_pos;
                 _audio_output->data(blob);
@@ -659,6 +981,7 @@ bool player::run_step()
     int64_t allowed_sleep;
 
     allowed_sleep = step(&more_steps, &seek_to, &prep_frame, &drop_frame, &display_frame);
+    controller::process_notifications();
 
     if (!more_steps)
     {
@@ -695,6 +1018,7 @@ void player::run()
 
 void player::close()
 {
+    stop_playlist_loader();
     reset_playstate();
     if (_audio_output)
     {
@@ -716,15 +1040,51 @@ void player::close()
     }
 }
 
+void player::queue_cmd(const command &cmd)
+{
+    _cmd_queue.push(cmd);
+}
+
+void player::process_commands()
+{
+    _cmds.clear();
+    if (_cmd_queue.take(_cmds))
+    {
+        for (size_t i = 0; i < _cmds.size(); i++)
+        {
+            receive_cmd(_cmds[i]);
+        }
+    }
+}
+
 void player::receive_cmd(const command &cmd)
 {
-    std::istringstream p(cmd.param);
     bool flag;
     float oldval;
     float param;
 
     bool parameters_changed = false;
 
+    // Commands that change the media input may free the data of a frame that
+    // the video output is still copying
+    switch (cmd.type)
+    {
+    case command::cycle_video_stream:
+    case command::set_video_stream:
+    case command::cycle_audio_stream:
+    case command::set_audio_stream:
+    case command::cycle_subtitles_stream:
+    case command::set_subtitles_stream:
+    case command::set_stereo_layout:
+        if (_video_output)
+        {
+            _video_output->wait_for_frame_copy();
+        }
+        break;
+    default:
+        break;
+    }
+
     switch (cmd.type)
     {
     case command::toggle_play:
@@ -757,7 +1117,7 @@ void player::receive_cmd(const command &cmd)
         {
             int oldstream = _media_input->selected_video_stream();
             int newstream;
-            s11n::load(p, newstream);
+            newstream = cmd.param.get_int();
             if (newstream < 0 || newstream >= _media_input->video_streams())
             {
                 newstream = 0;
@@ -781,7 +1141,7 @@ void player::receive_cmd(const command &cmd)
             }
             _media_input->select_audio_stream(newstream);
             notify(notification::audio_stream, oldstream, newstream);
-            _seek_request = -1;         // Get position right
+            continue_with_new_audio_stream();
         }
         break;
     case command::set_audio_stream:
@@ -789,7 +1149,7 @@ void player::receive_cmd(const command &cmd)
         {
             int oldstream = _media_input->selected_audio_stream();
             int newstream;
-            s11n::load(p, newstream);
+            newstream = cmd.param.get_int();
             if (newstream < 0 || newstream >= _media_input->audio_streams())
             {
                 newstream = 0;
@@ -798,7 +1158,7 @@ void player::receive_cmd(const command &cmd)
             {
                 _media_input->select_audio_stream(newstream);
                 notify(notification::audio_stream, oldstream, newstream);
-                _seek_request = -1;     // Get position right
+                continue_with_new_audio_stream();
             }
         }
         break;
@@ -813,7 +1173,7 @@ void player::receive_cmd(const command &cmd)
             }
             _media_input->select_subtitle_stream(newstream);
             notify(notification::subtitles_stream, oldstream, newstream);
-            _seek_request = -1;         // Get position right
+            continue_with_new_subtitle_stream();
         }
         break;
     case command::set_subtitles_stream:
@@ -821,7 +1181,7 @@ void player::receive_cmd(const command &cmd)
         {
             int oldstream = _media_input->selected_subtitle_stream();
             int newstream;
-            s11n::load(p, newstream);
+            newstream = cmd.param.get_int();
             if (newstream < 0 || newstream >= _media_input->subtitle_streams())
             {
                 newstream = 0;
@@ -830,16 +1190,14 @@ void player::receive_cmd(const command &cmd)
             {
                 _media_input->select_subtitle_stream(newstream);
                 notify(notification::subtitles_stream, oldstream, newstream);
-                _seek_request = -1;     // Get position right
+                continue_with_new_subtitle_stream();
             }
         }
         break;
     case command::set_stereo_layout:
         {
-            int stereo_layout;
-            bool stereo_layout_swap;
-            s11n::load(p, stereo_layout);
-            s11n::load(p, stereo_layout_swap);
+            int stereo_layout = cmd.param.get_int();
+            bool stereo_layout_swap = cmd.param.get_bool();
             _media_input->set_stereo_layout(static_cast<video_frame::stereo_layout_t>(stereo_layout), stereo_layout_swap);
             if (stereo_layout == video_frame::separate)
             {
@@ -849,10 +1207,8 @@ void player::receive_cmd(const command &cmd)
         break;
     case command::set_stereo_mode:
         {
-            int stereo_mode;
-            bool stereo_mode_swap;
-            s11n::load(p, stereo_mode);
-            s11n::load(p, stereo_mode_swap);
+            int stereo_mode = cmd.param.get_int();
+            bool stereo_mode_swap = cmd.param.get_bool();
             _params.stereo_mode = static_cast<parameters::stereo_mode_t>(stereo_mode);
             _params.stereo_mode_swap = stereo_mode_swap;
             parameters_changed = true;
@@ -878,80 +1234,80 @@ void player::receive_cmd(const command &cmd)
         /* notify when request is fulfilled */
         break;
     case command::adjust_contrast:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.contrast;
         _params.contrast = std::max(std::min(_params.contrast + param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::contrast, oldval, _params.contrast);
         break;
     case command::set_contrast:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.contrast;
         _params.contrast = std::max(std::min(param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::contrast, oldval, _params.contrast);
         break;
     case command::adjust_brightness:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.brightness;
         _params.brightness = std::max(std::min(_params.brightness + param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::brightness, oldval, _params.brightness);
         break;
     case command::set_brightness:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.brightness;
         _params.brightness = std::max(std::min(param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::brightness, oldval, _params.brightness);
         break;
     case command::adjust_hue:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.hue;
         _params.hue = std::max(std::min(_params.hue + param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::hue, oldval, _params.hue);
         break;
     case command::set_hue:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.hue;
         _params.hue = std::max(std::min(param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::hue, oldval, _params.hue);
         break;
     case command::adjust_saturation:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.saturation;
         _params.saturation = std::max(std::min(_params.saturation + param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::saturation, oldval, _params.saturation);
         break;
     case command::set_saturation:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.saturation;
         _params.saturation = std::max(std::min(param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::saturation, oldval, _params.saturation);
         break;
     case command::seek:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         _seek_request = param * 1e6f;
         /* notify when request is fulfilled */
         break;
     case command::set_pos:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         _set_pos_request = param;
         /* notify when request is fulfilled */
         break;
     case command::adjust_parallax:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.parallax;
         _params.parallax = std::max(std::min(_params.parallax + param, 1.0f), -1.0f);
         parameters_changed = true;
         notify(notification::parallax, oldval, _params.parallax);
         break;
     case command::set_parallax:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.parallax;
         _params.parallax = std::max(std::min(param, 1.0f), -1.0f);
         parameters_changed = true;
@@ -959,33 +1315,24 @@ void player::receive_cmd(const command &cmd)
         break;
     case command::set_crosstalk:
         {
-            float r, g, b;
-            std::ostringstream oldval, newval;
-            s11n::load(p, r);
-            s11n::load(p, g);
-            s11n::load(p, b);
-            s11n::save(oldval, _params.crosstalk_r);
-            s11n::save(oldval, _params.crosstalk_g);
-            s11n::save(oldval, _params.crosstalk_b);
-            _params.crosstalk_r = std::max(std::min(r, 1.0f), 0.0f);
-            _params.crosstalk_g = std::max(std::min(g, 1.0f), 0.0f);
-            _params.crosstalk_b = std::max(std::min(b, 1.0f), 0.0f);
-            s11n::save(newval, _params.crosstalk_r);
-            s11n::save(newval, _params.crosstalk_g);
-            s11n::save(newval, _params.crosstalk_b);
+            payload old_crosstalk(_params.crosstalk_r, _params.crosstalk_g, _params.crosstalk_b);
+            _params.crosstalk_r = std::max(std::min(cmd.param.get_float(0), 1.0f), 0.0f);
+            _params.crosstalk_g = std::max(std::min(cmd.param.get_float(1), 1.0f), 0.0f);
+            _params.crosstalk_b = std::max(std::min(cmd.param.get_float(2), 1.0f), 0.0f);
             parameters_changed = true;
-            notify(notification::crosstalk, oldval.str(), newval.str());
+            notify(notification::crosstalk, old_crosstalk,
+                    payload(_params.crosstalk_r, _params.crosstalk_g, _params.crosstalk_b));
         }
         break;
     case command::adjust_ghostbust:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.ghostbust;
         _params.ghostbust = std::max(std::min(_params.ghostbust + param, 1.0f), 0.0f);
         parameters_changed = true;
         notify(notification::ghostbust, oldval, _params.ghostbust);
         break;
     case command::set_ghostbust:
-        s11n::load(p, param);
+        param = cmd.param.get_float();
         oldval = _params.ghostbust;
         _params.ghostbust = std::max(std::min(param, 1.0f), 0.0f);
         parameters_changed = true;
@@ -995,7 +1342,7 @@ void player::receive_cmd(const command &cmd)
         {
             std::string old_file;
             old_file = _params.subtitles_font;
-            _params.subtitles_font = cmd.param;
+            _params.subtitles_font = cmd.param.get_string();
             parameters_changed = true;
             notify(notification::subtitles_font, old_file, _params.subtitles_font);
             break;
@@ -1003,15 +1350,15 @@ void player::receive_cmd(const command &cmd)
     case command::set_subtitles_encoding:
         {
             std::string old_val = _params.subtitles_encoding;
-            _params.subtitles_encoding = cmd.param;
+            _params.subtitles_encoding = cmd.param.get_string();
             parameters_changed = true;
             notify(notification::subtitles_encoding, old_val, _params.subtitles_encoding);
             break;
         }
     case command::set_subtitles_color:
         {
-            int val, old_val;
-            s11n::load(p, val);
+            int val = cmd.param.get_int();
+            int old_val;
             old_val = _params.subtitles_color;
             _params.subtitles_color = val & 0x00FFFFFF;
             parameters_changed = true;
@@ -1028,9 +1375,12 @@ void player::receive_cmd(const command &cmd)
 
 void player::notify(const notification &note)
 {
-    // Notify all controllers
+    // Queue the notification for all controllers; each controller receives
+    // it in its own thread
+    global_controllers_mutex.lock();
     for (size_t i = 0; i < global_controllers.size(); i++)
     {
-        global_controllers[i]->receive_notification(note);
+        global_controllers[i]->queue_notification(note);
     }
+    global_controllers_mutex.unlock();
 }
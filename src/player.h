@@ -25,8 +25,10 @@
 #include <vector>
 #include <string>
 
+#include "blob.h"
 #include "msg.h"
 #include "s11n.h"
+#include "thread.h"
 
 #include "controller.h"
 #include "media_data.h"
@@ -42,10 +44,12 @@ class player_init_data : public s11n
 public:
     msg::level_t log_level;                     // Level of log messages
     std::vector<std::string> urls;              // Input media objects
+    std::vector<std::vector<std::string> > playlist; // Further inputs to play after urls
     int video_stream;                           // Selected video stream
     int audio_stream;                           // Selected audio stream
     int subtitle_stream;                        // Selected subtitle stream
     bool benchmark;                             // Benchmark mode?
+    audio_output::buffering_t audio_buffering;  // Audio buffering mode
     bool fullscreen;                            // Make video fullscreen?
     bool center;                                // Center video on screen?
     bool stereo_layout_override;                // Manual input layout override?
@@ -65,6 +69,8 @@ public:
     void load(std::istream &is);
 };
 
+class playlist_loader;
+
 /*
  * The player class.
  *
@@ -90,6 +96,15 @@ private:
     audio_output *_audio_output;                // Audio output
     video_output *_video_output;                // Video output
 
+    /* Playlist handling. The next playlist item is opened and its first data is
+     * decoded in the background while the current item plays. */
+
+    player_init_data _init_data;                // The data that the player was opened with
+    size_t _playlist_index;                     // Index of the next playlist item
+    playlist_loader *_playlist_loader;          // Loader for the next playlist item, if any
+    video_frame _preroll_video_frame;           // First video frame of the next item
+    audio_blob _preroll_audio_blob;             // First audio blob of the next item
+
     /* Current state */
 
     // The current output parameters
@@ -108,6 +123,12 @@ private:
     bool _drop_next_frame;                      // Do we need to drop the next video frame (to catch up)?
     bool _previous_frame_dropped;               // Did we drop the previous video frame?
     bool _in_pause;                             // Are we in pause mode?
+    bool _audio_resync;                         // Does the next audio blob need to be aligned to _audio_end_pos?
+    blob _audio_resync_buffer;                  // Buffer for aligned audio data
+
+    // Commands sent by controllers, executed at the beginning of each step
+    mpsc_queue<command> _cmd_queue;             // The queued commands
+    std::vector<command> _cmds;                 // Commands taken from the queue
 
     // Requests made by controller commands
     bool _quit_request;                         // Request to quit
@@ -124,6 +145,7 @@ private:
     int64_t _current_pos;                       // Current input position
     int64_t _video_pos;                         // Presentation time of current video frame
     int64_t _audio_pos;                         // Presentation time of current audio blob
+    int64_t _audio_end_pos;                     // Presentation time of the end of current audio blob
     int64_t _master_time_start;                 // Master time offset
     int64_t _master_time_current;               // Current master time
     int64_t _master_time_pos;                   // Input position at master time start
@@ -136,12 +158,31 @@ private:
     // Set the current subtitle from the next subtitle
     void set_current_subtitle_box();
 
+    // Align an audio blob of a newly selected audio stream to the end of the
+    // previous audio data. Returns false if the blob has to be skipped completely.
+    bool align_audio_blob(audio_blob &blob);
+
+    // Continue playback with a newly selected audio or subtitle stream,
+    // without interrupting video
+    void continue_with_new_audio_stream();
+    void continue_with_new_subtitle_stream();
+
     // Reset the play state
     void reset_playstate();
 
     // Stop playback
     void stop_playback();
 
+    // Choose the stereo mode for the current input, unless it was overridden
+    void choose_stereo_mode();
+
+    // Start loading the next playlist item in the background, or cancel that
+    void start_playlist_loader();
+    void stop_playlist_loader();
+
+    // Switch to the next playlist item. Return false if there is none.
+    bool next_playlist_item();
+
 protected:
     // The current video frame and subtitle
     video_frame _video_frame;
@@ -152,6 +193,9 @@ protected:
     virtual video_output *create_video_output();
     virtual audio_output *create_audio_output();
 
+    // Open the media input (overridable by subclasses)
+    virtual void open_media_input(media_input *input, const std::vector<std::string> &urls);
+
     // Make this player the master player
     void make_master();
 
@@ -174,6 +218,7 @@ protected:
     void notify(enum notification::type t, int p, int c) { notify(notification(t, p, c)); }
     void notify(enum notification::type t, float p, float c) { notify(notification(t, p, c)); }
     void notify(enum notification::type t, const std::string &p, const std::string &c) { notify(notification(t, p, c)); }
+    void notify(enum notification::type t, const payload &p, const payload &c) { notify(notification(t, p, c)); }
 
 public:
     /* Constructor/destructor.
@@ -202,7 +247,16 @@ public:
     /* Close the player and clean up. */
     virtual void close();
 
-    /* Receive a command from a controller. */
+    /* Queue a command from a controller. This can be called from any thread.
+     * The command is executed at the beginning of the next step. */
+    void queue_cmd(const command &cmd);
+
+    /* Execute all queued commands. This is done at the beginning of each step;
+     * run loops that currently do not step the player call it directly. It
+     * must always be called from the same thread. */
+    void process_commands();
+
+    /* Execute a command from a controller. */
     virtual void receive_cmd(const command &cmd);
 };
 
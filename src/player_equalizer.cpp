@@ -22,13 +22,20 @@
 #include "config.h"
 
 #include <sstream>
+#include <vector>
+#include <cstring>
 #include <cmath>
+#include <algorithm>
+#include <limits>
 
 #include <eq/eq.h>
 
+#include "blob.h"
 #include "dbg.h"
 #include "msg.h"
 #include "s11n.h"
+#include "thread.h"
+#include "timer.h"
 
 #include "video_output.h"
 #include "player_equalizer.h"
@@ -49,6 +56,11 @@
  *
  * Each eq::Channel than calls the window's display function to render its subset of
  * the video.
+ *
+ * Normally, every node player reads the input itself. Alternatively, only the
+ * master player reads the input, and broadcasts the compressed video packets
+ * that it reads via the frame data. The node players then open their input from
+ * the stream descriptions in the init data, and only decode these packets.
  */
 
 
@@ -64,6 +76,44 @@ class player_eq_node : public player
 private:
     bool _is_master;
     bool _first_step;
+    const std::vector<std::string> *_stream_descriptions;
+    blob _frame_buffer;                         // Copy of the data of _video_frame (slave nodes)
+
+    // Copy the data of the given frame into our own buffer, because the
+    // decoder overwrites it when it decodes the next frame.
+    void copy_frame(const video_frame &frame)
+    {
+        size_t plane_sizes[2][3];
+        size_t size = 0;
+        for (int v = 0; v < 2; v++)
+        {
+            for (int p = 0; p < 3; p++)
+            {
+                int rows = frame.raw_height;
+                if (p != 0 && frame.layout == video_frame::yuv420p)
+                {
+                    rows = (rows + 1) / 2;
+                }
+                plane_sizes[v][p] = (frame.data[v][p] ? frame.line_size[v][p] * rows : 0);
+                size += plane_sizes[v][p];
+            }
+        }
+        _frame_buffer.resize(size);
+        _video_frame = frame;
+        size_t offset = 0;
+        for (int v = 0; v < 2; v++)
+        {
+            for (int p = 0; p < 3; p++)
+            {
+                if (plane_sizes[v][p] > 0)
+                {
+                    std::memcpy(_frame_buffer.ptr(offset), frame.data[v][p], plane_sizes[v][p]);
+                    _video_frame.data[v][p] = _frame_buffer.ptr(offset);
+                    offset += plane_sizes[v][p];
+                }
+            }
+        }
+    }
 
 protected:
     video_output *create_video_output()
@@ -78,8 +128,21 @@ protected:
         return _is_master ? new audio_output() : NULL;
     }
 
+    void open_media_input(media_input *input, const std::vector<std::string> &urls)
+    {
+        if (_stream_descriptions)
+        {
+            input->open(urls, *_stream_descriptions);
+        }
+        else
+        {
+            input->open(urls);
+        }
+    }
+
 public:
-    player_eq_node() : player(player::slave), _is_master(false), _first_step(true)
+    player_eq_node() : player(player::slave), _is_master(false), _first_step(true), _stream_descriptions(NULL),
+        _frame_buffer()
     {
     }
 
@@ -89,11 +152,16 @@ public:
         _is_master = true;
     }
 
-    bool init(const player_init_data &init_data, video_frame &frame_template)
+    // If stream descriptions are given, the input is not read; its packets
+    // must be imported instead.
+    bool init(const player_init_data &init_data, video_frame &frame_template,
+            const std::vector<std::string> *stream_descriptions = NULL)
     {
         try
         {
+            _stream_descriptions = stream_descriptions;
             player::open(init_data);
+            _stream_descriptions = NULL;
             frame_template = get_media_input().video_frame_template();
         }
         catch (std::exception &e)
@@ -104,6 +172,22 @@ public:
         return true;
     }
 
+    void start_packet_export(std::vector<std::string> &stream_descriptions)       // Only called on the master
+    {
+        stream_descriptions = get_media_input().stream_descriptions();
+        get_media_input_nonconst().set_packet_export(true);
+    }
+
+    void export_packets(std::vector<std::string> &packets)      // Only called on the master
+    {
+        get_media_input_nonconst().export_packets(packets);
+    }
+
+    void import_packets(const std::vector<std::string> &packets)        // Only called on slave nodes
+    {
+        get_media_input_nonconst().import_packets(packets);
+    }
+
     void seek(int64_t pos)
     {
         get_media_input_nonconst().seek(pos);
@@ -116,14 +200,22 @@ public:
         get_media_input_nonconst().start_video_frame_read();
     }
 
-    void finish_frame_read()    // Only called on slave nodes
+    // Get the frame that is currently read, and immediately start reading the
+    // next one, so that it is decoded while this one is uploaded and displayed.
+    // If keep is false, the frame is dropped. Only called on slave nodes.
+    void finish_frame_read(bool keep = true)
     {
-        _video_frame = get_media_input_nonconst().finish_video_frame_read();
-        if (!_video_frame.is_valid())
+        video_frame frame = get_media_input_nonconst().finish_video_frame_read();
+        if (!frame.is_valid())
         {
             msg::err("Reading input frame failed.");
             abort();
         }
+        if (keep)
+        {
+            copy_frame(frame);
+        }
+        start_frame_read();
     }
 
     void prepare_next_frame(video_output *vo)
@@ -239,6 +331,65 @@ static void exitErrors()
     }
 }
 
+/*
+ * eq_benchmark_stat
+ *
+ * In benchmark mode, the nodes measure the durations of the steps that
+ * determine the frame rate of a cluster, and report them every 100 frames,
+ * like the FPS output of the player.
+ */
+
+class eq_benchmark_stat
+{
+private:
+    std::string _name;
+    int _count;
+    int64_t _sum;
+    int64_t _min;
+    int64_t _max;
+
+public:
+    eq_benchmark_stat(const std::string &name) : _name(name)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        _count = 0;
+        _sum = 0;
+        _min = std::numeric_limits<int64_t>::max();
+        _max = 0;
+    }
+
+    // Add a duration, given by its start time (microseconds)
+    void add_since(int64_t start)
+    {
+        int64_t d = timer::get_microseconds(timer::monotonic) - start;
+        _count++;
+        _sum += d;
+        _min = std::min(_min, d);
+        _max = std::max(_max, d);
+    }
+
+    int count() const
+    {
+        return _count;
+    }
+
+    // Log the statistics and start anew
+    void report(const std::string &prefix)
+    {
+        if (_count > 0)
+        {
+            msg::inf("%s%s: avg %.3f ms, min %.3f ms, max %.3f ms (%d frames)",
+                    prefix.c_str(), _name.c_str(), _sum / 1e3f / _count,
+                    _min / 1e3f, _max / 1e3f, _count);
+        }
+        reset();
+    }
+};
+
 /*
  * eq_init_data
  */
@@ -250,8 +401,10 @@ public:
     player_init_data init_data;
     bool flat_screen;
     struct { float x, y, w, h, d; } canvas_video_area;
+    bool broadcast_packets;
+    std::vector<std::string> stream_descriptions;
 
-    eq_init_data() : init_data()
+    eq_init_data() : init_data(), broadcast_packets(false), stream_descriptions()
     {
         flat_screen = true;
         canvas_video_area.x = 0.0f;
@@ -273,33 +426,37 @@ protected:
 
     virtual void getInstanceData(co::DataOStream &os)
     {
-        std::ostringstream oss;
-        s11n::save(oss, frame_data_id.high());
-        s11n::save(oss, frame_data_id.low());
-        s11n::save(oss, init_data);
-        s11n::save(oss, flat_screen);
-        s11n::save(oss, canvas_video_area.x);
-        s11n::save(oss, canvas_video_area.y);
-        s11n::save(oss, canvas_video_area.w);
-        s11n::save(oss, canvas_video_area.h);
-        s11n::save(oss, canvas_video_area.d);
-        os << oss.str();
+        s11n::writer w;
+        s11n::save(w, frame_data_id.high());
+        s11n::save(w, frame_data_id.low());
+        s11n::save(w, init_data);
+        s11n::save(w, flat_screen);
+        s11n::save(w, canvas_video_area.x);
+        s11n::save(w, canvas_video_area.y);
+        s11n::save(w, canvas_video_area.w);
+        s11n::save(w, canvas_video_area.h);
+        s11n::save(w, canvas_video_area.d);
+        s11n::save(w, broadcast_packets);
+        s11n::save(w, stream_descriptions);
+        os << w.str();
     }
 
     virtual void applyInstanceData(co::DataIStream &is)
     {
         std::string s;
         is >> s;
-        std::istringstream iss(s);
-        s11n::load(iss, frame_data_id.high());
-        s11n::load(iss, frame_data_id.low());
-        s11n::load(iss, init_data);
-        s11n::load(iss, flat_screen);
-        s11n::load(iss, canvas_video_area.x);
-        s11n::load(iss, canvas_video_area.y);
-        s11n::load(iss, canvas_video_area.w);
-        s11n::load(iss, canvas_video_area.h);
-        s11n::load(iss, canvas_video_area.d);
+        s11n::reader r(s);
+        s11n::load(r, frame_data_id.high());
+        s11n::load(r, frame_data_id.low());
+        s11n::load(r, init_data);
+        s11n::load(r, flat_screen);
+        s11n::load(r, canvas_video_area.x);
+        s11n::load(r, canvas_video_area.y);
+        s11n::load(r, canvas_video_area.w);
+        s11n::load(r, canvas_video_area.h);
+        s11n::load(r, canvas_video_area.d);
+        s11n::load(r, broadcast_packets);
+        s11n::load(r, stream_descriptions);
     }
 };
 
@@ -315,11 +472,16 @@ public:
     bool prep_frame;
     bool drop_frame;
     bool display_frame;
+    std::vector<std::string> packets;   // Broadcast packets, one string per media object
+
+private:
+    s11n::writer _writer;               // Reused for every commit, to keep its memory
 
 public:
     eq_frame_data() :
         params(), seek_to(0),
-        prep_frame(false), drop_frame(false), display_frame(false)
+        prep_frame(false), drop_frame(false), display_frame(false),
+        packets(), _writer()
     {
     }
 
@@ -331,25 +493,27 @@ protected:
 
     virtual void getInstanceData(co::DataOStream &os)
     {
-        std::ostringstream oss;
-        s11n::save(oss, params);
-        s11n::save(oss, seek_to);
-        s11n::save(oss, prep_frame);
-        s11n::save(oss, drop_frame);
-        s11n::save(oss, display_frame);
-        os << oss.str();
+        _writer.clear();
+        s11n::save(_writer, params);
+        s11n::save(_writer, seek_to);
+        s11n::save(_writer, prep_frame);
+        s11n::save(_writer, drop_frame);
+        s11n::save(_writer, display_frame);
+        s11n::save(_writer, packets);
+        os << _writer.str();
     }
 
     virtual void applyInstanceData(co::DataIStream &is)
     {
         std::string s;
         is >> s;
-        std::istringstream iss(s);
-        s11n::load(iss, params);
-        s11n::load(iss, seek_to);
-        s11n::load(iss, prep_frame);
-        s11n::load(iss, drop_frame);
-        s11n::load(iss, display_frame);
+        s11n::reader r(s);
+        s11n::load(r, params);
+        s11n::load(r, seek_to);
+        s11n::load(r, prep_frame);
+        s11n::load(r, drop_frame);
+        s11n::load(r, display_frame);
+        s11n::load(r, packets);
     }
 };
 
@@ -365,6 +529,10 @@ private:
     eq_frame_data _eq_frame_data;       // Master eq_frame_data instance
     player_eq_node _player;             // Master player
     controller _controller;             // Sends commands to the player
+    int64_t _frame_start_time;          // Benchmark mode: start of the current frame
+    eq_benchmark_stat _stat_step;       // Benchmark mode: master player step (reading and decoding)
+    eq_benchmark_stat _stat_commit;     // Benchmark mode: frame data commit
+    eq_benchmark_stat _stat_frame;      // Benchmark mode: startFrame() to finishFrame() latency
 
 public:
     video_frame frame_template;         // Video frame properties
@@ -377,6 +545,10 @@ public:
         _eq_frame_data(),
         _player(),
         _controller(false),
+        _frame_start_time(0),
+        _stat_step("player step"),
+        _stat_commit("frame data commit"),
+        _stat_frame("frame latency"),
         frame_template()
     {
     }
@@ -386,7 +558,7 @@ public:
         return _is_master_config;
     }
 
-    bool init(const player_init_data &init_data, bool flat_screen)
+    bool init(const player_init_data &init_data, bool flat_screen, bool broadcast_packets)
     {
         msg::set_level(init_data.log_level);
         msg::dbg(HERE);
@@ -395,6 +567,7 @@ public:
         // Initialize master init/frame data instances
         _eq_init_data.init_data = init_data;
         _eq_init_data.flat_screen = flat_screen;
+        _eq_init_data.broadcast_packets = broadcast_packets;
         _eq_frame_data.params = _eq_init_data.init_data.params;
         // Initialize master player
         _player.make_master();
@@ -402,6 +575,10 @@ public:
         {
             return false;
         }
+        if (broadcast_packets)
+        {
+            _player.start_packet_export(_eq_init_data.stream_descriptions);
+        }
         // Find region of canvas to use, depending on the video aspect ratio
         if (getCanvases().size() < 1)
         {
@@ -466,22 +643,59 @@ public:
 
     virtual uint32_t startFrame()
     {
+        bool benchmark = _eq_init_data.init_data.benchmark;
+        if (benchmark)
+        {
+            _frame_start_time = timer::get_microseconds(timer::monotonic);
+        }
         // Run one player step to find out what to do
         bool more_steps;
         _player.step(&more_steps, &_eq_frame_data.seek_to,
                 &_eq_frame_data.prep_frame, &_eq_frame_data.drop_frame, &_eq_frame_data.display_frame);
+        if (benchmark)
+        {
+            _stat_step.add_since(_frame_start_time);
+        }
         if (!more_steps)
         {
             this->exit();
         }
         // Update the video state for all (it might have changed via handleEvent())
         _eq_frame_data.params = _player.get_parameters();
+        // Pass on the packets that the master player read in this step
+        if (_eq_init_data.broadcast_packets)
+        {
+            _player.export_packets(_eq_frame_data.packets);
+        }
         // Commit the updated frame data
+        int64_t commit_start_time = (benchmark ? timer::get_microseconds(timer::monotonic) : 0);
         const eq::uint128_t version = _eq_frame_data.commit();
+        if (benchmark)
+        {
+            _stat_commit.add_since(commit_start_time);
+        }
         // Start this frame with the committed frame data
         return eq::Config::startFrame(version);
     }
 
+    virtual uint32_t finishFrame()
+    {
+        uint32_t ret = eq::Config::finishFrame();
+        if (_eq_init_data.init_data.benchmark)
+        {
+            // With the default latency of one frame, this includes waiting for
+            // the render nodes to finish the previous frame.
+            _stat_frame.add_since(_frame_start_time);
+            if (_stat_frame.count() == 100)
+            {
+                _stat_step.report("Application node: ");
+                _stat_commit.report("Application node: ");
+                _stat_frame.report("Application node: ");
+            }
+        }
+        return ret;
+    }
+
     virtual bool handleEvent(const eq::ConfigEvent *event)
     {
         if (eq::Config::handleEvent(event))
@@ -664,6 +878,8 @@ class eq_node : public eq::Node
 private:
     bool _is_app_node;
     player_eq_node _player;
+    eq_benchmark_stat _stat_sync;       // Benchmark mode: frame data sync
+    eq_benchmark_stat _stat_decode;     // Benchmark mode: waiting for the decoded frame
 
 public:
     eq_init_data init_data;
@@ -674,6 +890,8 @@ public:
         eq::Node(parent),
         _is_app_node(false),
         _player(),
+        _stat_sync("frame data sync"),
+        _stat_decode("decoding"),
         init_data(),
         frame_data(),
         frame_template()
@@ -711,7 +929,8 @@ protected:
         // Create decoders and input
         if (!_is_app_node)
         {
-            if (!_player.init(init_data.init_data, frame_template))
+            if (!_player.init(init_data.init_data, frame_template,
+                        init_data.broadcast_packets ? &init_data.stream_descriptions : NULL))
             {
                 setError(ERROR_PLAYER_INIT_FAILED);
                 return false;
@@ -742,7 +961,13 @@ protected:
     virtual void frameStart(const eq::uint128_t &frame_id, const uint32_t frame_number)
     {
         // Update our frame data
+        int64_t sync_start_time = timer::get_microseconds(timer::monotonic);
         frame_data.sync(frame_id);
+        bool benchmark = init_data.init_data.benchmark;
+        if (benchmark)
+        {
+            _stat_sync.add_since(sync_start_time);
+        }
         // Do as we're told
         if (_is_app_node)
         {
@@ -750,39 +975,43 @@ protected:
         }
         else
         {
+            int64_t decode_start_time = timer::get_microseconds(timer::monotonic);
+            if (init_data.broadcast_packets)
+            {
+                // Packets read after a seek are kept back until we seek, too
+                _player.import_packets(frame_data.packets);
+            }
             if (frame_data.seek_to >= 0)
             {
                 _player.seek(frame_data.seek_to);
             }
+            // The frame reads follow the decisions of the master player exactly:
+            // there is always one outstanding read, which is finished here, and
+            // the next read is started right away. With Equalizer's default
+            // DRAW_SYNC node thread model, the previous frame was already
+            // uploaded, so its copy of the data can be replaced.
             if (frame_data.prep_frame)
             {
                 _player.finish_frame_read();
             }
             if (frame_data.drop_frame)
             {
-                _player.finish_frame_read();
-                _player.start_frame_read();
+                _player.finish_frame_read(false);
             }
-        }
-        startFrame(frame_number);
-    }
-
-    virtual void frameFinish(const eq::uint128_t &, const uint32_t frame_number)
-    {
-        if (_is_app_node)
-        {
-            // Nothing to do since the config's master player already did it
-        }
-        else
-        {
-            if (frame_data.prep_frame)
+            if (benchmark && (frame_data.prep_frame || frame_data.drop_frame))
             {
-                // The frame was uploaded to texture memory.
-                // Start reading the next one asynchronously.
-                _player.start_frame_read();
+                // Decoding runs asynchronously; this is the time that the node
+                // had to wait for it.
+                _stat_decode.add_since(decode_start_time);
             }
         }
-        releaseFrame(frame_number);
+        if (benchmark && _stat_sync.count() == 100)
+        {
+            std::string prefix = "Node " + (getName().empty() ? std::string("(unnamed)") : getName()) + ": ";
+            _stat_sync.report(prefix);
+            _stat_decode.report(prefix);
+        }
+        startFrame(frame_number);
     }
 
 public:
@@ -820,9 +1049,12 @@ class eq_window : public eq::Window
 {
 private:
     video_output_eq_window _video_output;
+    eq_window *_owner;          // the window of our pipe that uploads and converts the frames
+    bool _region_reported;      // whether a channel reported its region in the current frame
+    float _region[4];           // union of the regions of the video frame that the channels display
 
 public:
-    eq_window(eq::Pipe *parent) : eq::Window(parent), _video_output(this)
+    eq_window(eq::Pipe *parent) : eq::Window(parent), _video_output(this), _owner(this), _region_reported(false)
     {
     }
 
@@ -831,10 +1063,51 @@ public:
         _video_output.display_current_frame(mono_right_instead_of_left, x, y, w, h, viewport);
     }
 
+    /* Called by the channels of this window for every frame they draw, with the
+     * part of the video frame that they display (normalized coordinates). */
+    void add_region(float x, float y, float w, float h)
+    {
+        if (_owner != this)
+        {
+            _owner->add_region(x, y, w, h);
+        }
+        else if (!_region_reported)
+        {
+            _region[0] = x;
+            _region[1] = y;
+            _region[2] = w;
+            _region[3] = h;
+            _region_reported = true;
+        }
+        else
+        {
+            float x0 = std::min(_region[0], x);
+            float y0 = std::min(_region[1], y);
+            float x1 = std::max(_region[0] + _region[2], x + w);
+            float y1 = std::max(_region[1] + _region[3], y + h);
+            _region[0] = x0;
+            _region[1] = y0;
+            _region[2] = x1 - x0;
+            _region[3] = y1 - y0;
+        }
+    }
+
 protected:
+    virtual bool configInit(const eq::uint128_t &init_id)
+    {
+        // All windows of a pipe share the OpenGL objects of the first one, so
+        // that each frame is uploaded and color-converted only once per pipe.
+        const eq::Windows &windows = getPipe()->getWindows();
+        _owner = static_cast<eq_window *>(windows.front());
+        setSharedContextWindow(_owner);
+        return eq::Window::configInit(init_id);
+    }
+
     virtual bool configInitGL(const eq::uint128_t &init_id)
     {
         msg::dbg(HERE);
+        // This pipe thread presents the video frames
+        thread::apply_role(thread::render);
         if (!eq::Window::configInitGL(init_id))
         {
             return false;
@@ -850,6 +1123,11 @@ protected:
         // Disable some things that Equalizer seems to enable for some reason.
         glDisable(GL_LIGHTING);
 
+        if (_owner != this)
+        {
+            _video_output.set_color_source(&(_owner->_video_output));
+        }
+
         msg::dbg(HERE);
         return true;
     }
@@ -867,6 +1145,19 @@ protected:
         // Get frame data via from the node
         eq_node *node = static_cast<eq_node *>(getNode());
         _video_output.set_parameters(node->frame_data.params);
+        if (_owner != this)
+        {
+            // The owner prepares the frames for us
+            startFrame(frame_number);
+            return;
+        }
+        // Only upload the part of the video frame that our channels displayed
+        // in the last frame. Until they have reported, the full frame is used.
+        if (_region_reported)
+        {
+            _video_output.set_frame_region(_region[0], _region[1], _region[2], _region[3]);
+            _region_reported = false;
+        }
         // Do as we're told
         if (node->frame_data.prep_frame)
         {
@@ -920,8 +1211,19 @@ protected:
         float quad_y = canvas_video_area.y;
         float quad_w = canvas_video_area.w;
         float quad_h = canvas_video_area.h;
+        eq_window *window = static_cast<eq_window *>(getWindow());
         if (node->init_data.flat_screen)
         {
+            // Tell the window which part of the video frame this channel shows
+            float region_x0 = std::max(canvas_video_area.x, canvas_channel_area.x);
+            float region_y0 = std::max(canvas_video_area.y, canvas_channel_area.y);
+            float region_x1 = std::min(canvas_video_area.x + canvas_video_area.w, canvas_channel_area.x + canvas_channel_area.w);
+            float region_y1 = std::min(canvas_video_area.y + canvas_video_area.h, canvas_channel_area.y + canvas_channel_area.h);
+            window->add_region(
+                    (region_x0 - canvas_video_area.x) / canvas_video_area.w,
+                    (region_y0 - canvas_video_area.y) / canvas_video_area.h,
+                    std::max(region_x1 - region_x0, 0.0f) / canvas_video_area.w,
+                    std::max(region_y1 - region_y0, 0.0f) / canvas_video_area.h);
             quad_x = ((quad_x - canvas_channel_area.x) / canvas_channel_area.w - 0.5f) * 2.0f;
             quad_y = ((quad_y - canvas_channel_area.y) / canvas_channel_area.h - 0.5f) * 2.0f;
             quad_w = 2.0f * quad_w / canvas_channel_area.w;
@@ -933,13 +1235,14 @@ protected:
         }
         else
         {
+            // With a 3D setup, any part of the video frame may be visible
+            window->add_region(0.0f, 0.0f, 1.0f, 1.0f);
             glTranslatef(0.0f, 0.0f, -canvas_video_area.d);
         }
 
         // Display
         glEnable(GL_TEXTURE_2D);
         glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-        eq_window *window = static_cast<eq_window *>(getWindow());
         bool mono_right_instead_of_left = (getEye() == eq::EYE_RIGHT);
         GLint viewport[4];
         glGetIntegerv(GL_VIEWPORT, viewport);
@@ -984,8 +1287,8 @@ public:
  * player_equalizer
  */
 
-player_equalizer::player_equalizer(int *argc, char *argv[], bool flat_screen) :
-    player(player::slave), _flat_screen(flat_screen)
+player_equalizer::player_equalizer(int *argc, char *argv[], bool flat_screen, bool broadcast_packets) :
+    player(player::slave), _flat_screen(flat_screen), _broadcast_packets(broadcast_packets)
 {
     /* Initialize Equalizer */
     initErrors();
@@ -1012,7 +1315,7 @@ player_equalizer::~player_equalizer()
 void player_equalizer::open(const player_init_data &init_data)
 {
     eq_config *config = static_cast<eq_config *>(_config);
-    if (!config->init(init_data, _flat_screen))
+    if (!config->init(init_data, _flat_screen, _broadcast_packets))
     {
         throw exc("Equalizer configuration initialization failed.");
     }
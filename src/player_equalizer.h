@@ -34,9 +34,12 @@ private:
     void *_node_factory;
     void *_config;
     bool _flat_screen;
+    bool _broadcast_packets;
 
 public:
-    player_equalizer(int *argc, char *argv[], bool flat_screen);
+    /* If broadcast_packets is set, only the application node reads the input,
+     * and the render nodes decode the packets that it sends to them. */
+    player_equalizer(int *argc, char *argv[], bool flat_screen, bool broadcast_packets = false);
     virtual ~player_equalizer();
 
     virtual void open(const player_init_data &init_data);
@@ -51,6 +51,10 @@
 #include <QFileDialog>
 #include <QColorDialog>
 #include <QTextCodec>
+#include <QImage>
+#include <QPixmap>
+#include <QStyle>
+#include <QMouseEvent>
 
 #include "player_qt.h"
 #include "qt_app.h"
@@ -92,8 +96,7 @@ void player_qt_internal::receive_notification(const notification &note)
 {
     if (note.type == notification::play)
     {
-        std::istringstream iss(note.current);
-        s11n::load(iss, _playing);
+        _playing = note.current.get_bool();
     }
 }
 
@@ -110,6 +113,8 @@ bool player_qt_internal::playloop_step()
 void player_qt_internal::force_stop()
 {
     notify(notification::play, false, false);
+    // The callers rely on the stop being complete
+    controller::process_notifications();
 }
 
 void player_qt_internal::move_event()
@@ -398,10 +403,7 @@ void in_out_widget::input_changed()
     {
         _video_combobox->setEnabled(true);
     }
-    std::ostringstream oss;
-    s11n::save(oss, static_cast<int>(stereo_layout));
-    s11n::save(oss, stereo_layout_swap);
-    send_cmd(command::set_stereo_layout, oss.str());
+    send_cmd(command(command::set_stereo_layout, static_cast<int>(stereo_layout), stereo_layout_swap));
     parameters::stereo_mode_t stereo_mode;
     bool stereo_mode_swap;
     get_stereo_mode(stereo_mode, stereo_mode_swap);
@@ -426,10 +428,7 @@ void in_out_widget::output_changed()
     parameters::stereo_mode_t stereo_mode;
     bool stereo_mode_swap;
     get_stereo_mode(stereo_mode, stereo_mode_swap);
-    std::ostringstream oss;
-    s11n::save(oss, static_cast<int>(stereo_mode));
-    s11n::save(oss, stereo_mode_swap);
-    send_cmd(command::set_stereo_mode, oss.str());
+    send_cmd(command(command::set_stereo_mode, static_cast<int>(stereo_mode), stereo_mode_swap));
 }
 
 void in_out_widget::swap_changed()
@@ -651,32 +650,31 @@ void in_out_widget::get_stereo_mode(parameters::stereo_mode_t &stereo_mode, bool
 
 void in_out_widget::receive_notification(const notification &note)
 {
-    std::istringstream current(note.current);
     int stream;
     bool flag;
 
     switch (note.type)
     {
     case notification::video_stream:
-        s11n::load(current, stream);
+        stream = note.current.get_int();
         _lock = true;
         _video_combobox->setCurrentIndex(stream);
         _lock = false;
         break;
     case notification::audio_stream:
-        s11n::load(current, stream);
+        stream = note.current.get_int();
         _lock = true;
         _audio_combobox->setCurrentIndex(stream);
         _lock = false;
         break;
     case notification::subtitles_stream:
-        s11n::load(current, stream);
+        stream = note.current.get_int();
         _lock = true;
         _subtitles_combobox->setCurrentIndex(stream);
         _lock = false;
         break;
     case notification::stereo_mode_swap:
-        s11n::load(current, flag);
+        flag = note.current.get_bool();
         _lock = true;
         _swap_checkbox->setChecked(flag);
         _lock = false;
@@ -688,7 +686,8 @@ void in_out_widget::receive_notification(const notification &note)
 
 
 controls_widget::controls_widget(QSettings *settings, QWidget *parent)
-    : QWidget(parent), _lock(false), _settings(settings), _playing(false)
+    : QWidget(parent), _lock(false), _settings(settings), _playing(false),
+    _thumbnailer(NULL), _thumbnailer_video_stream(-1)
 {
     QGridLayout *layout = new QGridLayout;
     _seek_slider = new QSlider(Qt::Horizontal);
@@ -698,6 +697,14 @@ controls_widget::controls_widget(QSettings *settings, QWidget *parent)
     _seek_slider->setRange(0, 2000);
     _seek_slider->setTracking(false);
     connect(_seek_slider, SIGNAL(valueChanged(int)), this, SLOT(seek_slider_changed()));
+    connect(_seek_slider, SIGNAL(sliderMoved(int)), this, SLOT(seek_slider_moved(int)));
+    // Show thumbnails when the mouse hovers over the slider or drags it
+    _seek_slider->setMouseTracking(true);
+    _seek_slider->installEventFilter(this);
+    _thumbnail_label = new QLabel(this, Qt::ToolTip);
+    _thumbnail_label->hide();
+    _thumbnailer_reaper = new QTimer(this);
+    connect(_thumbnailer_reaper, SIGNAL(timeout()), this, SLOT(reap_thumbnailers()));
     layout->addWidget(_seek_slider, 0, 0, 1, 13);
     _play_button = new QPushButton(QIcon(":icons/play.png"), "");
     _play_button->setToolTip("<p>Play.</p>");
@@ -769,6 +776,95 @@ controls_widget::controls_widget(QSettings *settings, QWidget *parent)
 
 controls_widget::~controls_widget()
 {
+    stop_thumbnailer();
+    // The thumbnailers must not outlive the application, so wait for them here.
+    // They check for the stop request after each packet, so this does not take
+    // long even though they run with the lowest priority.
+    for (size_t i = 0; i < _stopping_thumbnailers.size(); i++)
+    {
+        try { _stopping_thumbnailers[i]->finish(); } catch (...) {}
+        delete _stopping_thumbnailers[i];
+    }
+    _stopping_thumbnailers.clear();
+}
+
+void controls_widget::stop_thumbnailer()
+{
+    // Do not wait for the thumbnailer here: it runs with the lowest priority,
+    // so waiting could block the GUI for a long time if the system is busy.
+    if (_thumbnailer)
+    {
+        _thumbnailer->request_stop();
+        _stopping_thumbnailers.push_back(_thumbnailer);
+        _thumbnailer = NULL;
+        if (!_thumbnailer_reaper->isActive())
+        {
+            _thumbnailer_reaper->start(100);
+        }
+    }
+}
+
+void controls_widget::reap_thumbnailers()
+{
+    for (size_t i = 0; i < _stopping_thumbnailers.size(); i++)
+    {
+        if (!_stopping_thumbnailers[i]->is_running())
+        {
+            delete _stopping_thumbnailers[i];
+            _stopping_thumbnailers.erase(_stopping_thumbnailers.begin() + i);
+            i--;
+        }
+    }
+    if (_stopping_thumbnailers.empty())
+    {
+        _thumbnailer_reaper->stop();
+    }
+}
+
+void controls_widget::show_thumbnail(int slider_value, int slider_x)
+{
+    thumbnailer::thumbnail t;
+    if (!_thumbnailer || !_seek_slider->isEnabled()
+            || !_thumbnailer->get(static_cast<float>(slider_value) / 2000.0f, t))
+    {
+        hide_thumbnail();
+        return;
+    }
+    // The thumbnail data is in BGRA layout, which is QImage::Format_RGB32 on
+    // little endian systems.
+    QImage img(&(t.data[0]), t.width, t.height, t.width * 4, QImage::Format_RGB32);
+    int h = t.height;
+    int w = std::max(static_cast<int>(h * t.aspect_ratio + 0.5f), 1);
+    _thumbnail_label->setPixmap(QPixmap::fromImage(img.scaled(w, h,
+                    Qt::IgnoreAspectRatio, Qt::SmoothTransformation)));
+    _thumbnail_label->resize(_thumbnail_label->sizeHint());
+    QPoint p = _seek_slider->mapToGlobal(QPoint(slider_x, 0));
+    _thumbnail_label->move(p.x() - _thumbnail_label->width() / 2, p.y() - _thumbnail_label->height() - 4);
+    _thumbnail_label->show();
+}
+
+void controls_widget::hide_thumbnail()
+{
+    _thumbnail_label->hide();
+}
+
+bool controls_widget::eventFilter(QObject *obj, QEvent *event)
+{
+    if (obj == _seek_slider)
+    {
+        if (event->type() == QEvent::MouseMove && !_seek_slider->isSliderDown())
+        {
+            int x = static_cast<QMouseEvent *>(event)->x();
+            show_thumbnail(QStyle::sliderValueFromPosition(_seek_slider->minimum(), _seek_slider->maximum(),
+                        x, _seek_slider->width()), x);
+        }
+        else if (event->type() == QEvent::Leave || event->type() == QEvent::MouseButtonRelease)
+        {
+            hide_thumbnail();
+        }
+    }
+    // pass the event on to the parent class
+    return QWidget::eventFilter(obj, event);
 }
 
 void controls_widget::play_pressed()
@@ -833,6 +929,12 @@ void controls_widget::fff_pressed()
     send_cmd(command::seek, +600.0f);
 }
 
+void controls_widget::seek_slider_moved(int value)
+{
+    show_thumbnail(value, QStyle::sliderPositionFromValue(_seek_slider->minimum(), _seek_slider->maximum(),
+                value, _seek_slider->width()));
+}
+
 void controls_widget::seek_slider_changed()
 {
     if (!_lock)
@@ -841,14 +943,26 @@ void controls_widget::seek_slider_changed()
     }
 }
 
-void controls_widget::update(const player_init_data &, bool have_valid_input, bool playing)
+void controls_widget::update(const player_init_data &init_data, bool have_valid_input, bool playing)
 {
     if (have_valid_input)
     {
         receive_notification(notification(notification::play, !playing, playing));
+        if (!_thumbnailer || init_data.urls != _thumbnailer_urls
+                || init_data.video_stream != _thumbnailer_video_stream)
+        {
+            stop_thumbnailer();
+            _thumbnailer = new thumbnailer(init_data.urls, init_data.video_stream,
+                    init_data.stereo_layout_override, init_data.stereo_layout, init_data.stereo_layout_swap);
+            _thumbnailer_urls = init_data.urls;
+            _thumbnailer_video_stream = init_data.video_stream;
+            _thumbnailer->start();
+        }
     }
     else
     {
+        stop_thumbnailer();
+        hide_thumbnail();
         _playing = false;
         _play_button->setEnabled(false);
         _pause_button->setEnabled(false);
@@ -868,14 +982,13 @@ void controls_widget::update(const player_init_data &, bool have_valid_input, bo
 
 void controls_widget::receive_notification(const notification &note)
 {
-    std::istringstream current(note.current);
     bool flag;
     float value;
 
     switch (note.type)
     {
     case notification::play:
-        s11n::load(current, flag);
+        flag = note.current.get_bool();
         _playing = flag;
         _play_button->setEnabled(!flag);
         _pause_button->setEnabled(flag);
@@ -892,10 +1005,11 @@ void controls_widget::receive_notification(const notification &note)
         if (!flag)
         {
             _seek_slider->setValue(0);
+            hide_thumbnail();
         }
         break;
     case notification::pause:
-        s11n::load(current, flag);
+        flag = note.current.get_bool();
         _play_button->setEnabled(flag);
         _pause_button->setEnabled(!flag);
         break;
@@ -903,7 +1017,7 @@ void controls_widget::receive_notification(const notification &note)
         if (!_seek_slider->isSliderDown())
         {
             _lock = true;
-            s11n::load(current, value);
+            value = note.current.get_float();
             _seek_slider->setValue(qRound(value * 2000.0f));
             _lock = false;
         }
@@ -1046,34 +1160,33 @@ void color_dialog::s_spinbox_changed(double val)
 
 void color_dialog::receive_notification(const notification &note)
 {
-    std::istringstream current(note.current);
     float value;
 
     switch (note.type)
     {
     case notification::contrast:
-        s11n::load(current, value);
+        value = note.current.get_float();
         _lock = true;
         _c_slider->setValue(value * 1000.0f);
         _c_spinbox->setValue(value);
         _lock = false;
         break;
     case notification::brightness:
-        s11n::load(current, value);
+        value = note.current.get_float();
         _lock = true;
         _b_slider->setValue(value * 1000.0f);
         _b_spinbox->setValue(value);
         _lock = false;
         break;
     case notification::hue:
-        s11n::load(current, value);
+        value = note.current.get_float();
         _lock = true;
         _h_slider->setValue(value * 1000.0f);
         _h_spinbox->setValue(value);
         _lock = false;
         break;
     case notification::saturation:
-        s11n::load(current, value);
+        value = note.current.get_float();
         _lock = true;
         _s_slider->setValue(value * 1000.0f);
         _s_spinbox->setValue(value);
@@ -1134,11 +1247,10 @@ void crosstalk_dialog::spinbox_changed()
 {
     if (!_lock)
     {
-        std::ostringstream v;
-        s11n::save(v, static_cast<float>(_r_spinbox->value()));
-        s11n::save(v, static_cast<float>(_g_spinbox->value()));
-        s11n::save(v, static_cast<float>(_b_spinbox->value()));
-        send_cmd(command::set_crosstalk, v.str());
+        send_cmd(command(command::set_crosstalk,
+                    static_cast<float>(_r_spinbox->value()),
+                    static_cast<float>(_g_spinbox->value()),
+                    static_cast<float>(_b_spinbox->value())));
         /* Also set crosstalk levels in init data, because this must also work in
          * the absence of a player that interpretes the above command (i.e. when
          * no video is currently playing */
@@ -1150,15 +1262,14 @@ void crosstalk_dialog::spinbox_changed()
 
 void crosstalk_dialog::receive_notification(const notification &note)
 {
-    std::istringstream current(note.current);
     float r, g, b;
 
     switch (note.type)
     {
     case notification::crosstalk:
-        s11n::load(current, r);
-        s11n::load(current, g);
-        s11n::load(current, b);
+        r = note.current.get_float(0);
+        g = note.current.get_float(1);
+        b = note.current.get_float(2);
         _lock = true;
         _r_spinbox->setValue(r);
         _g_spinbox->setValue(g);
@@ -1256,20 +1367,19 @@ void stereoscopic_dialog::g_spinbox_changed(double val)
 
 void stereoscopic_dialog::receive_notification(const notification &note)
 {
-    std::istringstream current(note.current);
     float value;
 
     switch (note.type)
     {
     case notification::parallax:
-        s11n::load(current, value);
+        value = note.current.get_float();
         _lock = true;
         _p_slider->setValue(value * 1000.0f);
         _p_spinbox->setValue(value);
         _lock = false;
         break;
     case notification::ghostbust:
-        s11n::load(current, value);
+        value = note.current.get_float();
         _lock = true;
         _g_slider->setValue(value * 1000.0f);
         _g_spinbox->setValue(value);
@@ -1407,17 +1517,16 @@ void subtitles_dialog::find_codecs()
 
 void subtitles_dialog::receive_notification(const notification &note)
 {
-   std::istringstream current(note.current);
    int value;
    std::string s_value;
    
    switch (note.type)
    {
       case notification::subtitles_font:
-         _font_label->setText(note.current.c_str());
+         _font_label->setText(note.current.get_string().c_str());
          break;
       case notification::subtitles_color:
-         s11n::load(current, value);
+         value = note.current.get_int();
          _lock = true;
          set_font_color(value);
          _lock = false;
@@ -1498,6 +1607,11 @@ main_window::main_window(QSettings *settings, const player_init_data &init_data)
     _player = new player_qt_internal(_init_data.benchmark, _video_container_widget);
     _timer = new QTimer(this);
     connect(_timer, SIGNAL(timeout()), this, SLOT(playloop_step()));
+    // While the play loop is not running, commands and notifications are
+    // processed by this timer
+    _idle_timer = new QTimer(this);
+    connect(_idle_timer, SIGNAL(timeout()), this, SLOT(idle_step()));
+    _idle_timer->start(20);
     _in_out_widget = new in_out_widget(_settings, _player, central_widget);
     layout->addWidget(_in_out_widget, 1, 0);
     _controls_widget = new controls_widget(_settings, central_widget);
@@ -1577,6 +1691,8 @@ main_window::main_window(QSettings *settings, const player_init_data &init_data)
         }
         open(urls);
     }
+    // A playlist only applies to the initial input, not to files opened later
+    _init_data_template.playlist.clear();
 }
 
 main_window::~main_window()
@@ -1613,13 +1729,12 @@ bool main_window::open_player()
 
 void main_window::receive_notification(const notification &note)
 {
-    std::istringstream current(note.current);
     bool flag;
 
     switch (note.type)
     {
     case notification::play:
-        s11n::load(current, flag);
+        flag = note.current.get_bool();
         if (flag)
         {
             // Close and re-open the player. This resets the video state in case
@@ -1658,80 +1773,80 @@ void main_window::receive_notification(const notification &note)
         break;
 
     case notification::video_stream:
-        s11n::load(current, _init_data.video_stream);
+        _init_data.video_stream = note.current.get_int();
         _settings->beginGroup("Video/" + current_file_hash());
         _settings->setValue("video-stream", QVariant(_init_data.video_stream).toString());
         _settings->endGroup();
         break;
 
     case notification::audio_stream:
-        s11n::load(current, _init_data.audio_stream);
+        _init_data.audio_stream = note.current.get_int();
         _settings->beginGroup("Video/" + current_file_hash());
         _settings->setValue("audio-stream", QVariant(_init_data.audio_stream).toString());
         _settings->endGroup();
         break;
         
     case notification::subtitles_stream:
-        s11n::load(current, _init_data.subtitle_stream);
+        _init_data.subtitle_stream = note.current.get_int();
         _settings->beginGroup("Video/" + current_file_hash());
         _settings->setValue("subtitles-stream", QVariant(_init_data.subtitle_stream).toString());
         _settings->endGroup();
         break;
 
     case notification::contrast:
-        s11n::load(current, _init_data.params.contrast);
+        _init_data.params.contrast = note.current.get_float();
         break;
 
     case notification::brightness:
-        s11n::load(current, _init_data.params.brightness);
+        _init_data.params.brightness = note.current.get_float();
         break;
 
     case notification::hue:
-        s11n::load(current, _init_data.params.hue);
+        _init_data.params.hue = note.current.get_float();
         break;
 
     case notification::saturation:
-        s11n::load(current, _init_data.params.saturation);
+        _init_data.params.saturation = note.current.get_float();
         break;
 
     case notification::stereo_mode_swap:
-        s11n::load(current, _init_data.params.stereo_mode_swap);
+        _init_data.params.stereo_mode_swap = note.current.get_bool();
         // TODO: save this is Session/?d-stereo-mode?
         break;
 
     case notification::parallax:
-        s11n::load(current, _init_data.params.parallax);
+        _init_data.params.parallax = note.current.get_float();
         _settings->beginGroup("Video/" + current_file_hash());
         _settings->setValue("parallax", QVariant(_init_data.params.parallax).toString());
         _settings->endGroup();
         break;
 
     case notification::crosstalk:
-        s11n::load(current, _init_data.params.crosstalk_r);
-        s11n::load(current, _init_data.params.crosstalk_g);
-        s11n::load(current, _init_data.params.crosstalk_b);
+        _init_data.params.crosstalk_r = note.current.get_float(0);
+        _init_data.params.crosstalk_g = note.current.get_float(1);
+        _init_data.params.crosstalk_b = note.current.get_float(2);
         break;
 
     case notification::ghostbust:
-        s11n::load(current, _init_data.params.ghostbust);
+        _init_data.params.ghostbust = note.current.get_float();
         _settings->beginGroup("Video/" + current_file_hash());
         _settings->setValue("ghostbust", QVariant(_init_data.params.ghostbust).toString());
         _settings->endGroup();
         break;
         
     case notification::subtitles_color:
-        s11n::load(current, _init_data.params.subtitles_color);
+        _init_data.params.subtitles_color = note.current.get_int();
         _settings->beginGroup("Video/" + current_file_hash());
         _settings->setValue("subtitles_color", QVariant(_init_data.params.subtitles_color).toString());
         _settings->endGroup();
         break;
        
     case notification::subtitles_font:
-        _init_data.params.subtitles_font = note.current;
+        _init_data.params.subtitles_font = note.current.get_string();
         break;
        
     case notification::subtitles_encoding:
-        _init_data.params.subtitles_encoding = note.current;
+        _init_data.params.subtitles_encoding = note.current.get_string();
         _settings->beginGroup("Video/" + current_file_hash());
         _settings->setValue("subtitles_encoding", QVariant(_init_data.params.subtitles_encoding.c_str()).toString());
         _settings->endGroup();
@@ -1852,6 +1967,15 @@ void main_window::playloop_step()
     }
 }
 
+void main_window::idle_step()
+{
+    if (!_timer->isActive())
+    {
+        _player->process_commands();
+        controller::process_notifications();
+    }
+}
+
 void main_window::open(QStringList filenames)
 {
     _player->force_stop();
@@ -39,6 +39,7 @@
 #include "controller.h"
 #include "video_output_qt.h"
 #include "player.h"
+#include "thumbnailer.h"
 #include <QColorDialog>
 
 
@@ -128,6 +129,16 @@ private:
     QPushButton *_fff_button;
     QSlider *_seek_slider;
     bool _playing;
+    thumbnailer *_thumbnailer;
+    std::vector<std::string> _thumbnailer_urls;
+    int _thumbnailer_video_stream;
+    std::vector<thumbnailer *> _stopping_thumbnailers;  // Requested to stop, but still running
+    QTimer *_thumbnailer_reaper;                        // Destroys stopped thumbnailers
+    QLabel *_thumbnail_label;
+
+    void show_thumbnail(int slider_value, int slider_x);
+    void hide_thumbnail();
+    void stop_thumbnailer();
 
 private slots:
     void play_pressed();
@@ -142,6 +153,11 @@ private slots:
     void ff_pressed();
     void fff_pressed();
     void seek_slider_changed();
+    void seek_slider_moved(int value);
+    void reap_thumbnailers();
+
+protected:
+    bool eventFilter(QObject *obj, QEvent *event);
 
 public:
     controls_widget(QSettings *settings, QWidget *parent);
@@ -272,6 +288,7 @@ private:
     subtitles_dialog *_subtitles_dialog;
     player_qt_internal *_player;
     QTimer *_timer;
+    QTimer *_idle_timer;
     player_init_data _init_data;
     const player_init_data _init_data_template;
     bool _stop_request;
@@ -283,6 +300,7 @@ private:
 private slots:
     void move_event();
     void playloop_step();
+    void idle_step();
     void file_open();
     void file_open_url();
     void preferences_colors();
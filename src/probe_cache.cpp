@@ -0,0 +1,198 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "msg.h"
+#include "str.h"
+
+#include "probe_cache.h"
+
+
+// Entries larger than this are considered broken
+static const size_t max_entry_size = 1024 * 1024;
+
+// Get the directory that holds the cache entries, or an empty string
+static std::string cache_dir()
+{
+    const char *s;
+#ifdef _WIN32
+    if ((s = std::getenv("LOCALAPPDATA")) || (s = std::getenv("APPDATA")))
+    {
+        return std::string(s) + "\\bino\\probe-cache";
+    }
+#else
+    if ((s = std::getenv("XDG_CACHE_HOME")) && s[0] == '/')
+    {
+        return std::string(s) + "/bino/probe-cache";
+    }
+    if ((s = std::getenv("HOME")) && s[0] == '/')
+    {
+        return std::string(s) + "/.cache/bino/probe-cache";
+    }
+#endif
+    return std::string();
+}
+
+// Create a directory and its parents. Errors are detected later when writing.
+static void make_dirs(const std::string &dir)
+{
+    for (size_t i = 1; i <= dir.length(); i++)
+    {
+        if (i == dir.length() || dir[i] == '/' || dir[i] == '\\')
+        {
+            std::string d = dir.substr(0, i);
+#ifdef _WIN32
+            (void)mkdir(d.c_str());
+#else
+            (void)mkdir(d.c_str(), 0777);
+#endif
+        }
+    }
+}
+
+// Get the file name of the entry and the key for an URL. Returns false if the
+// URL does not refer to a local file.
+static bool entry_name_and_key(const std::string &url, std::string &entry_name, std::string &key)
+{
+    std::string path = url;
+    if (path.compare(0, 5, "file:") == 0)
+    {
+        path = path.substr(5);
+    }
+    struct stat st;
+    if (path.empty() || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return false;
+    }
+#ifdef _WIN32
+    bool absolute = (path.length() > 1 && path[1] == ':') || path[0] == '\\' || path[0] == '/';
+#else
+    bool absolute = (path[0] == '/');
+#endif
+    if (!absolute)
+    {
+        char cwd[4096];
+        if (!getcwd(cwd, sizeof(cwd)))
+        {
+            return false;
+        }
+        path = std::string(cwd) + "/" + path;
+    }
+    std::string dir = cache_dir();
+    if (dir.empty())
+    {
+        return false;
+    }
+    // The entry file is named after a hash (64 bit FNV-1a) of the path.
+    // Collisions are harmless since the key is stored in the entry.
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < path.length(); i++)
+    {
+        hash ^= static_cast<unsigned char>(path[i]);
+        hash *= 1099511628211ULL;
+    }
+    entry_name = dir + "/" + str::asprintf("%016llx", static_cast<unsigned long long>(hash));
+    key = path + '\n'
+        + str::from(static_cast<long long>(st.st_size)) + '\n'
+        + str::from(static_cast<long long>(st.st_mtime));
+    return true;
+}
+
+bool probe_cache::get(const std::string &url, const std::string &version, std::string &data)
+{
+    std::string entry_name, key;
+    if (!entry_name_and_key(url, entry_name, key))
+    {
+        return false;
+    }
+    std::ifstream f(entry_name.c_str(), std::ios::in | std::ios::binary);
+    if (!f)
+    {
+        return false;
+    }
+    // The entry is key, version, and data, separated by null bytes
+    std::ostringstream oss;
+    oss << f.rdbuf();
+    std::string entry = oss.str();
+    if (entry.length() > max_entry_size)
+    {
+        return false;
+    }
+    size_t key_end = entry.find('\0');
+    size_t version_end = (key_end == std::string::npos ? key_end : entry.find('\0', key_end + 1));
+    if (version_end == std::string::npos
+            || entry.compare(0, key_end, key) != 0
+            || entry.compare(key_end + 1, version_end - key_end - 1, version) != 0)
+    {
+        msg::dbg(url + ": No valid probe cache entry.");
+        return false;
+    }
+    data = entry.substr(version_end + 1);
+    msg::dbg(url + ": Using probe cache entry " + entry_name + ".");
+    return true;
+}
+
+void probe_cache::put(const std::string &url, const std::string &version, const std::string &data)
+{
+    std::string entry_name, key;
+    if (!entry_name_and_key(url, entry_name, key) || data.length() > max_entry_size)
+    {
+        return;
+    }
+    make_dirs(cache_dir());
+    // Write to a temporary file first so that concurrent readers never see
+    // a partial entry.
+    std::string tmp_name = entry_name + "." + str::from(static_cast<int>(getpid())) + ".tmp";
+    std::ofstream f(tmp_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    f << key << '\0' << version << '\0' << data;
+    f.close();
+    if (!f)
+    {
+        (void)std::remove(tmp_name.c_str());
+        msg::dbg(url + ": Cannot write probe cache entry " + entry_name + ".");
+        return;
+    }
+#ifdef _WIN32
+    (void)std::remove(entry_name.c_str());
+#endif
+    if (std::rename(tmp_name.c_str(), entry_name.c_str()) != 0)
+    {
+        (void)std::remove(tmp_name.c_str());
+    }
+}
+
+void probe_cache::remove(const std::string &url)
+{
+    std::string entry_name, key;
+    if (entry_name_and_key(url, entry_name, key))
+    {
+        (void)std::remove(entry_name.c_str());
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#include <string>
+
+
+/*
+ * A persistent cache for stream information, so that known files can be
+ * opened without probing them again.
+ *
+ * Entries are keyed by the absolute file name, the file size, and the file
+ * modification time, plus a version string that the caller chooses (e.g. the
+ * library versions that produced the data). Each entry is stored in its own
+ * file in the user's cache directory. The data itself is opaque to the cache.
+ *
+ * Only local files are cached. All errors are ignored: the cache is just not
+ * used then.
+ */
+
+class probe_cache
+{
+public:
+    /* Get the data stored for the given file. Returns false if there is no
+     * valid entry, e.g. because the file was modified since it was stored. */
+    static bool get(const std::string &url, const std::string &version, std::string &data);
+
+    /* Store data for the given file, replacing an existing entry. */
+    static void put(const std::string &url, const std::string &version, const std::string &data);
+
+    /* Remove the entry for the given file, e.g. because its data was wrong. */
+    static void remove(const std::string &url);
+};
+
+#endif
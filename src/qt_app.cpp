@@ -66,6 +66,11 @@ bool init_qt()
     if (!qt_app)
     {
         qInstallMsgHandler(qt_msg_handler);
+#if QT_VERSION >= 0x040800
+        // The video output uses OpenGL from a second thread (for uploading
+        // frames), which requires a thread-safe Xlib
+        QCoreApplication::setAttribute(Qt::AA_X11InitThreads);
+#endif
         qt_app = new QApplication(qt_argc, const_cast<char **>(qt_argv));
         QTextCodec::setCodecForCStrings(QTextCodec::codecForName("UTF-8"));
         QCoreApplication::setOrganizationName("Bino");
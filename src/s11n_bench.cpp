@@ -0,0 +1,138 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ * Joe <joe@wpj.cz>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark for the two ways of serialization in s11n: standard streams,
+ * and s11n::writer / s11n::reader. It serializes and deserializes a single
+ * float value, and Equalizer frame data (display parameters and a few flags)
+ * like it is done for every frame.
+ *
+ * This program is not built by default; use "make s11n_bench".
+ */
+
+#include "config.h"
+
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+
+#include "s11n.h"
+#include "timer.h"
+
+#include "media_data.h"
+
+
+static const int iterations = 200000;
+
+// Prevents the compiler from optimizing the work away
+static volatile size_t sink;
+
+static void report(const char *what, int64_t stream_us, int64_t buffer_us)
+{
+    std::printf("%-26s stream %8.1f ns   buffer %8.1f ns   speedup %5.2fx\n", what,
+            stream_us * 1e3 / iterations, buffer_us * 1e3 / iterations,
+            static_cast<double>(stream_us) / static_cast<double>(buffer_us > 0 ? buffer_us : 1));
+}
+
+static void bench_float()
+{
+    int64_t t0 = timer::get_microseconds(timer::monotonic);
+    for (int i = 0; i < iterations; i++)
+    {
+        std::ostringstream oss;
+        s11n::save(oss, static_cast<float>(i));
+        std::string current = oss.str();
+        std::istringstream iss(current);
+        float value;
+        s11n::load(iss, value);
+        sink += static_cast<size_t>(value);
+    }
+    int64_t t1 = timer::get_microseconds(timer::monotonic);
+    for (int i = 0; i < iterations; i++)
+    {
+        s11n::writer w;
+        s11n::save(w, static_cast<float>(i));
+        std::string current = w.str();
+        s11n::reader r(current);
+        float value;
+        s11n::load(r, value);
+        sink += static_cast<size_t>(value);
+    }
+    int64_t t2 = timer::get_microseconds(timer::monotonic);
+    report("single float", t1 - t0, t2 - t1);
+}
+
+static void bench_frame_data()
+{
+    parameters params;
+    params.set_defaults();
+    parameters loaded_params;
+    int64_t seek_to = -1;
+    bool prep_frame = true, drop_frame = false, display_frame = true;
+
+    int64_t t0 = timer::get_microseconds(timer::monotonic);
+    for (int i = 0; i < iterations; i++)
+    {
+        std::ostringstream oss;
+        s11n::save(oss, params);
+        s11n::save(oss, seek_to);
+        s11n::save(oss, prep_frame);
+        s11n::save(oss, drop_frame);
+        s11n::save(oss, display_frame);
+        std::string s = oss.str();
+        std::istringstream iss(s);
+        s11n::load(iss, loaded_params);
+        s11n::load(iss, seek_to);
+        s11n::load(iss, prep_frame);
+        s11n::load(iss, drop_frame);
+        s11n::load(iss, display_frame);
+        sink += s.size();
+    }
+    int64_t t1 = timer::get_microseconds(timer::monotonic);
+    s11n::writer w;
+    for (int i = 0; i < iterations; i++)
+    {
+        w.clear();
+        s11n::save(w, params);
+        s11n::save(w, seek_to);
+        s11n::save(w, prep_frame);
+        s11n::save(w, drop_frame);
+        s11n::save(w, display_frame);
+        std::string s = w.str();
+        s11n::reader r(s);
+        s11n::load(r, loaded_params);
+        s11n::load(r, seek_to);
+        s11n::load(r, prep_frame);
+        s11n::load(r, drop_frame);
+        s11n::load(r, display_frame);
+        sink += s.size();
+    }
+    int64_t t2 = timer::get_microseconds(timer::monotonic);
+    report("frame data (parameters)", t1 - t0, t2 - t1);
+}
+
+int main(void)
+{
+    std::printf("s11n round trips, average time per iteration (%d iterations):\n", iterations);
+    bench_float();
+    bench_frame_data();
+    return 0;
+}
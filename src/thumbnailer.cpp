@@ -0,0 +1,203 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <limits>
+#include <algorithm>
+
+#ifdef _WIN32
+#  include <windows.h>
+#elif defined(__linux__)
+#  include <pthread.h>
+#  include <sched.h>
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#endif
+
+#include "msg.h"
+
+#include "media_object.h"
+#include "thumbnailer.h"
+
+
+// Number of thumbnails over the duration of the video
+static const int thumbnail_count = 100;
+// Maximum thumbnail size
+static const int thumbnail_max_width = 160;
+static const int thumbnail_max_height = 120;
+
+// Give the calling thread the lowest CPU and I/O priority. On Linux, the
+// threads that it starts (for reading) inherit this. Thumbnails are decoded
+// by the calling thread itself, not by the task pool (see
+// media_object::video_stream_set_preview()).
+static void lower_thread_priority()
+{
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(__linux__)
+# ifdef SCHED_IDLE
+    struct sched_param param;
+    param.sched_priority = 0;
+    (void)pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+# endif
+# ifdef SYS_ioprio_set
+    const int ioprio_who_process = 1;
+    const int ioprio_class_idle = 3;
+    const int ioprio_class_shift = 13;
+    (void)syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift);
+# endif
+#endif
+}
+
+thumbnailer::thumbnail::thumbnail() :
+    width(0), height(0), aspect_ratio(0.0f),
+    presentation_time(std::numeric_limits<int64_t>::min()), data()
+{
+}
+
+thumbnailer::thumbnailer(const std::vector<std::string> &urls, int video_stream,
+        bool stereo_layout_override, video_frame::stereo_layout_t stereo_layout, bool stereo_layout_swap) :
+    _urls(urls), _video_stream(video_stream),
+    _stereo_layout_override(stereo_layout_override),
+    _stereo_layout(stereo_layout), _stereo_layout_swap(stereo_layout_swap),
+    _stop_request(0), _thumbnails(thumbnail_count)
+{
+}
+
+thumbnailer::~thumbnailer()
+{
+    stop();
+}
+
+void thumbnailer::run()
+{
+    lower_thread_priority();
+
+    // Find the media object that contains the video stream, in the same way
+    // that media_input numbers the streams.
+    media_object input;
+    int stream = std::max(_video_stream, 0);
+    size_t o;
+    for (o = 0; o < _urls.size() && !atomic::fetch(&_stop_request); o++)
+    {
+        input.open(_urls[o]);
+        if (stream < input.video_streams())
+        {
+            break;
+        }
+        stream -= input.video_streams();
+        input.close();
+    }
+    if (o >= _urls.size() || atomic::fetch(&_stop_request))
+    {
+        return;
+    }
+    input.set_stop_request(&_stop_request);
+    input.video_stream_set_preview(stream, thumbnail_max_width, thumbnail_max_height);
+    input.video_stream_set_active(stream, true);
+
+    // The first frame determines the start position, as in the player
+    input.start_video_frame_read(stream);
+    video_frame frame = input.finish_video_frame_read(stream);
+    int64_t duration = input.video_duration(stream);
+    if (!frame.is_valid() || duration <= 0)
+    {
+        return;
+    }
+    int64_t start_pos = frame.presentation_time;
+    int64_t range = std::max(duration - 2000000, static_cast<int64_t>(0));
+
+    // Take a coarse set of thumbnails first, then refine it
+    std::vector<bool> done(thumbnail_count, false);
+    int step = 1;
+    while (step < thumbnail_count)
+    {
+        step *= 2;
+    }
+    for (; step >= 1 && !atomic::fetch(&_stop_request); step /= 2)
+    {
+        for (int i = 0; i < thumbnail_count && !atomic::fetch(&_stop_request); i += step)
+        {
+            if (done[i])
+            {
+                continue;
+            }
+            done[i] = true;
+            input.seek(start_pos + range * i / (thumbnail_count - 1));
+            input.start_video_frame_read(stream);
+            frame = input.finish_video_frame_read(stream);
+            if (!frame.is_valid())
+            {
+                continue;
+            }
+            if (_stereo_layout_override)
+            {
+                frame.stereo_layout = (_stereo_layout == video_frame::separate ? video_frame::mono : _stereo_layout);
+                frame.stereo_layout_swap = _stereo_layout_swap;
+                frame.set_view_dimensions();
+            }
+            thumbnail t;
+            t.width = frame.width;
+            t.height = frame.height;
+            t.aspect_ratio = frame.aspect_ratio;
+            t.presentation_time = frame.presentation_time;
+            t.data.resize(t.width * t.height * 4);
+            frame.copy_plane(0, 0, &(t.data[0]));
+            _mutex.lock();
+            _thumbnails[i] = t;
+            _mutex.unlock();
+        }
+    }
+    msg::dbg("Thumbnails for " + _urls[o] + " are complete.");
+}
+
+void thumbnailer::request_stop()
+{
+    atomic::increment(&_stop_request);
+}
+
+void thumbnailer::stop()
+{
+    request_stop();
+    wait();
+}
+
+bool thumbnailer::get(float pos, thumbnail &t)
+{
+    int i = static_cast<int>(std::min(std::max(pos, 0.0f), 1.0f) * (thumbnail_count - 1) + 0.5f);
+    bool found = false;
+    _mutex.lock();
+    for (int d = 0; d < thumbnail_count && !found; d++)
+    {
+        if (i - d >= 0 && _thumbnails[i - d].is_valid())
+        {
+            t = _thumbnails[i - d];
+            found = true;
+        }
+        else if (i + d < thumbnail_count && _thumbnails[i + d].is_valid())
+        {
+            t = _thumbnails[i + d];
+            found = true;
+        }
+    }
+    _mutex.unlock();
+    return found;
+}
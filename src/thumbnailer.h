@@ -0,0 +1,101 @@
+/*
+ * This file is part of bino, a 3D video player.
+ *
+ * Copyright (C) 2010-2011
+ * Martin Lambers <marlam@marlam.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "thread.h"
+
+#include "media_data.h"
+
+
+/*
+ * The thumbnailer creates small preview images of a video in the background,
+ * e.g. for the seek slider.
+ *
+ * It uses its own media object, so that it never needs to seek the one that
+ * is used for playback. Only key frames are decoded, at reduced resolution if
+ * possible, and the threads involved run with the lowest CPU and I/O priority.
+ * Thumbnails are taken at regular intervals over the duration of the video:
+ * first a coarse set, which is then refined.
+ */
+
+class thumbnailer : public thread
+{
+public:
+    // A thumbnail of the left view, in BGRA layout without row padding.
+    class thumbnail
+    {
+    public:
+        int width;                              // Width in pixels
+        int height;                             // Height in pixels
+        float aspect_ratio;                     // Aspect ratio when displayed
+        int64_t presentation_time;              // Presentation time of the frame
+        std::vector<unsigned char> data;        // The data (empty if invalid)
+
+        thumbnail();
+
+        bool is_valid() const
+        {
+            return !data.empty();
+        }
+    };
+
+private:
+    std::vector<std::string> _urls;             // The input media objects
+    int _video_stream;                          // The video stream of the input
+    bool _stereo_layout_override;               // Manual input layout override?
+    video_frame::stereo_layout_t _stereo_layout;//   Override layout
+    bool _stereo_layout_swap;                   //   Override layout swap
+    int _stop_request;                          // Request to stop the thread (accessed atomically)
+    mutex _mutex;                               // Protects _thumbnails
+    std::vector<thumbnail> _thumbnails;         // The thumbnails, in order of position
+
+public:
+    /* Prepare thumbnails for the given video stream of the input that consists
+     * of the given media objects. Call start() to begin. */
+    thumbnailer(const std::vector<std::string> &urls, int video_stream,
+            bool stereo_layout_override = false,
+            video_frame::stereo_layout_t stereo_layout = video_frame::mono,
+            bool stereo_layout_swap = false);
+    ~thumbnailer();
+
+    void run();
+
+    /* Stop creating thumbnails, without waiting for the thread to finish. The
+     * thread runs with the lowest priority, so this may take a while; use
+     * is_running() to find out when the thumbnailer can be destroyed. */
+    void request_stop();
+
+    /* Stop creating thumbnails and wait for the thread to finish. */
+    void stop();
+
+    /* Get the thumbnail for the given normalized input position (0..1), in the
+     * same way the player maps positions for seeking. If that thumbnail is not
+     * available yet, the nearest available one is returned. Returns false if
+     * there is none yet. */
+    bool get(float pos, thumbnail &t);
+};
+
+#endif
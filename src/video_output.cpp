@@ -23,6 +23,7 @@
 
 #include <cstdlib>
 #include <cmath>
+#include <algorithm>
 
 #include <GL/glew.h>
 
@@ -31,6 +32,8 @@
 #include "str.h"
 #include "timer.h"
 #include "dbg.h"
+#include "trace.h"
+#include "thread.h"
 
 #include "video_output.h"
 #include "video_output_color.fs.glsl.h"
@@ -48,6 +51,14 @@
  * and one for preparing the next video frame. Each texture set has textures
  * for the left and right view. The video data is transferred to texture
  * memory using pixel buffer objects, for better performance.
+ * Frames that pack both views into one image (left-right, top-bottom,
+ * alternating rows) are uploaded as they are, into a single texture set, and
+ * the color correction step extracts the views.
+ * If only a part of the frame is displayed (e.g. by one tile of a video wall),
+ * only that part plus a small margin is uploaded, and the next step only
+ * converts that part, too.
+ * If possible, the upload happens in a separate thread with an OpenGL context
+ * of its own (see the upload thread below).
  *
  * Step 2: Color correction.
  * The input data is first converted to YUV (for the common planar YUV frame
@@ -59,6 +70,12 @@
  * errors. We do not convert to linear RGB (as opposed to sRGB) in this step
  * because storing linear RGB in a GL_RGB texture would lose some precision
  * when compared to the non-linear input data.
+ * If a view is displayed smaller than the frame size, the GL_SRGB texture only
+ * has the displayed size, and each of its pixels averages the input pixels it
+ * covers (an exception to the no-interpolation rule that avoids aliasing).
+ * This step is done only once per frame, even if the frame is displayed
+ * several times (e.g. by several Equalizer channels, or by several windows
+ * that share the textures of one video output).
  *
  * Step 3: Rendering.
  * This step reads from the sRGB textures created in the previous step, which
@@ -71,6 +88,19 @@
  * this purpose because 1) we need computations on non-linear values for the
  * anaglyph methods and 2) sRGB framebuffers are not yet widely supported.
  *
+ * Steps 2 and 3 fused:
+ * Most output modes read only one point of each view per output pixel. For
+ * these, the render shader includes the color correction code and reads the
+ * input textures directly, so that the round trip through the sRGB textures
+ * is avoided. The conversion from sRGB to linear RGB that the GL would do is
+ * done in the shader instead, and so is the bilinear interpolation: the shader
+ * converts the four nearest texels to linear RGB and interpolates between
+ * them. The masking modes filter across neighboring pixels, which is cheaper
+ * with the sRGB textures, so they keep using the separate steps. So do frames
+ * with subtitles, which are drawn into the sRGB textures, and views that are
+ * displayed at less than half their size, which need more than four input
+ * samples per output pixel.
+ *
  * Open issues / TODO:
  * The 420p and 422p chroma subsampling formats are currently handled by
  * sampling the U and V textures with bilinear interpolation at the correct
@@ -81,6 +111,194 @@
  */
 
 
+/*
+ * The upload thread
+ *
+ * If the video output can create a second OpenGL context that shares objects
+ * with its own, this thread uploads the frames in that context, so that
+ * prepare_next_frame() returns immediately and the thread that displays the
+ * frames is not blocked by copying. When the textures of a frame are
+ * submitted, the thread inserts a fence into its command stream, and
+ * activate_next_frame() lets the display context wait for that fence on the
+ * GPU. Without sync objects, the thread waits for the upload to finish
+ * instead.
+ */
+
+class video_output_upload_thread : public thread
+{
+private:
+    enum state_t
+    {
+        idle,           // no job
+        queued,         // job waiting for the thread
+        running,        // job running; the frame data is still in use
+        copied,         // job running; the frame data was copied
+        done            // job finished; the fence can be taken
+    };
+
+    video_output *_vo;
+    bool _use_fences;
+    mutex _mutex;
+    condition _cond;
+    state_t _state;
+    bool _quit;
+    int _index;
+    video_frame _frame;
+    subtitle_box _subtitle;
+    parameters _params;
+    GLsync _fence;              // fence of the last job that was not taken yet
+    exc _job_exception;
+
+    void set_state(state_t state)
+    {
+        _mutex.lock();
+        _state = state;
+        _cond.wake_all();
+        _mutex.unlock();
+    }
+
+public:
+    video_output_upload_thread(video_output *vo, bool use_fences) :
+        thread(thread::render), _vo(vo), _use_fences(use_fences),
+        _mutex(), _cond(), _state(idle), _quit(false), _index(0),
+        _frame(), _subtitle(), _params(), _fence(NULL), _job_exception()
+    {
+    }
+
+    void run()
+    {
+        _vo->make_upload_context_current();
+        _mutex.lock();
+        for (;;)
+        {
+            while (_state != queued && !_quit)
+            {
+                _cond.wait(_mutex);
+            }
+            if (_quit)
+            {
+                break;
+            }
+            _state = running;
+            // The fence of a frame that was replaced before it was activated
+            GLsync stale_fence = _fence;
+            _fence = NULL;
+            _mutex.unlock();
+            if (stale_fence)
+            {
+                glDeleteSync(stale_fence);
+            }
+            GLsync fence = NULL;
+            exc e;
+            try
+            {
+                _vo->input_upload(_index, _frame);
+                set_state(copied);
+                _vo->input_upload_subtitle(_index, _subtitle, _params);
+                if (_use_fences)
+                {
+                    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    // Make sure that the fence reaches the GPU, so that other
+                    // contexts cannot wait for it forever
+                    glFlush();
+                }
+                else
+                {
+                    glFinish();
+                }
+            }
+            catch (exc &x)
+            {
+                e = x;
+            }
+            catch (std::exception &x)
+            {
+                e = x;
+            }
+            _mutex.lock();
+            _fence = fence;
+            _job_exception = e;
+            _state = done;
+            _cond.wake_all();
+        }
+        GLsync stale_fence = _fence;
+        _fence = NULL;
+        _mutex.unlock();
+        if (stale_fence)
+        {
+            glDeleteSync(stale_fence);
+        }
+        _vo->done_upload_context_current();
+    }
+
+    // Start uploading a frame. The previous job must be finished.
+    void start_job(int index, const video_frame &frame, const subtitle_box &subtitle, const parameters &params)
+    {
+        _mutex.lock();
+        assert(_state == idle || _state == done);
+        _index = index;
+        _frame = frame;
+        _subtitle = subtitle;
+        _params = params;
+        _state = queued;
+        _cond.wake_all();
+        _mutex.unlock();
+    }
+
+    // Wait until the frame data of the current job is not used anymore
+    void wait_for_copy()
+    {
+        _mutex.lock();
+        while (_state == queued || _state == running)
+        {
+            _cond.wait(_mutex);
+        }
+        _mutex.unlock();
+    }
+
+    // Wait until the current job is finished, and rethrow its exception. The
+    // fence remains with the thread.
+    void wait_for_job()
+    {
+        _mutex.lock();
+        while (_state == queued || _state == running || _state == copied)
+        {
+            _cond.wait(_mutex);
+        }
+        exc e = _job_exception;
+        _job_exception = exc();
+        _mutex.unlock();
+        if (!e.empty())
+        {
+            throw e;
+        }
+    }
+
+    // Wait until the current job is finished, and take its fence. The caller
+    // must delete the fence. Returns NULL if there is no fence.
+    GLsync finish_job()
+    {
+        wait_for_job();
+        _mutex.lock();
+        GLsync fence = _fence;
+        _fence = NULL;
+        _state = idle;
+        _mutex.unlock();
+        return fence;
+    }
+
+    // Stop the thread. A queued job is dropped.
+    void quit()
+    {
+        _mutex.lock();
+        _quit = true;
+        _cond.wake_all();
+        _mutex.unlock();
+        finish();
+    }
+};
+
+
 video_output::video_output(bool receive_notifications) :
     controller(receive_notifications),
     _initialized(false)
@@ -88,9 +306,11 @@ video_output::video_output(bool receive_notifications) :
     // XXX: Hack: work around broken SRGB texture implementations
     _srgb_textures_are_broken = std::getenv("SRGB_TEXTURES_ARE_BROKEN");
 
-    _input_pbo = 0;
-    _input_subtitle = 0;
     _active_index = 1;
+    _region[0] = 0.0f;
+    _region[1] = 0.0f;
+    _region[2] = 1.0f;
+    _region[3] = 1.0f;
     for (int i = 0; i < 2; i++)
     {
         for (int j = 0; j < 2; j++)
@@ -100,12 +320,26 @@ video_output::video_output(bool receive_notifications) :
             _input_yuv_v_tex[i][j] = 0;
             _input_bgra32_tex[i][j] = 0;
         }
+        for (int j = 0; j < 4; j++)
+        {
+            _input_region[i][j] = 0;
+        }
+        _input_pbo[i] = 0;
+        _input_subtitle_tex[i] = 0;
+        _input_subtitle_valid[i] = false;
         _color_srgb_tex[i] = 0;
+        _color_size[i] = 0;
+        _color_requested_size[i][0] = 0;
+        _color_requested_size[i][1] = 0;
     }
+    _upload_thread = NULL;
     _color_prg = 0;
     _color_fbo = 0;
+    _color_valid = false;
+    _color_source = NULL;
     _render_prg = 0;
     _render_mask_tex = 0;
+    _fused_prg = 0;
 }
 
 video_output::~video_output()
@@ -116,7 +350,15 @@ void video_output::init()
 {
     if (!_initialized)
     {
-        /* currently nothing to do */
+        if (create_upload_context())
+        {
+            make_context_current();
+            bool use_fences = glewIsSupported("GL_ARB_sync");
+            _upload_thread = new video_output_upload_thread(this, use_fences);
+            _upload_thread->start();
+            msg::dbg("Uploading video frames in a separate thread (%s).",
+                    use_fences ? "with fences" : "without fences");
+        }
         _initialized = true;
     }
 }
@@ -126,11 +368,20 @@ void video_output::deinit()
     if (_initialized)
     {
         make_context_current();
+        if (_upload_thread)
+        {
+            _upload_thread->quit();
+            delete _upload_thread;
+            _upload_thread = NULL;
+            destroy_upload_context();
+            make_context_current();
+        }
         assert(xgl::CheckError(HERE));
         input_deinit(0);
         input_deinit(1);
         color_deinit();
         render_deinit();
+        fused_deinit();
         assert(xgl::CheckError(HERE));
         _initialized = false;
     }
@@ -181,10 +432,10 @@ void video_output::set_suitable_size(int w, int h, float ar, parameters::stereo_
 void video_output::input_init(int index, const video_frame &frame)
 {
     assert(xgl::CheckError(HERE));
-    glGenBuffers(1, &_input_pbo);
+    glGenBuffers(1, &(_input_pbo[index]));
     
-    glGenBuffers(1, &_input_subtitle);
-    glBindTexture(GL_TEXTURE_2D, _input_subtitle);
+    glGenTextures(1, &(_input_subtitle_tex[index]));
+    glBindTexture(GL_TEXTURE_2D, _input_subtitle_tex[index]);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -192,9 +443,15 @@ void video_output::input_init(int index, const video_frame &frame)
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, frame.width, frame.height,
                  0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
     
+    // Frames with packed views are uploaded as they are, into one texture per
+    // plane; the color pass extracts the views.
+    bool packed = frame.has_packed_views();
+    int textures = (frame.stereo_layout == video_frame::mono || packed ? 1 : 2);
+    int tex_width = (packed ? frame.raw_width : frame.width);
+    int tex_height = (packed ? frame.raw_height : frame.height);
     if (frame.layout == video_frame::bgra32)
     {
-        for (int i = 0; i < (frame.stereo_layout == video_frame::mono ? 1 : 2); i++)
+        for (int i = 0; i < textures; i++)
         {
             glGenTextures(1, &(_input_bgra32_tex[index][i]));
             glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[index][i]);
@@ -202,7 +459,7 @@ void video_output::input_init(int index, const video_frame &frame)
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, frame.width, frame.height,
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tex_width, tex_height,
                     0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
         }
     }
@@ -222,7 +479,7 @@ void video_output::input_init(int index, const video_frame &frame)
             _input_yuv_chroma_height_divisor[index] = 2;
             need_chroma_filtering = true;
         }
-        for (int i = 0; i < (frame.stereo_layout == video_frame::mono ? 1 : 2); i++)
+        for (int i = 0; i < textures; i++)
         {
             glGenTextures(1, &(_input_yuv_y_tex[index][i]));
             glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[index][i]);
@@ -231,8 +488,8 @@ void video_output::input_init(int index, const video_frame &frame)
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8,
-                    frame.width,
-                    frame.height,
+                    tex_width,
+                    tex_height,
                     0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
             glGenTextures(1, &(_input_yuv_u_tex[index][i]));
             glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[index][i]);
@@ -241,8 +498,8 @@ void video_output::input_init(int index, const video_frame &frame)
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8,
-                    frame.width / _input_yuv_chroma_width_divisor[index],
-                    frame.height / _input_yuv_chroma_height_divisor[index],
+                    tex_width / _input_yuv_chroma_width_divisor[index],
+                    tex_height / _input_yuv_chroma_height_divisor[index],
                     0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
             glGenTextures(1, &(_input_yuv_v_tex[index][i]));
             glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[index][i]);
@@ -251,8 +508,8 @@ void video_output::input_init(int index, const video_frame &frame)
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8,
-                    frame.width / _input_yuv_chroma_width_divisor[index],
-                    frame.height / _input_yuv_chroma_height_divisor[index],
+                    tex_width / _input_yuv_chroma_width_divisor[index],
+                    tex_height / _input_yuv_chroma_height_divisor[index],
                     0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
         }
     }
@@ -273,10 +530,16 @@ bool video_output::input_is_compatible(int index, const video_frame &current_fra
 void video_output::input_deinit(int index)
 {
     assert(xgl::CheckError(HERE));
-    glDeleteBuffers(1, &_input_pbo);
-    _input_pbo = 0;
-    glDeleteBuffers(1, &_input_subtitle);
-    _input_subtitle = 0;
+    if (_input_pbo[index] != 0)
+    {
+        glDeleteBuffers(1, &(_input_pbo[index]));
+        _input_pbo[index] = 0;
+    }
+    if (_input_subtitle_tex[index] != 0)
+    {
+        glDeleteTextures(1, &(_input_subtitle_tex[index]));
+        _input_subtitle_tex[index] = 0;
+    }
     for (int i = 0; i < 2; i++)
     {
         if (_input_yuv_y_tex[index][i] != 0)
@@ -311,53 +574,158 @@ static int next_multiple_of_4(int x)
     return (x / 4 + (x % 4 == 0 ? 0 : 1)) * 4;
 }
 
+void video_output::input_region(const video_frame &frame, int region[4])
+{
+    // Margin for the bilinear filtering of the chroma and render steps, and
+    // for the texture coordinate shift that parallax adjustment causes.
+    // If the color pass downscales, the margin must be scaled, too.
+    const int filter_margin = 2;
+    int scale_x = (_color_size[0] > 0 ? std::max((frame.width + _color_size[0] - 1) / _color_size[0], 1) : 1);
+    int scale_y = (_color_size[1] > 0 ? std::max((frame.height + _color_size[1] - 1) / _color_size[1], 1) : 1);
+    int margin_x = filter_margin * scale_x + static_cast<int>(std::ceil(std::fabs(_params.parallax * 0.05f) * frame.width));
+    int margin_y = filter_margin * scale_y;
+    // Convert to pixels from the top left, and align to multiples of 4 so that
+    // the chroma planes are always cut at whole pixels.
+    int x0 = static_cast<int>(std::floor(_region[0] * frame.width)) - margin_x;
+    int x1 = static_cast<int>(std::ceil((_region[0] + _region[2]) * frame.width)) + margin_x;
+    int y0 = static_cast<int>(std::floor((1.0f - _region[1] - _region[3]) * frame.height)) - margin_y;
+    int y1 = static_cast<int>(std::ceil((1.0f - _region[1]) * frame.height)) + margin_y;
+    x0 = std::max(x0 / 4 * 4, 0);
+    x1 = std::min(next_multiple_of_4(x1), frame.width);
+    y0 = std::max(y0 / 4 * 4, 0);
+    y1 = std::min(next_multiple_of_4(y1), frame.height);
+    if (x1 <= x0 || y1 <= y0)
+    {
+        // Nothing is visible; keep a minimal valid region
+        x0 = 0;
+        y0 = 0;
+        x1 = std::min(4, frame.width);
+        y1 = std::min(4, frame.height);
+    }
+    region[0] = x0;
+    region[1] = y0;
+    region[2] = x1 - x0;
+    region[3] = y1 - y0;
+}
+
 void video_output::prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle)
 {
-    assert(xgl::CheckError(HERE));
+    TRACE_SCOPE("prepare next frame");
     int index = (_active_index == 0 ? 1 : 0);
+    if (_upload_thread)
+    {
+        // A frame that was prepared but not activated is replaced
+        _upload_thread->wait_for_job();
+    }
     if (!frame.is_valid())
     {
         _frame[index] = frame;
         return;
     }
-    make_context_current();
+    input_region(frame, _input_region[index]);
+    if (_upload_thread)
+    {
+        _upload_thread->start_job(index, frame, subtitle, _params);
+    }
+    else
+    {
+        make_context_current();
+        input_upload(index, frame);
+        input_upload_subtitle(index, subtitle, _params);
+    }
+}
+
+void video_output::wait_for_frame_copy()
+{
+    if (_upload_thread)
+    {
+        _upload_thread->wait_for_copy();
+    }
+}
+
+void video_output::input_upload(int index, const video_frame &frame)
+{
+    TRACE_SCOPE("upload frame");
+    assert(xgl::CheckError(HERE));
     if (!input_is_compatible(index, frame))
     {
         input_deinit(index);
         input_init(index, frame);
-        _frame[index] = frame;
     }
-    
+    _frame[index] = frame;
+
+    const int *region = _input_region[index];
     int bytes_per_pixel = (frame.layout == video_frame::bgra32 ? 4 : 1);
     GLenum format = (frame.layout == video_frame::bgra32 ? GL_BGRA : GL_LUMINANCE);
     GLenum type = (frame.layout == video_frame::bgra32 ? GL_UNSIGNED_INT_8_8_8_8_REV : GL_UNSIGNED_BYTE);
-    for (int i = 0; i < (frame.stereo_layout == video_frame::mono ? 1 : 2); i++)
+    /* Determine the rectangles to upload. Without packed views, this is the region
+     * of each view, and it goes into the texture of that view. With packed views,
+     * it is the part of the raw frame that contains the region of both views,
+     * which is a single rectangle if the region spans the whole frame in the
+     * packing direction; the raw frame goes into a single texture. */
+    bool packed = frame.has_packed_views();
+    int rects[2][4];
+    int n_rects = (frame.stereo_layout == video_frame::mono ? 1 : 2);
+    for (int i = 0; i < n_rects; i++)
+    {
+        std::copy(region, region + 4, rects[i]);
+    }
+    if (frame.stereo_layout == video_frame::top_bottom || frame.stereo_layout == video_frame::top_bottom_half)
     {
+        rects[1][1] += frame.height;
+        if (region[3] == frame.height)
+        {
+            rects[0][3] *= 2;
+            n_rects = 1;
+        }
+    }
+    else if (frame.stereo_layout == video_frame::left_right || frame.stereo_layout == video_frame::left_right_half)
+    {
+        rects[1][0] += frame.width;
+        if (region[2] == frame.width)
+        {
+            rects[0][2] *= 2;
+            n_rects = 1;
+        }
+    }
+    else if (frame.stereo_layout == video_frame::even_odd_rows)
+    {
+        rects[0][1] *= 2;
+        rects[0][3] *= 2;
+        n_rects = 1;
+    }
+    for (int i = 0; i < n_rects; i++)
+    {
+        int t = (packed ? 0 : i);
         for (int plane = 0; plane < (frame.layout == video_frame::bgra32 ? 1 : 3); plane++)
         {
-            // Determine the texture and the dimensions
-            int w = frame.width;
-            int h = frame.height;
+            // Determine the texture and the dimensions of the region
+            int x = rects[i][0];
+            int y = rects[i][1];
+            int w = rects[i][2];
+            int h = rects[i][3];
             GLuint tex;
             int row_size;
             if (frame.layout == video_frame::bgra32)
             {
-                tex = _input_bgra32_tex[index][i];
+                tex = _input_bgra32_tex[index][t];
             }
             else
             {
                 if (plane != 0)
                 {
+                    x /= _input_yuv_chroma_width_divisor[index];
+                    y /= _input_yuv_chroma_height_divisor[index];
                     w /= _input_yuv_chroma_width_divisor[index];
                     h /= _input_yuv_chroma_height_divisor[index];
                 }
-                tex = (plane == 0 ? _input_yuv_y_tex[index][i]
-                        : plane == 1 ? _input_yuv_u_tex[index][i]
-                        : _input_yuv_v_tex[index][i]);
+                tex = (plane == 0 ? _input_yuv_y_tex[index][t]
+                        : plane == 1 ? _input_yuv_u_tex[index][t]
+                        : _input_yuv_v_tex[index][t]);
             }
             row_size = next_multiple_of_4(w * bytes_per_pixel);
             // Get a pixel buffer object buffer for the data
-            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo[index]);
             glBufferData(GL_PIXEL_UNPACK_BUFFER, row_size * h, NULL, GL_STREAM_DRAW);
             void *pboptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
             if (!pboptr)
@@ -367,7 +735,14 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
             }
             assert(reinterpret_cast<uintptr_t>(pboptr) % 4 == 0);
             // Get the plane data into the pbo
-            frame.copy_plane(i, plane, pboptr);
+            if (packed)
+            {
+                frame.copy_packed_plane(plane, pboptr, rects[i][0], rects[i][1], rects[i][2], rects[i][3]);
+            }
+            else
+            {
+                frame.copy_plane(i, plane, pboptr, rects[i][0], rects[i][1], rects[i][2], rects[i][3]);
+            }
             // Upload the data to the texture. We need to set GL_UNPACK_ROW_LENGTH for
             // misbehaving OpenGL implementations that do not seem to honor
             // GL_UNPACK_ALIGNMENT correctly in all cases (reported for Mac).
@@ -376,16 +751,20 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
             glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, tex);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, type, NULL);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, format, type, NULL);
             glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
         }
     }
     assert(xgl::CheckError(HERE));
-    
-    
+}
+
+void video_output::input_upload_subtitle(int index, const subtitle_box &subtitle, parameters &params)
+{
     // Subtitle rendering
+    _input_subtitle_valid[index] = subtitle.is_valid();
     if (subtitle.is_valid())
     {
+        const video_frame &frame = _frame[index];
         msg::inf("SUBTITLE: %s", subtitle.str.c_str());
 
         int w = frame.width;
@@ -393,7 +772,7 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
         int row_size;
         row_size = next_multiple_of_4(w * 4);
         // Get a pixel buffer object buffer for the data
-        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _input_pbo[index]);
         glBufferData(GL_PIXEL_UNPACK_BUFFER, row_size * h, NULL, GL_STREAM_DRAW);
         void *pboptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
         if (!pboptr)
@@ -403,7 +782,7 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
         }
         assert(reinterpret_cast<uintptr_t>(pboptr) % 4 == 0);
         // Get the subtitle data into the pbo
-        render_subtitle(subtitle, _params, pboptr, w, h);
+        render_subtitle(subtitle, params, pboptr, w, h);
         // Upload the data to the texture. We need to set GL_UNPACK_ROW_LENGTH for
         // misbehaving OpenGL implementations that do not seem to honor
         // GL_UNPACK_ALIGNMENT correctly in all cases (reported for Mac).
@@ -411,27 +790,22 @@ void video_output::prepare_next_frame(const video_frame &frame, const subtitle_b
         glPixelStorei(GL_UNPACK_ROW_LENGTH, row_size / 4);
         glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _input_subtitle);
+        glBindTexture(GL_TEXTURE_2D, _input_subtitle_tex[index]);
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
-    else
-    {
-        // Clear texture
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _color_fbo);
-        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
-                                  GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _input_subtitle, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClear(GL_COLOR | GL_DEPTH);
-        
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-    }
+    // Without a subtitle, the texture is left alone: the color pass does not
+    // draw it then. (Clearing it would need a framebuffer object, and those
+    // are not shared with the upload context.)
 }
 
-void video_output::color_init(const video_frame &frame)
+// Get the source of the color correction shader for the given frame format.
+// The pass type is color_pass_separate or color_pass_fused. The output size is
+// only used by color_pass_separate.
+static std::string color_fs_src(const video_frame &frame,
+        int chroma_width_divisor, int chroma_height_divisor, const std::string &color_pass_str,
+        const int output_size[2])
 {
-    assert(xgl::CheckError(HERE));
-    glGenFramebuffersEXT(1, &_color_fbo);
     std::string layout_str;
     std::string color_space_str;
     std::string value_range_str;
@@ -469,14 +843,14 @@ void video_output::color_init(const video_frame &frame)
             if (frame.chroma_location == video_frame::left)
             {
                 chroma_offset_x_str = str::from(0.5f / static_cast<float>(frame.width
-                            / _input_yuv_chroma_width_divisor[_active_index]));
+                            / chroma_width_divisor));
             }
             else if (frame.chroma_location == video_frame::topleft)
             {
                 chroma_offset_x_str = str::from(0.5f / static_cast<float>(frame.width
-                            / _input_yuv_chroma_width_divisor[_active_index]));
+                            / chroma_width_divisor));
                 chroma_offset_y_str = str::from(0.5f / static_cast<float>(frame.height
-                            / _input_yuv_chroma_height_divisor[_active_index]));
+                            / chroma_height_divisor));
             }
         }
         else if (frame.layout == video_frame::yuv420p)
@@ -484,23 +858,60 @@ void video_output::color_init(const video_frame &frame)
             if (frame.chroma_location == video_frame::left)
             {
                 chroma_offset_x_str = str::from(0.5f / static_cast<float>(frame.width
-                            / _input_yuv_chroma_width_divisor[_active_index]));
+                            / chroma_width_divisor));
             }
             else if (frame.chroma_location == video_frame::topleft)
             {
                 chroma_offset_x_str = str::from(0.5f / static_cast<float>(frame.width
-                            / _input_yuv_chroma_width_divisor[_active_index]));
+                            / chroma_width_divisor));
                 chroma_offset_y_str = str::from(0.5f / static_cast<float>(frame.height
-                            / _input_yuv_chroma_height_divisor[_active_index]));
+                            / chroma_height_divisor));
             }
         }
     }
-    std::string color_fs_src(VIDEO_OUTPUT_COLOR_FS_GLSL_STR);
-    str::replace(color_fs_src, "$layout", layout_str);
-    str::replace(color_fs_src, "$color_space", color_space_str);
-    str::replace(color_fs_src, "$value_range", value_range_str);
-    str::replace(color_fs_src, "$chroma_offset_x", chroma_offset_x_str);
-    str::replace(color_fs_src, "$chroma_offset_y", chroma_offset_y_str);
+    std::string packing_str = (
+            frame.stereo_layout == video_frame::top_bottom ? "packing_top_bottom"
+            : frame.stereo_layout == video_frame::top_bottom_half ? "packing_top_bottom"
+            : frame.stereo_layout == video_frame::left_right ? "packing_left_right"
+            : frame.stereo_layout == video_frame::left_right_half ? "packing_left_right"
+            : frame.stereo_layout == video_frame::even_odd_rows ? "packing_even_odd_rows"
+            : "packing_none");
+    std::string luma_size_str = str::asprintf("vec2(%d.0, %d.0)", frame.width, frame.height);
+    std::string chroma_size_str = luma_size_str;
+    if (frame.layout != video_frame::bgra32)
+    {
+        chroma_size_str = str::asprintf("vec2(%d.0, %d.0)",
+                frame.width / chroma_width_divisor, frame.height / chroma_height_divisor);
+    }
+    // Sample each input texel once when downscaling, but limit the number of
+    // samples per output pixel; the luma texture is not filtered.
+    std::string output_size_str = str::asprintf("vec2(%d.0, %d.0)", output_size[0], output_size[1]);
+    int downscale_taps_x = std::min(std::max((frame.width + output_size[0] - 1) / output_size[0], 1), 4);
+    int downscale_taps_y = std::min(std::max((frame.height + output_size[1] - 1) / output_size[1], 1), 4);
+    std::string src(VIDEO_OUTPUT_COLOR_FS_GLSL_STR);
+    str::replace(src, "$color_pass", color_pass_str);
+    str::replace(src, "$output_size", output_size_str);
+    str::replace(src, "$downscale_taps_x", str::from(downscale_taps_x));
+    str::replace(src, "$downscale_taps_y", str::from(downscale_taps_y));
+    str::replace(src, "$packing", packing_str);
+    str::replace(src, "$luma_size", luma_size_str);
+    str::replace(src, "$chroma_size", chroma_size_str);
+    str::replace(src, "$layout", layout_str);
+    str::replace(src, "$color_space", color_space_str);
+    str::replace(src, "$value_range", value_range_str);
+    str::replace(src, "$chroma_offset_x", chroma_offset_x_str);
+    str::replace(src, "$chroma_offset_y", chroma_offset_y_str);
+    return src;
+}
+
+void video_output::color_init(const video_frame &frame, const int size[2])
+{
+    assert(xgl::CheckError(HERE));
+    glGenFramebuffersEXT(1, &_color_fbo);
+    std::string color_fs_src = ::color_fs_src(frame,
+            _input_yuv_chroma_width_divisor[_active_index],
+            _input_yuv_chroma_height_divisor[_active_index],
+            "color_pass_separate", size);
     _color_prg = xgl::CreateProgram("video_output_color", "", "", color_fs_src);
     xgl::LinkProgram("video_output_color", _color_prg);
     for (int i = 0; i < (frame.stereo_layout == video_frame::mono ? 1 : 2); i++)
@@ -513,8 +924,10 @@ void video_output::color_init(const video_frame &frame)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexImage2D(GL_TEXTURE_2D, 0,
                 _srgb_textures_are_broken ? GL_RGB8 : GL_SRGB8,
-                frame.width, frame.height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+                size[0], size[1], 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
     }
+    _color_size[0] = size[0];
+    _color_size[1] = size[1];
     assert(xgl::CheckError(HERE));
 }
 
@@ -536,7 +949,10 @@ void video_output::color_deinit()
             _color_srgb_tex[i] = 0;
         }
     }
+    _color_size[0] = 0;
+    _color_size[1] = 0;
     _color_last_frame = video_frame();
+    _color_valid = false;
     assert(xgl::CheckError(HERE));
 }
 
@@ -551,32 +967,69 @@ bool video_output::color_is_compatible(const video_frame &current_frame)
             && _color_last_frame.stereo_layout == current_frame.stereo_layout);
 }
 
-void video_output::render_init()
+/* The sRGB textures do not need more pixels than a view occupies on screen.
+ * Every display of a frame requests the size it needs. The textures have the
+ * largest size requested during this or the last frame, so that all displays
+ * that share them (see set_color_source()) are served without switching sizes
+ * back and forth. A request for a larger size takes effect immediately;
+ * smaller sizes take effect one frame later. */
+void video_output::color_request_size(const video_frame &frame, float w, float h)
+{
+    int iw = std::min(std::max(static_cast<int>(std::ceil(w)), 1), frame.width);
+    int ih = std::min(std::max(static_cast<int>(std::ceil(h)), 1), frame.height);
+    _color_requested_size[0][0] = std::max(_color_requested_size[0][0], iw);
+    _color_requested_size[0][1] = std::max(_color_requested_size[0][1], ih);
+    if (iw > _color_size[0] || ih > _color_size[1])
+    {
+        _color_valid = false;
+    }
+}
+
+void video_output::color_size(const video_frame &frame, int size[2])
+{
+    int w = std::max(_color_requested_size[0][0], _color_requested_size[1][0]);
+    int h = std::max(_color_requested_size[0][1], _color_requested_size[1][1]);
+    size[0] = (w > 0 ? std::min(w, frame.width) : frame.width);
+    size[1] = (h > 0 ? std::min(h, frame.height) : frame.height);
+}
+
+// Get the source of the render shader for the given stereo mode. The color
+// input is color_input_textures or color_input_fused.
+static std::string render_fs_src(parameters::stereo_mode_t stereo_mode, bool srgb_broken,
+        const std::string &color_input_str)
 {
-    assert(xgl::CheckError(HERE));
     std::string mode_str = (
-            _params.stereo_mode == parameters::even_odd_rows ? "mode_even_odd_rows"
-            : _params.stereo_mode == parameters::even_odd_columns ? "mode_even_odd_columns"
-            : _params.stereo_mode == parameters::checkerboard ? "mode_checkerboard"
-            : _params.stereo_mode == parameters::red_cyan_monochrome ? "mode_red_cyan_monochrome"
-            : _params.stereo_mode == parameters::red_cyan_half_color ? "mode_red_cyan_half_color"
-            : _params.stereo_mode == parameters::red_cyan_full_color ? "mode_red_cyan_full_color"
-            : _params.stereo_mode == parameters::red_cyan_dubois ? "mode_red_cyan_dubois"
-            : _params.stereo_mode == parameters::green_magenta_monochrome ? "mode_green_magenta_monochrome"
-            : _params.stereo_mode == parameters::green_magenta_half_color ? "mode_green_magenta_half_color"
-            : _params.stereo_mode == parameters::green_magenta_full_color ? "mode_green_magenta_full_color"
-            : _params.stereo_mode == parameters::green_magenta_dubois ? "mode_green_magenta_dubois"
-            : _params.stereo_mode == parameters::amber_blue_monochrome ? "mode_amber_blue_monochrome"
-            : _params.stereo_mode == parameters::amber_blue_half_color ? "mode_amber_blue_half_color"
-            : _params.stereo_mode == parameters::amber_blue_full_color ? "mode_amber_blue_full_color"
-            : _params.stereo_mode == parameters::amber_blue_dubois ? "mode_amber_blue_dubois"
-            : _params.stereo_mode == parameters::red_green_monochrome ? "mode_red_green_monochrome"
-            : _params.stereo_mode == parameters::red_blue_monochrome ? "mode_red_blue_monochrome"
+            stereo_mode == parameters::even_odd_rows ? "mode_even_odd_rows"
+            : stereo_mode == parameters::even_odd_columns ? "mode_even_odd_columns"
+            : stereo_mode == parameters::checkerboard ? "mode_checkerboard"
+            : stereo_mode == parameters::red_cyan_monochrome ? "mode_red_cyan_monochrome"
+            : stereo_mode == parameters::red_cyan_half_color ? "mode_red_cyan_half_color"
+            : stereo_mode == parameters::red_cyan_full_color ? "mode_red_cyan_full_color"
+            : stereo_mode == parameters::red_cyan_dubois ? "mode_red_cyan_dubois"
+            : stereo_mode == parameters::green_magenta_monochrome ? "mode_green_magenta_monochrome"
+            : stereo_mode == parameters::green_magenta_half_color ? "mode_green_magenta_half_color"
+            : stereo_mode == parameters::green_magenta_full_color ? "mode_green_magenta_full_color"
+            : stereo_mode == parameters::green_magenta_dubois ? "mode_green_magenta_dubois"
+            : stereo_mode == parameters::amber_blue_monochrome ? "mode_amber_blue_monochrome"
+            : stereo_mode == parameters::amber_blue_half_color ? "mode_amber_blue_half_color"
+            : stereo_mode == parameters::amber_blue_full_color ? "mode_amber_blue_full_color"
+            : stereo_mode == parameters::amber_blue_dubois ? "mode_amber_blue_dubois"
+            : stereo_mode == parameters::red_green_monochrome ? "mode_red_green_monochrome"
+            : stereo_mode == parameters::red_blue_monochrome ? "mode_red_blue_monochrome"
             : "mode_onechannel");
-    std::string srgb_broken_str = (_srgb_textures_are_broken ? "1" : "0");
-    std::string render_fs_src(VIDEO_OUTPUT_RENDER_FS_GLSL_STR);
-    str::replace(render_fs_src, "$mode", mode_str);
-    str::replace(render_fs_src, "$srgb_broken", srgb_broken_str);
+    std::string srgb_broken_str = (srgb_broken ? "1" : "0");
+    std::string src(VIDEO_OUTPUT_RENDER_FS_GLSL_STR);
+    str::replace(src, "$mode", mode_str);
+    str::replace(src, "$color_input", color_input_str);
+    str::replace(src, "$srgb_broken", srgb_broken_str);
+    return src;
+}
+
+void video_output::render_init()
+{
+    assert(xgl::CheckError(HERE));
+    std::string render_fs_src = ::render_fs_src(_params.stereo_mode, _srgb_textures_are_broken,
+            "color_input_textures");
     _render_prg = xgl::CreateProgram("video_output_render", "", "", render_fs_src);
     xgl::LinkProgram("video_output_render", _render_prg);
     if (_params.stereo_mode == parameters::even_odd_rows
@@ -624,15 +1077,106 @@ bool video_output::render_is_compatible()
     return (_render_last_params.stereo_mode == _params.stereo_mode);
 }
 
+bool video_output::fused_is_possible(const video_output *src, float view_w, float view_h)
+{
+    // The fused pass interpolates between the four nearest texels of a view.
+    // That covers magnification and minification down to half the size; for
+    // smaller views, the color pass averages more samples.
+    const video_frame &frame = src->_frame[src->_active_index];
+    return (2.0f * view_w >= frame.width - 1.0f
+            && 2.0f * view_h >= frame.height - 1.0f
+            && _params.stereo_mode != parameters::even_odd_rows
+            && _params.stereo_mode != parameters::even_odd_columns
+            && _params.stereo_mode != parameters::checkerboard
+            && !src->_input_subtitle_valid[src->_active_index]);
+}
+
+void video_output::fused_init(const video_output *src)
+{
+    assert(xgl::CheckError(HERE));
+    const video_frame &frame = src->_frame[src->_active_index];
+    // The color correction code must precede the render code, and only the
+    // first #version directive may remain.
+    int frame_size[2] = { frame.width, frame.height };
+    std::string fused_fs_src = color_fs_src(frame,
+            src->_input_yuv_chroma_width_divisor[src->_active_index],
+            src->_input_yuv_chroma_height_divisor[src->_active_index],
+            "color_pass_fused", frame_size);
+    std::string render_src = render_fs_src(_params.stereo_mode, _srgb_textures_are_broken,
+            "color_input_fused");
+    str::replace(render_src, "#version 120", "");
+    fused_fs_src += render_src;
+    _fused_prg = xgl::CreateProgram("video_output_fused", "", "", fused_fs_src);
+    xgl::LinkProgram("video_output_fused", _fused_prg);
+    assert(xgl::CheckError(HERE));
+}
+
+void video_output::fused_deinit()
+{
+    assert(xgl::CheckError(HERE));
+    if (_fused_prg != 0)
+    {
+        xgl::DeleteProgram(_fused_prg);
+        _fused_prg = 0;
+    }
+    _fused_last_frame = video_frame();
+    _fused_last_params = parameters();
+    assert(xgl::CheckError(HERE));
+}
+
+bool video_output::fused_is_compatible(const video_frame &current_frame)
+{
+    return (_fused_last_params.stereo_mode == _params.stereo_mode
+            && _fused_last_frame.width == current_frame.width
+            && _fused_last_frame.height == current_frame.height
+            && _fused_last_frame.layout == current_frame.layout
+            && _fused_last_frame.color_space == current_frame.color_space
+            && _fused_last_frame.value_range == current_frame.value_range
+            && _fused_last_frame.chroma_location == current_frame.chroma_location
+            && _fused_last_frame.stereo_layout == current_frame.stereo_layout);
+}
+
+void video_output::set_frame_region(float x, float y, float w, float h)
+{
+    _region[0] = x;
+    _region[1] = y;
+    _region[2] = w;
+    _region[3] = h;
+}
+
+void video_output::set_color_source(video_output *source)
+{
+    _color_source = (source == this ? NULL : source);
+}
+
 void video_output::activate_next_frame()
 {
+    if (_upload_thread)
+    {
+        GLsync fence = _upload_thread->finish_job();
+        if (fence)
+        {
+            // Let the GPU wait for the upload before it executes our next
+            // commands; this does not block the calling thread.
+            make_context_current();
+            glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+            glDeleteSync(fence);
+        }
+    }
     _active_index = (_active_index == 0 ? 1 : 0);
+    _color_valid = false;
+    for (int i = 0; i < 2; i++)
+    {
+        _color_requested_size[1][i] = _color_requested_size[0][i];
+        _color_requested_size[0][i] = 0;
+    }
     trigger_update();
 }
 
 void video_output::set_parameters(const parameters &params)
 {
     _params = params;
+    _color_valid = false;
     bool context_needs_stereo = (_params.stereo_mode == parameters::stereo);
     if (context_needs_stereo != context_is_stereo())
     {
@@ -642,6 +1186,31 @@ void video_output::set_parameters(const parameters &params)
     trigger_update();
 }
 
+// The texture that holds the given view (0 = left, 1 = right) of a frame, and the
+// position of the view in it, as expected by the color shader.
+static int view_texture(const video_frame &frame, int view)
+{
+    return (frame.has_packed_views() ? 0 : view);
+}
+
+static float view_position(const video_frame &frame, int view)
+{
+    if (!frame.has_packed_views())
+    {
+        return 0.0f;
+    }
+    return (frame.stereo_layout_swap ? 1 - view : view);
+}
+
+static void set_color_uniforms(GLuint prg, const parameters &params)
+{
+    glUniform1f(glGetUniformLocation(prg, "contrast"), params.contrast);
+    glUniform1f(glGetUniformLocation(prg, "brightness"), params.brightness);
+    glUniform1f(glGetUniformLocation(prg, "saturation"), params.saturation);
+    glUniform1f(glGetUniformLocation(prg, "cos_hue"), std::cos(params.hue * M_PI));
+    glUniform1f(glGetUniformLocation(prg, "sin_hue"), std::sin(params.hue * M_PI));
+}
+
 static void draw_quad(float x, float y, float w, float h)
 {
     glBegin(GL_QUADS);
@@ -656,40 +1225,30 @@ static void draw_quad(float x, float y, float w, float h)
     glEnd();
 }
 
-void video_output::display_current_frame(bool mono_right_instead_of_left,
-            float x, float y, float w, float h, const GLint viewport[4])
+bool video_output::color_pass()
 {
-    make_context_current();
-    assert(xgl::CheckError(HERE));
-    clear();
     const video_frame &frame = _frame[_active_index];
     if (!frame.is_valid())
     {
-        return;
-    }
-
-    if (frame.width != _color_last_frame.width
-            || frame.height != _color_last_frame.height
-            || frame.aspect_ratio < _color_last_frame.aspect_ratio
-            || frame.aspect_ratio > _color_last_frame.aspect_ratio
-            || _render_last_params.stereo_mode != _params.stereo_mode)
-    {
-        reshape(width(), height());
+        return false;
     }
-    if (!_color_prg || !color_is_compatible(frame))
+    int size[2];
+    color_size(frame, size);
+    if (!_color_prg || !color_is_compatible(frame)
+            || size[0] != _color_size[0] || size[1] != _color_size[1])
     {
         color_deinit();
-        color_init(frame);
+        color_init(frame, size);
         _color_last_frame = frame;
     }
-    if (!_render_prg || !render_is_compatible())
-    {                
-        render_deinit();
-        render_init();
-        _render_last_params = _params;
+    if (_color_valid)
+    {
+        return true;
     }
 
-    /* Use correct left and right view indices */
+    /* The left view goes into _color_srgb_tex[0], the right view (if it exists)
+     * into _color_srgb_tex[1]. Swapping that depends on the position of the
+     * output is done in the render pass, so that the result can be shared. */
 
     int left = 0;
     int right = (frame.stereo_layout == video_frame::mono ? 0 : 1);
@@ -697,35 +1256,34 @@ void video_output::display_current_frame(bool mono_right_instead_of_left,
     {
         std::swap(left, right);
     }
-    if ((_params.stereo_mode == parameters::even_odd_rows
-                || _params.stereo_mode == parameters::checkerboard)
-            && (pos_y() + viewport[1]) % 2 == 0)
-    {
-        std::swap(left, right);
-    }
-    if ((_params.stereo_mode == parameters::even_odd_columns
-                || _params.stereo_mode == parameters::checkerboard)
-            && (pos_x() + viewport[0]) % 2 == 1)
-    {
-        std::swap(left, right);
-    }
-
-    /* Initialize GL things */
 
     glEnable(GL_TEXTURE_2D);
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
-    /* Step 2: color-correction */
-
+    trace::scope color_pass_trace("color pass");
+    GLint old_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, old_viewport);
     GLboolean scissor_test = glIsEnabled(GL_SCISSOR_TEST);
-    glDisable(GL_SCISSOR_TEST);
+    GLint scissor_box[4];
+    glGetIntegerv(GL_SCISSOR_BOX, scissor_box);
+    // Only convert the part of the frame that was uploaded. The sRGB texture is
+    // upside down relative to the input textures, and may be smaller.
+    const int *region = _input_region[_active_index];
+    float scale_x = static_cast<float>(size[0]) / frame.width;
+    float scale_y = static_cast<float>(size[1]) / frame.height;
+    int x0 = static_cast<int>(std::floor(region[0] * scale_x));
+    int x1 = static_cast<int>(std::ceil((region[0] + region[2]) * scale_x));
+    int y0 = static_cast<int>(std::floor((frame.height - region[1] - region[3]) * scale_y));
+    int y1 = static_cast<int>(std::ceil((frame.height - region[1]) * scale_y));
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x0, y0, x1 - x0, y1 - y0);
     glMatrixMode(GL_MODELVIEW);
     glPushMatrix();
     glLoadIdentity();
     glMatrixMode(GL_PROJECTION);
     glPushMatrix();
     glLoadIdentity();
-    glViewport(0, 0, frame.width, frame.height);
+    glViewport(0, 0, size[0], size[1]);
     glUseProgram(_color_prg);
     if (frame.layout == video_frame::bgra32)
     {
@@ -737,86 +1295,226 @@ void video_output::display_current_frame(bool mono_right_instead_of_left,
         glUniform1i(glGetUniformLocation(_color_prg, "u_tex"), 1);
         glUniform1i(glGetUniformLocation(_color_prg, "v_tex"), 2);
     }
-    glUniform1f(glGetUniformLocation(_color_prg, "contrast"), _params.contrast);
-    glUniform1f(glGetUniformLocation(_color_prg, "brightness"), _params.brightness);
-    glUniform1f(glGetUniformLocation(_color_prg, "saturation"), _params.saturation);
-    glUniform1f(glGetUniformLocation(_color_prg, "cos_hue"), std::cos(_params.hue * M_PI));
-    glUniform1f(glGetUniformLocation(_color_prg, "sin_hue"), std::sin(_params.hue * M_PI));
+    set_color_uniforms(_color_prg, _params);
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _color_fbo);
     // left view: render into _color_srgb_tex[0]
+    int t = view_texture(frame, left);
     if (frame.layout == video_frame::bgra32)
     {
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[_active_index][left]);
+        glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[_active_index][t]);
     }
     else
     {
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[_active_index][left]);
+        glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[_active_index][t]);
         glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[_active_index][left]);
+        glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[_active_index][t]);
         glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[_active_index][left]);
+        glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[_active_index][t]);
     }
+    glUniform1f(glGetUniformLocation(_color_prg, "view"), view_position(frame, left));
     
     glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
             GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _color_srgb_tex[0], 0);
     draw_quad(-1.0f, +1.0f, +2.0f, -2.0f);
     
     // Draw subtitle
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _input_subtitle);
-    draw_quad(-1.0f, +1.0f, +2.0f, -2.0f);
+    if (_input_subtitle_valid[_active_index])
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _input_subtitle_tex[_active_index]);
+        draw_quad(-1.0f, +1.0f, +2.0f, -2.0f);
+    }
     
     // right view: render into _color_srgb_tex[1]
     if (left != right)
     {
+        t = view_texture(frame, right);
         if (frame.layout == video_frame::bgra32)
         {
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[_active_index][right]);
+            glBindTexture(GL_TEXTURE_2D, _input_bgra32_tex[_active_index][t]);
         }
         else
         {
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[_active_index][right]);
+            glBindTexture(GL_TEXTURE_2D, _input_yuv_y_tex[_active_index][t]);
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[_active_index][right]);
+            glBindTexture(GL_TEXTURE_2D, _input_yuv_u_tex[_active_index][t]);
             glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[_active_index][right]);
+            glBindTexture(GL_TEXTURE_2D, _input_yuv_v_tex[_active_index][t]);
         }
+        glUniform1f(glGetUniformLocation(_color_prg, "view"), view_position(frame, right));
         glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
                 GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, _color_srgb_tex[1], 0);
         draw_quad(-1.0f, +1.0f, +2.0f, -2.0f);
     }
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
     glMatrixMode(GL_MODELVIEW);
     glPopMatrix();
-    if (scissor_test)
+    glScissor(scissor_box[0], scissor_box[1], scissor_box[2], scissor_box[3]);
+    if (!scissor_test)
+    {
+        glDisable(GL_SCISSOR_TEST);
+    }
+    color_pass_trace.end();
+    _color_valid = true;
+    return true;
+}
+
+void video_output::display_current_frame(bool mono_right_instead_of_left,
+            float x, float y, float w, float h, const GLint viewport[4])
+{
+    make_context_current();
+    assert(xgl::CheckError(HERE));
+    clear();
+    video_output *src = (_color_source ? _color_source : this);
+    const video_frame &frame = src->_frame[src->_active_index];
+    if (!frame.is_valid())
+    {
+        return;
+    }
+
+    // The resolution at which a view is displayed
+    float view_w = w / 2.0f * viewport[2];
+    float view_h = h / 2.0f * viewport[3];
+    if (_params.stereo_mode == parameters::left_right
+            || _params.stereo_mode == parameters::left_right_half)
+    {
+        view_w /= 2.0f;
+    }
+    else if (_params.stereo_mode == parameters::top_bottom
+            || _params.stereo_mode == parameters::top_bottom_half)
+    {
+        view_h /= 2.0f;
+    }
+    bool fused = fused_is_possible(src, view_w, view_h);
+    const video_frame &last_frame = (fused ? _fused_last_frame : _color_last_frame);
+    const parameters &last_params = (fused ? _fused_last_params : _render_last_params);
+    if (frame.width != last_frame.width
+            || frame.height != last_frame.height
+            || frame.aspect_ratio < last_frame.aspect_ratio
+            || frame.aspect_ratio > last_frame.aspect_ratio
+            || last_params.stereo_mode != _params.stereo_mode)
+    {
+        reshape(width(), height());
+    }
+
+    if (fused)
+    {
+        /* Steps 2 and 3 fused: color-correction happens while rendering */
+
+        if (!_fused_prg || !fused_is_compatible(frame))
+        {
+            fused_deinit();
+            fused_init(src);
+            _fused_last_frame = frame;
+            _fused_last_params = _params;
+        }
+    }
+    else
+    {
+        /* Step 2: color-correction */
+
+        src->color_request_size(frame, view_w, view_h);
+        if (src == this)
+        {
+            color_pass();
+        }
+        else
+        {
+            // The source lives in a different context that shares our objects.
+            // Only switch contexts if it did not convert this frame yet.
+            if (!src->_color_valid)
+            {
+                src->make_context_current();
+                src->color_pass();
+                make_context_current();
+            }
+            _color_last_frame = frame;
+        }
+        if (!_render_prg || !render_is_compatible())
+        {
+            render_deinit();
+            render_init();
+            _render_last_params = _params;
+        }
+    }
+
+    /* Use correct left and right view indices */
+
+    int left = 0;
+    int right = (frame.stereo_layout == video_frame::mono ? 0 : 1);
+    if ((_params.stereo_mode == parameters::even_odd_rows
+                || _params.stereo_mode == parameters::checkerboard)
+            && (pos_y() + viewport[1]) % 2 == 0)
     {
-        glEnable(GL_SCISSOR_TEST);
+        std::swap(left, right);
     }
+    if ((_params.stereo_mode == parameters::even_odd_columns
+                || _params.stereo_mode == parameters::checkerboard)
+            && (pos_x() + viewport[0]) % 2 == 1)
+    {
+        std::swap(left, right);
+    }
+
+    /* Initialize GL things */
 
-    // at this point, the left view is in _color_srgb_tex[0],
-    // and the right view (if it exists) is in _color_srgb_tex[1]
-    right = (left != right ? 1 : 0);
-    left = 0;
+    glEnable(GL_TEXTURE_2D);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
     // Step 3: rendering
-    glUseProgram(_render_prg);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _color_srgb_tex[left]);
-    if (left != right)
+    TRACE_SCOPE("render pass");
+    GLuint prg = (fused ? _fused_prg : _render_prg);
+    glUseProgram(prg);
+    if (fused)
     {
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, _color_srgb_tex[right]);
+        // Bind the input textures of the left view to units 0-2, and those of
+        // the right view to units 3-5. The swapping of views that the color
+        // pass would do happens here instead.
+        int views[2] = { left, right };
+        if (_params.stereo_mode_swap)
+        {
+            std::swap(views[0], views[1]);
+        }
+        const char *names[2][3] = { { "tex0_l", "tex1_l", "tex2_l" }, { "tex0_r", "tex1_r", "tex2_r" } };
+        const char *view_names[2] = { "view_l", "view_r" };
+        for (int v = 0; v < 2; v++)
+        {
+            int i = view_texture(frame, views[v]);
+            int a = src->_active_index;
+            glUniform1f(glGetUniformLocation(prg, view_names[v]), view_position(frame, views[v]));
+            GLuint planes[3] = { src->_input_yuv_y_tex[a][i], src->_input_yuv_u_tex[a][i], src->_input_yuv_v_tex[a][i] };
+            if (frame.layout == video_frame::bgra32)
+            {
+                planes[0] = src->_input_bgra32_tex[a][i];
+            }
+            for (int p = 0; p < 3; p++)
+            {
+                glActiveTexture(GL_TEXTURE0 + 3 * v + p);
+                glBindTexture(GL_TEXTURE_2D, planes[p]);
+                glUniform1i(glGetUniformLocation(prg, names[v][p]), 3 * v + p);
+            }
+        }
+        set_color_uniforms(prg, _params);
+    }
+    else
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, src->_color_srgb_tex[0]);
+        if (left != right)
+        {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, src->_color_srgb_tex[1]);
+        }
+        glUniform1i(glGetUniformLocation(prg, "rgb_l"), left);
+        glUniform1i(glGetUniformLocation(prg, "rgb_r"), right);
     }
-    glUniform1i(glGetUniformLocation(_render_prg, "rgb_l"), left);
-    glUniform1i(glGetUniformLocation(_render_prg, "rgb_r"), right);
-    glUniform1f(glGetUniformLocation(_render_prg, "parallax"), _params.parallax * 0.05f);
+    glUniform1f(glGetUniformLocation(prg, "parallax"), _params.parallax * 0.05f);
     if (_params.stereo_mode != parameters::red_green_monochrome
             && _params.stereo_mode != parameters::red_cyan_half_color
             && _params.stereo_mode != parameters::red_cyan_full_color
@@ -832,7 +1530,7 @@ void video_output::display_current_frame(bool mono_right_instead_of_left,
             && _params.stereo_mode != parameters::red_blue_monochrome
             && _params.stereo_mode != parameters::red_cyan_monochrome)
     {
-        glUniform3f(glGetUniformLocation(_render_prg, "crosstalk"),
+        glUniform3f(glGetUniformLocation(prg, "crosstalk"),
                 _params.crosstalk_r * _params.ghostbust,
                 _params.crosstalk_g * _params.ghostbust,
                 _params.crosstalk_b * _params.ghostbust);
@@ -841,17 +1539,17 @@ void video_output::display_current_frame(bool mono_right_instead_of_left,
             || _params.stereo_mode == parameters::even_odd_columns
             || _params.stereo_mode == parameters::checkerboard)
     {
-        glUniform1i(glGetUniformLocation(_render_prg, "mask_tex"), 2);
-        glUniform1f(glGetUniformLocation(_render_prg, "step_x"), 1.0f / static_cast<float>(viewport[2]));
-        glUniform1f(glGetUniformLocation(_render_prg, "step_y"), 1.0f / static_cast<float>(viewport[3]));
+        glUniform1i(glGetUniformLocation(prg, "mask_tex"), 2);
+        glUniform1f(glGetUniformLocation(prg, "step_x"), 1.0f / static_cast<float>(viewport[2]));
+        glUniform1f(glGetUniformLocation(prg, "step_y"), 1.0f / static_cast<float>(viewport[3]));
     }
 
     if (_params.stereo_mode == parameters::stereo)
     {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 0.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 0.0f);
         glDrawBuffer(GL_BACK_LEFT);
         draw_quad(x, y, w, h);
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 1.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 1.0f);
         glDrawBuffer(GL_BACK_RIGHT);
         draw_quad(x, y, w, h);
     }
@@ -898,29 +1596,29 @@ void video_output::display_current_frame(bool mono_right_instead_of_left,
     else if (_params.stereo_mode == parameters::mono_left
             && !mono_right_instead_of_left)
     {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 0.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 0.0f);
         draw_quad(x, y, w, h);
     }
     else if (_params.stereo_mode == parameters::mono_right
             || (_params.stereo_mode == parameters::mono_left && mono_right_instead_of_left))
     {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 1.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 1.0f);
         draw_quad(x, y, w, h);
     }
     else if (_params.stereo_mode == parameters::left_right
             || _params.stereo_mode == parameters::left_right_half)
     {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 0.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 0.0f);
         draw_quad(-1.0f, -1.0f, 1.0f, 2.0f);
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 1.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 1.0f);
         draw_quad(0.0f, -1.0f, 1.0f, 2.0f);
     }
     else if (_params.stereo_mode == parameters::top_bottom
             || _params.stereo_mode == parameters::top_bottom_half)
     {
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 0.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 0.0f);
         draw_quad(-1.0f, 0.0f, 2.0f, 1.0f);
-        glUniform1f(glGetUniformLocation(_render_prg, "channel"), 1.0f);
+        glUniform1f(glGetUniformLocation(prg, "channel"), 1.0f);
         draw_quad(-1.0f, -1.0f, 2.0f, 1.0f);
     }
     assert(xgl::CheckError(HERE));
@@ -31,6 +31,8 @@
 #include "media_data.h"
 #include "controller.h"
 
+class video_output_upload_thread;
+
 class video_output : public controller
 {
 private:
@@ -45,24 +47,36 @@ private:
 
     video_frame _frame[2];              // input frames (active / preparing)
     parameters _params;                 // current parameters for display
+    float _region[4];                   // needed part of the frame (x, y, w, h; normalized, from bottom left)
     // Step 1: input of video data
-    GLuint _input_pbo;                  // pixel-buffer object for texture uploading
+    GLuint _input_pbo[2];               // pixel-buffer object for texture uploading
     GLuint _input_yuv_y_tex[2][2];      // for yuv formats: y component
     GLuint _input_yuv_u_tex[2][2];      // for yuv formats: u component
     GLuint _input_yuv_v_tex[2][2];      // for yuv formats: v component
     GLuint _input_bgra32_tex[2][2];     // for bgra32 format
-    GLuint _input_subtitle;               // for subtitle
+    GLuint _input_subtitle_tex[2];      // for subtitles
+    bool _input_subtitle_valid[2];      // whether the subtitle texture holds a subtitle for this frame
     int _input_yuv_chroma_width_divisor[2];     // for yuv formats: chroma subsampling
     int _input_yuv_chroma_height_divisor[2];    // for yuv formats: chroma subsampling
+    int _input_region[2][4];            // part of the input that was uploaded (x, y, w, h; pixels from top left)
+    video_output_upload_thread *_upload_thread; // uploads in a context of its own, or NULL
     // Step 2: rendering
     video_frame _color_last_frame;      // last frame for this step; used for reinitialization check
     GLuint _color_prg;                  // color space transformation, color adjustment
     GLuint _color_fbo;                  // framebuffer object to render into the sRGB texture
     GLuint _color_srgb_tex[2];          // output: sRGB texture
+    int _color_size[2];                 // size of the sRGB textures; smaller than the frame when downscaling
+    int _color_requested_size[2][2];    // largest view size requested by displays of this ([0]) and the last frame ([1])
+    bool _color_valid;                  // whether the sRGB textures hold the current frame
+    video_output *_color_source;        // video output whose sRGB textures we display, or NULL
     // Step 3: rendering
     parameters _render_last_params;     // last params for this step; used for reinitialization check
     GLuint _render_prg;                 // reads sRGB texture, renders according to _params[_active_index]
     GLuint _render_mask_tex;            // for the masking modes even-odd-{rows,columns}, checkerboard
+    // Steps 2 and 3 fused: rendering directly from the input textures
+    video_frame _fused_last_frame;      // last frame for this step; used for reinitialization check
+    parameters _fused_last_params;      // last params for this step; used for reinitialization check
+    GLuint _fused_prg;                  // color conversion and rendering in one pass
     // OpenGL Viewport for drawing the video frame
     GLint _viewport[4];
     
@@ -72,14 +86,25 @@ private:
     void input_init(int index, const video_frame &frame);
     void input_deinit(int index);
     bool input_is_compatible(int index, const video_frame &current_frame);
+    void input_region(const video_frame &frame, int region[4]);
+    void input_upload(int index, const video_frame &frame);
+    void input_upload_subtitle(int index, const subtitle_box &subtitle, parameters &params);
     // Step 2: initialize/deinitialize, and check if reinitialization is necessary
-    void color_init(const video_frame &frame);
+    void color_init(const video_frame &frame, const int size[2]);
     void color_deinit();
     bool color_is_compatible(const video_frame &current_frame);
+    void color_request_size(const video_frame &frame, float w, float h);
+    void color_size(const video_frame &frame, int size[2]);
+    bool color_pass();
     // Step 3: initialize/deinitialize, and check if reinitialization is necessary
     void render_init();
     void render_deinit();
     bool render_is_compatible();
+    // Steps 2 and 3 fused: initialize/deinitialize, and check if reinitialization is necessary
+    bool fused_is_possible(const video_output *src, float view_w, float view_h);
+    void fused_init(const video_output *src);
+    void fused_deinit();
+    bool fused_is_compatible(const video_frame &current_frame);
 
 protected:
     virtual void make_context_current() = 0;    // Make sure our OpenGL context is current
@@ -88,6 +113,14 @@ protected:
     virtual void trigger_update() = 0;          // Trigger a redraw (i.e. make GL context current and call display())
     virtual void trigger_resize(int w, int h) = 0;      // Trigger a resize the video area
 
+    /* Optional: a second OpenGL context that shares objects with ours, used by a
+     * separate thread to upload frames. It is created and destroyed while our
+     * context is current, and only made current in the upload thread. */
+    virtual bool create_upload_context() { return false; }      // Return false if not supported
+    virtual void destroy_upload_context() { }
+    virtual void make_upload_context_current() { }      // Called from the upload thread
+    virtual void done_upload_context_current() { }      // Called from the upload thread
+
     void clear();                               // Clear the video area
     void reshape(int w, int h);                 // Call this when the video area was resized
     bool need_redisplay_on_move();              // Whether we need to redisplay if the video area moved
@@ -145,15 +178,30 @@ public:
     virtual bool has_events() = 0;
     virtual void process_events() = 0;
     
-    /* Prepare a new frame for display. */
+    /* Prepare a new frame for display. If the video output has an upload thread,
+     * this only starts the upload, and the frame data must remain valid until
+     * wait_for_frame_copy() returns. */
     void prepare_next_frame(const video_frame &frame, const subtitle_box &subtitle);
+    void wait_for_frame_copy();
     /* Switch to the next frame (make it the current one) */
     void activate_next_frame();
     /* Set display parameters. */
     void set_parameters(const parameters &params);
+    /* Restrict uploading and color conversion of the following frames to the given
+     * part of the frame, because only this part will be displayed. The rectangle is
+     * given in normalized coordinates relative to the bottom left corner of the
+     * displayed frame. The default is the full frame. */
+    void set_frame_region(float x, float y, float w, float h);
+    /* Display the frames of another video output instead of our own, so that
+     * uploading and color conversion happen only once. The OpenGL context of the
+     * source must share objects with ours. Frames must then be prepared and
+     * activated only on the source. Pass NULL to use our own frames again. */
+    void set_color_source(video_output *source);
 
     /* Receive a notification from the player. */
     virtual void receive_notification(const notification &note) = 0;
+
+    friend class video_output_upload_thread;
 };
 
 #endif
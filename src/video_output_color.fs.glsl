@@ -20,6 +20,11 @@
 
 #version 120
 
+// color_pass_separate: this shader renders the sRGB textures of the color pass
+// color_pass_fused: this code only provides get_srgb() to the render shader,
+//   which follows it (see video_output_render.fs.glsl)
+#define $color_pass
+
 // layout_yuv_p
 // layout_bgra32
 #define $layout
@@ -33,19 +38,27 @@
 // value_range_8bit_mpeg
 #define $value_range
 
+// packing_none: each texture holds one view
+// packing_top_bottom: the textures hold both views, left view on top
+// packing_left_right: the textures hold both views, left view on the left
+// packing_even_odd_rows: the textures hold both views, left view in the even rows
+#define $packing
+
+// the size of one view in the Y (or BGRA) texture and in the U and V textures, in texels
+#define luma_size $luma_size
+#define chroma_size $chroma_size
+
+// color_pass_separate only: the size of the output texture, and the number of
+// input samples per output pixel in each direction (1 unless downscaling)
+#define output_size $output_size
+#define downscale_taps_x $downscale_taps_x
+#define downscale_taps_y $downscale_taps_y
+
 // the offset between the y texture coordinates and the appropriate
 // u and v texture coordinates, according to the chroma sample location
 #define chroma_offset_x $chroma_offset_x
 #define chroma_offset_y $chroma_offset_y
 
-#if defined(layout_yuv_p)
-uniform sampler2D y_tex;
-uniform sampler2D u_tex;
-uniform sampler2D v_tex;
-#elif defined(layout_bgra32)
-uniform sampler2D srgb_tex;
-#endif
-
 uniform float contrast;
 uniform float brightness;
 uniform float saturation;
@@ -110,22 +123,97 @@ vec3 adjust_yuv(vec3 yuv)
     return vec3(ay, au, av);
 }
 
-vec3 get_yuv(vec2 tex_coord)
+// Sample the given view (0.0 for the first, 1.0 for the second) of a texture.
+// The texture coordinates refer to the view; size is the view size in texels.
+vec4 sample_view(sampler2D tex, vec2 size, vec2 tex_coord, float view)
+{
+#if defined(packing_none)
+    return texture2D(tex, tex_coord);
+#else
+    // Do not let filtering reach into the other view; a texture with only this
+    // view would clamp to its edge.
+    vec2 c = clamp(tex_coord, vec2(0.5) / size, vec2(1.0) - vec2(0.5) / size);
+# if defined(packing_top_bottom)
+    return texture2D(tex, vec2(c.x, (c.y + view) / 2.0));
+# elif defined(packing_left_right)
+    return texture2D(tex, vec2((c.x + view) / 2.0, c.y));
+# elif defined(packing_even_odd_rows)
+    // The rows of the two views alternate, so vertical interpolation must
+    // be done here, between the two nearest rows of this view.
+    float t = c.y * size.y - 0.5;
+    float r0 = floor(t);
+    float r1 = min(r0 + 1.0, size.y - 1.0);
+    vec4 s0 = texture2D(tex, vec2(c.x, (2.0 * r0 + view + 0.5) / (2.0 * size.y)));
+    vec4 s1 = texture2D(tex, vec2(c.x, (2.0 * r1 + view + 0.5) / (2.0 * size.y)));
+    return mix(s0, s1, t - r0);
+# endif
+#endif
+}
+
+// For layout_bgra32, only the first texture is used: it holds the sRGB data.
+// For layout_yuv_p, the textures hold the Y, U, and V planes.
+vec3 get_yuv(sampler2D tex0, sampler2D tex1, sampler2D tex2, vec2 tex_coord, float view)
 {
 #if defined(layout_bgra32)
-    return srgb_to_yuv(texture2D(srgb_tex, tex_coord).xyz);
+    return srgb_to_yuv(sample_view(tex0, luma_size, tex_coord, view).xyz);
 #elif defined(layout_yuv_p)
     return vec3(
-            texture2D(y_tex, tex_coord).x,
-            texture2D(u_tex, tex_coord + vec2(chroma_offset_x, chroma_offset_y)).x,
-            texture2D(v_tex, tex_coord + vec2(chroma_offset_x, chroma_offset_y)).x);
+            sample_view(tex0, luma_size, tex_coord, view).x,
+            sample_view(tex1, chroma_size, tex_coord + vec2(chroma_offset_x, chroma_offset_y), view).x,
+            sample_view(tex2, chroma_size, tex_coord + vec2(chroma_offset_x, chroma_offset_y), view).x);
 #endif
 }
 
-void main()
+vec3 get_srgb(sampler2D tex0, sampler2D tex1, sampler2D tex2, vec2 tex_coord, float view)
 {
-    vec3 yuv = get_yuv(gl_TexCoord[0].xy);
+    vec3 yuv = get_yuv(tex0, tex1, tex2, tex_coord, view);
     vec3 adjusted_yuv = adjust_yuv(yuv);
-    vec3 srgb = yuv_to_srgb(adjusted_yuv);
-    gl_FragColor = vec4(srgb, 1.0);
+    return yuv_to_srgb(adjusted_yuv);
 }
+
+#if defined(color_pass_separate)
+
+#if defined(layout_yuv_p)
+uniform sampler2D y_tex;
+uniform sampler2D u_tex;
+uniform sampler2D v_tex;
+#elif defined(layout_bgra32)
+uniform sampler2D srgb_tex;
+#endif
+uniform float view;
+
+vec3 get_view_yuv(vec2 tex_coord)
+{
+#if defined(layout_bgra32)
+    return get_yuv(srgb_tex, srgb_tex, srgb_tex, tex_coord, view);
+#elif defined(layout_yuv_p)
+    return get_yuv(y_tex, u_tex, v_tex, tex_coord, view);
+#endif
+}
+
+void main()
+{
+#if downscale_taps_x == 1 && downscale_taps_y == 1
+    vec3 yuv = get_view_yuv(gl_TexCoord[0].xy);
+#else
+    // The output is smaller than the input: average a grid of samples that
+    // covers the area of the output pixel, so that no input texel is skipped.
+    // The color conversion and adjustment are affine, so they can be applied
+    // to the average.
+    vec2 taps = vec2(float(downscale_taps_x), float(downscale_taps_y));
+    vec2 delta = vec2(1.0) / (output_size * taps);
+    vec2 origin = gl_TexCoord[0].xy - vec2(0.5) / output_size + 0.5 * delta;
+    vec3 yuv = vec3(0.0);
+    for (int i = 0; i < downscale_taps_y; i++)
+    {
+        for (int j = 0; j < downscale_taps_x; j++)
+        {
+            yuv += get_view_yuv(origin + vec2(float(j), float(i)) * delta);
+        }
+    }
+    yuv /= taps.x * taps.y;
+#endif
+    gl_FragColor = vec4(yuv_to_srgb(adjust_yuv(yuv)), 1.0);
+}
+
+#endif
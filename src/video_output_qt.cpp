@@ -38,6 +38,7 @@ static GLEWContext* glewGetContext() { return &_glewContext; }
 #include <QMessageBox>
 #include <QPalette>
 #include <QTextCodec>
+#include <QThread>
 
 #include "exc.h"
 #include "msg.h"
@@ -241,6 +242,7 @@ video_output_qt::video_output_qt(bool benchmark, video_container_widget *contain
     _container_widget(container_widget),
     _container_is_external(container_widget != NULL),
     _widget(NULL),
+    _upload_widget(NULL),
     _fullscreen(false),
     _playing(false),
     _subtitle_encoder(NULL)
@@ -381,6 +383,49 @@ void video_output_qt::recreate_context(bool stereo)
     clear();
 }
 
+bool video_output_qt::create_upload_context()
+{
+    // See "Texture uploading in a thread" in the QGLWidget documentation
+    _upload_widget = new QGLWidget(_format, NULL, _widget);
+    bool ok = (_upload_widget->isValid() && _upload_widget->isSharing());
+    if (ok)
+    {
+        _upload_widget->doneCurrent();
+    }
+    else
+    {
+        msg::dbg("Cannot create a shared OpenGL context for uploading frames.");
+        delete _upload_widget;
+        _upload_widget = NULL;
+    }
+    _widget->makeCurrent();
+    return ok;
+}
+
+void video_output_qt::destroy_upload_context()
+{
+    // The context was moved back to our thread by done_upload_context_current()
+    delete _upload_widget;
+    _upload_widget = NULL;
+}
+
+void video_output_qt::make_upload_context_current()
+{
+#if QT_VERSION >= 0x040800
+    // Qt only makes a context current in the thread that it belongs to
+    _upload_widget->context()->moveToThread(QThread::currentThread());
+#endif
+    _upload_widget->makeCurrent();
+}
+
+void video_output_qt::done_upload_context_current()
+{
+    _upload_widget->doneCurrent();
+#if QT_VERSION >= 0x040800
+    _upload_widget->context()->moveToThread(_widget->thread());
+#endif
+}
+
 void video_output_qt::trigger_update()
 {
     _widget->update();
@@ -569,30 +614,27 @@ void video_output_qt::process_events()
 
 void video_output_qt::receive_notification(const notification &note)
 {
-    std::istringstream current(note.current);
-   
     switch(note.type)
     {
     case notification::play:
-        s11n::load(current, _playing);
+        _playing = note.current.get_bool();
         break;
         
     case notification::subtitles_font:
-        _subtitle_font.fromString(note.current.c_str());
+        _subtitle_font.fromString(note.current.get_string().c_str());
         break;
         
     case notification::subtitles_color:
 //         if(_subtitle_painter)
 //         {
-//             int color;
-//             s11n::load(current, color);
+//             int color = note.current.get_int();
 //             _subtitle_painter->setPen(QColor(QRgb(color)));
 //             QPainter p;
 //         }
         break;
         
     case notification::subtitles_encoding:       
-        _subtitle_encoder = QTextCodec::codecForName(note.current.c_str());
+        _subtitle_encoder = QTextCodec::codecForName(note.current.get_string().c_str());
         break;
     }
     /* More is currently not implemented.
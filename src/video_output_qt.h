@@ -85,6 +85,7 @@ private:
     video_container_widget *_container_widget;
     bool _container_is_external;
     video_output_qt_widget *_widget;
+    QGLWidget *_upload_widget;          // hidden; provides the context of the upload thread
     QGLFormat _format;
     bool _fullscreen;
     bool _playing;
@@ -101,6 +102,10 @@ protected:
     virtual void recreate_context(bool stereo);
     virtual void trigger_update();
     virtual void trigger_resize(int w, int h);
+    virtual bool create_upload_context();
+    virtual void destroy_upload_context();
+    virtual void make_upload_context_current();
+    virtual void done_upload_context_current();
     
     bool render_subtitle(const subtitle_box& subtitle, parameters& params, void* buffer, int w, int h);
 
@@ -41,8 +41,24 @@
 // mode_checkerboard
 #define $mode
 
+// color_input_textures: read the sRGB textures rendered by the color pass
+// color_input_fused: convert the input textures directly, using get_srgb()
+//   from video_output_color.fs.glsl, which precedes this code
+#define $color_input
+
+#if defined(color_input_fused)
+uniform sampler2D tex0_l;
+uniform sampler2D tex1_l;
+uniform sampler2D tex2_l;
+uniform sampler2D tex0_r;
+uniform sampler2D tex1_r;
+uniform sampler2D tex2_r;
+uniform float view_l;
+uniform float view_r;
+#else
 uniform sampler2D rgb_l;
 uniform sampler2D rgb_r;
+#endif
 uniform float parallax;
 
 #if defined(mode_onechannel)
@@ -72,6 +88,25 @@ float linear_to_nonlinear(float x)
     return (x <= 0.0031308 ? (x * 12.92) : (1.055 * pow(x, 1.0 / 2.4) - 0.055));
 }
 
+#if defined(color_input_fused)
+float nonlinear_to_linear(float x)
+{
+    return (x <= 0.04045 ? (x / 12.92) : pow((x + 0.055) / 1.055, 2.4));
+}
+
+vec3 srgb_to_rgb(vec3 srgb)
+{
+    // This replaces the conversion that the GL does when reading from the
+    // sRGB textures of the color pass, including the clamping on storage.
+    srgb = clamp(srgb, 0.0, 1.0);
+# if $srgb_broken
+    return srgb;
+# else
+    return vec3(nonlinear_to_linear(srgb.r), nonlinear_to_linear(srgb.g), nonlinear_to_linear(srgb.b));
+# endif
+}
+#endif
+
 vec3 rgb_to_srgb(vec3 rgb)
 {
 #if $srgb_broken
@@ -102,6 +137,38 @@ vec3 ghostbust(vec3 original, vec3 other)
 }
 #endif
 
+#if defined(color_input_fused)
+// Interpolate bilinearly between the four texels of a view that are nearest
+// to the given view coordinates. The GL would interpolate the nonlinear input
+// values, so each texel is converted to linear RGB first, just like the GL
+// does when filtering the sRGB textures of the color pass.
+vec3 tex_fused(sampler2D tex0, sampler2D tex1, sampler2D tex2, vec2 tex_coord, float view)
+{
+    vec2 t = tex_coord * luma_size - vec2(0.5);
+    vec2 t0 = floor(t);
+    vec2 f = t - t0;
+    vec2 c0 = (t0 + vec2(0.5)) / luma_size;
+    vec2 c1 = (t0 + vec2(1.5)) / luma_size;
+    vec3 rgb00 = srgb_to_rgb(get_srgb(tex0, tex1, tex2, c0, view));
+    vec3 rgb10 = srgb_to_rgb(get_srgb(tex0, tex1, tex2, vec2(c1.x, c0.y), view));
+    vec3 rgb01 = srgb_to_rgb(get_srgb(tex0, tex1, tex2, vec2(c0.x, c1.y), view));
+    vec3 rgb11 = srgb_to_rgb(get_srgb(tex0, tex1, tex2, c1, view));
+    return mix(mix(rgb00, rgb10, f.x), mix(rgb01, rgb11, f.x), f.y);
+}
+
+// The input textures are upside down relative to the sRGB textures.
+vec3 tex_l(vec2 texcoord)
+{
+    vec2 c = texcoord - vec2(parallax, 0.0);
+    return tex_fused(tex0_l, tex1_l, tex2_l, vec2(c.x, 1.0 - c.y), view_l);
+}
+
+vec3 tex_r(vec2 texcoord)
+{
+    vec2 c = texcoord + vec2(parallax, 0.0);
+    return tex_fused(tex0_r, tex1_r, tex2_r, vec2(c.x, 1.0 - c.y), view_r);
+}
+#else
 vec3 tex_l(vec2 texcoord)
 {
     return texture2D(rgb_l, texcoord - vec2(parallax, 0.0)).rgb;
@@ -111,6 +178,7 @@ vec3 tex_r(vec2 texcoord)
 {
     return texture2D(rgb_r, texcoord + vec2(parallax, 0.0)).rgb;
 }
+#endif
 
 void main()
 {